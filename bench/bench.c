@@ -0,0 +1,1320 @@
+/*******************************************************************************
+ * bench.c
+ * Description - Benchmark driver for smallsh, built and run by 'make bench'.
+ * The shell itself is measured from the outside: how long it takes to start
+ * and exit, and how long a line takes from being typed at a terminal to the
+ * next prompt, for builtins and for commands that are spawned or forked. The
+ * tokenizer, $ expansion, the environment handed to commands, 
+ * reapChildren and exiting with jobs running are measured in this process, by
+ * including smallsh.c and calling them directly. Results go to stdout as
+ * JSON, so runs can be kept and compared.
+ *
+ * With -f, the benchmarks are skipped and lexSpan is fuzzed against
+ * lexSpanScalar instead, and quoted $ expansions are checked, see fuzzLexer;
+ * the exit status is 1 if anything differs.
+ *
+ * Usage: bench [-n runs] [-j maxjobs] [-s stressjobs] [-f lines] [shell]
+ *
+ * ****************************************************************************/
+
+#define main smallshMain
+#include "../smallsh.c"
+#undef main
+
+#include <pty.h>
+#include <sys/ptrace.h>
+
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+#ifndef BENCH_CFLAGS
+#define BENCH_CFLAGS ""
+#endif
+
+#define BENCHTIME 500000000LL  // ns each throughput test runs for, at least
+#define IDLECALLS 100000       // reapChildren calls timed with nothing to reap
+#define TOKENBYTES (1 << 20)   // size of the line the tokenizer is timed on
+#define EXPANDWORDS 16384      // words in each expandWords call
+#define DENSECOPIES 100        // copies of "$$/$?/$HOME/" in one dense word
+#define ENVVARS 200            // variables added for the large environment
+#define ENVCALLS 100000        // calls timed by benchEnv
+#define SHUTDOWNWAIT 0.2       // seconds benchShutdown's jobs get before SIGKILL
+#define FUZZBYTES 520          // longest line fuzzLexer makes
+#define PIPEBYTES (4LL << 30)  // bytes benchPipe sends through a pipeline
+#define PIPERUNS 5             // times benchPipe runs each pipeline
+#define SATURATEJOBS 4         // jobs per cpu benchParallel runs
+#define ALLOCLINES 1000000     // lines of benchAlloc's long script
+#define LOOPPASSES 1000        // passes of benchLoop's for loop
+#define LOOPRUNS 5             // times benchLoop runs each loop
+// the PATH benchPath searches, the usual one
+#define BENCHPATH "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin"
+#define PATHCALLS 100000       // lookups timed by benchPath
+
+struct samples {
+	double* ns;          // one time per run
+	int count;           // runs timed
+};
+
+extern char** environ;
+
+#if !defined(__SANITIZE_ADDRESS__)
+// glibc's own allocator, under the counting malloc below
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+#endif
+
+long allocCount = -1;    // heap allocations made, -1 when not counting
+int allocFd = -1;        // where countAllocs' child sends allocCount
+
+
+
+
+/*******************************************************************************
+ * nowNs
+ * returns the monotonic clock in nanoseconds.
+ *
+ * ****************************************************************************/
+long long nowNs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+
+
+#if !defined(__SANITIZE_ADDRESS__)
+/*******************************************************************************
+ * malloc, calloc, realloc
+ * stand in for glibc's for everything in this process, libc included, and 
+ * count the calls that allocate while allocCount isn't -1. Left out of 
+ * sanitizer builds, which have their own.
+ *
+ * ****************************************************************************/
+void* malloc(size_t size){
+	if (allocCount >= 0){
+		allocCount++;
+	}
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size){
+	if (allocCount >= 0){
+		allocCount++;
+	}
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size){
+	if (allocCount >= 0){
+		allocCount++;
+	}
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+
+
+
+/*******************************************************************************
+ * initSamples
+ * makes room for count timings.
+ *
+ * ****************************************************************************/
+void initSamples(struct samples* s, int count){
+	s->ns = malloc(count * sizeof(double));
+	if (s->ns == NULL){
+		perror("malloc");
+		exit(1);
+	}
+	s->count = 0;
+}
+
+
+
+
+/*******************************************************************************
+ * compareDoubles
+ * qsort comparator for sorting the timings.
+ *
+ * ****************************************************************************/
+int compareDoubles(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+
+
+
+/*******************************************************************************
+ * printSamples
+ * writes the timings, in microseconds, as a JSON object of their min,
+ * median, 90th and 99th percentiles and mean, and frees them.
+ *
+ * ****************************************************************************/
+void printSamples(FILE* out, struct samples* s){
+	double sum = 0;
+	int i;
+	if (s->count == 0){
+		fprintf(out, "null");
+		free(s->ns);
+		return;
+	}
+	qsort(s->ns, s->count, sizeof(double), compareDoubles);
+	for (i = 0; i < s->count; i++){
+		sum += s->ns[i];
+	}
+	fprintf(out, "{\"runs\": %d, \"min\": %.2f, \"median\": %.2f, "
+			"\"p90\": %.2f, \"p99\": %.2f, \"mean\": %.2f}",
+			s->count, s->ns[0] / 1000, s->ns[s->count / 2] / 1000,
+			s->ns[s->count * 9 / 10] / 1000,
+			s->ns[s->count * 99 / 100] / 1000, sum / s->count / 1000);
+	free(s->ns);
+}
+
+
+
+
+/*******************************************************************************
+ * benchStartup
+ * times starting the shell with -c command and waiting for it to exit, runs
+ * times, with its input, output and errors on /dev/null.
+ *
+ * ****************************************************************************/
+void benchStartup(const char* shell, const char* command, int runs,
+		struct samples* s){
+	char* argv[] = {(char*)shell, "-c", (char*)command, NULL};
+	posix_spawn_file_actions_t actions;
+	long long start;
+	pid_t pid;
+	int status;
+	int i;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+	initSamples(s, runs);
+	for (i = 0; i < runs; i++){
+		start = nowNs();
+		if (posix_spawn(&pid, shell, &actions, NULL, argv, environ) != 0){
+			perror(shell);
+			exit(1);
+		}
+		waitpid(pid, &status, 0);
+		s->ns[s->count++] = nowNs() - start;
+	}
+	posix_spawn_file_actions_destroy(&actions);
+}
+
+
+
+
+/*******************************************************************************
+ * benchPipe
+ * times PIPEBYTES of zeros going from head to wc through link, '|' or '|>',
+ * with the shell started for each of PIPERUNS runs, and writes the best and
+ * median GB/s. A '|' is just a pipe between the two, a '|>' has the shell
+ * splicing the data from one pipe to the next.
+ *
+ * ****************************************************************************/
+void benchPipe(FILE* out, const char* shell, const char* link){
+	char command[128];
+	struct samples s;
+
+	snprintf(command, sizeof(command), "head -c %lld /dev/zero %s wc -c",
+			PIPEBYTES, link);
+	benchStartup(shell, command, PIPERUNS, &s);
+	qsort(s.ns, s.count, sizeof(double), compareDoubles);
+	fprintf(out, "{\"bytes\": %lld, \"runs\": %d, \"best_gb_per_s\": %.2f, "
+			"\"median_gb_per_s\": %.2f}", PIPEBYTES, s.count,
+			PIPEBYTES / s.ns[0], PIPEBYTES / s.ns[s.count / 2]);
+	free(s.ns);
+}
+
+
+
+
+/*******************************************************************************
+ * sendAllocs
+ * atexit handler of countAllocs' child, sends its count to the parent.
+ *
+ * ****************************************************************************/
+void sendAllocs(void){
+	if (write(allocFd, &allocCount, sizeof(allocCount)) == -1){
+		_exit(1);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * countAllocs
+ * runs the shell's own main on script, in a child so its exit is no matter,
+ * and returns how many heap allocations it made from start to exit, or -1
+ * if they couldn't be counted.
+ *
+ * ****************************************************************************/
+long countAllocs(const char* script){
+	char* argv[] = {"smallsh", "-f", (char*)script, NULL};
+	long count = -1;
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) == -1){
+		perror("pipe");
+		exit(1);
+	}
+	fflush(NULL);
+	pid = fork();
+	if (pid == -1){
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0){
+		close(fds[0]);
+		allocFd = fds[1];
+		atexit(sendAllocs);
+		// smallshMain reads its own options
+		optind = 0;
+		allocCount = 0;
+		smallshMain(3, argv);
+		exit(0);
+	}
+	close(fds[1]);
+	if (read(fds[0], &count, sizeof(count)) != sizeof(count)){
+		count = -1;
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return count;
+}
+
+
+
+
+/*******************************************************************************
+ * benchAlloc
+ * counts the heap allocations the shell makes running a script of 
+ * ALLOCLINES lines, builtins, variables, lists and comments, and one of a
+ * thousand of the same lines. Each command's memory comes from the arena,
+ * so the two should be about the same, the difference is per_line.
+ *
+ * ****************************************************************************/
+void benchAlloc(FILE* out){
+	const char* lines[] = {
+		"echo one two three $$",
+		"X=$? Y=two",
+		"true && test 1 -lt 2 || false",
+		"# a comment",
+		"if [ $X = 0 ]; then true; else false; fi",
+	};
+	char file[] = "/tmp/bench-allocXXXXXX";
+	long counts[2];
+	int sizes[2] = {1000, ALLOCLINES};
+	FILE* script;
+	int fd;
+	int i, j;
+
+#if defined(__SANITIZE_ADDRESS__)
+	fprintf(out, "null");
+	return;
+#endif
+	for (i = 0; i < 2; i++){
+		fd = mkstemp(file);
+		if (fd == -1 || (script = fdopen(fd, "w")) == NULL){
+			perror(file);
+			exit(1);
+		}
+		for (j = 0; j < sizes[i]; j++){
+			fprintf(script, "%s\n", lines[j % 5]);
+		}
+		fclose(script);
+		counts[i] = countAllocs(file);
+		unlink(file);
+		strcpy(file, "/tmp/bench-allocXXXXXX");
+	}
+	fprintf(out, "{\"lines\": %d, \"allocs\": %ld, \"allocs_%d_lines\": "
+			"%ld, \"per_line\": %.6f}", sizes[1], counts[1], sizes[0],
+			counts[0], (double)(counts[1] - counts[0]) / 
+			(sizes[1] - sizes[0]));
+}
+
+
+
+
+/*******************************************************************************
+ * benchLoop
+ * times a for loop of LOOPPASSES passes that runs body, in the shell started
+ * with -c for each of LOOPRUNS runs, and writes the best and median us per 
+ * pass. Run with builtins like echo and test, and with the same commands 
+ * from /bin, it shows what not forking saves.
+ *
+ * ****************************************************************************/
+void benchLoop(FILE* out, const char* shell, const char* body){
+	char* command;
+	size_t size = LOOPPASSES * 8 + strlen(body) + 64;
+	size_t len;
+	struct samples s;
+	int i;
+
+	command = malloc(size);
+	if (command == NULL){
+		perror("malloc");
+		exit(1);
+	}
+	len = snprintf(command, size, "for i in");
+	for (i = 1; i <= LOOPPASSES; i++){
+		len += snprintf(command + len, size - len, " %d", i);
+	}
+	snprintf(command + len, size - len, "; do %s; done", body);
+	benchStartup(shell, command, LOOPRUNS, &s);
+	qsort(s.ns, s.count, sizeof(double), compareDoubles);
+	fprintf(out, "{\"passes\": %d, \"best_us_per_pass\": %.2f, "
+			"\"median_us_per_pass\": %.2f}", LOOPPASSES, 
+			s.ns[0] / 1000 / LOOPPASSES, 
+			s.ns[s.count / 2] / 1000 / LOOPPASSES);
+	free(s.ns);
+	free(command);
+}
+
+
+
+
+/*******************************************************************************
+ * benchParallel
+ * runs SATURATEJOBS cpu bound jobs per cpu with parallel -j <cpus>, in a 
+ * shell of their own, and writes the wall time, the cpu time they used and 
+ * how much of the machine that is. Near 1.0 means parallel kept every cpu 
+ * busy, refilling slots as fast as jobs finished.
+ *
+ * ****************************************************************************/
+void benchParallel(FILE* out, const char* shell){
+	char file[] = "/tmp/bench-parallelXXXXXX";
+	char command[128];
+	char* argv[] = {(char*)shell, "-c", command, NULL};
+	posix_spawn_file_actions_t actions;
+	struct rusage usage;      // of the shell and everything it ran
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	long long start, wall;
+	double cpu;
+	FILE* jobs;
+	int status;
+	pid_t pid;
+	int fd;
+	int i;
+
+	if (cpus < 1){
+		cpus = 1;
+	}
+	fd = mkstemp(file);
+	if (fd == -1 || (jobs = fdopen(fd, "w")) == NULL){
+		perror(file);
+		exit(1);
+	}
+	for (i = 0; i < SATURATEJOBS * cpus; i++){
+		fprintf(jobs, "head -c 64M /dev/zero | md5sum\n");
+	}
+	fclose(jobs);
+	snprintf(command, sizeof(command), "parallel -j %ld %s", cpus, file);
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+	start = nowNs();
+	if (posix_spawn(&pid, shell, &actions, NULL, argv, environ) != 0){
+		perror(shell);
+		exit(1);
+	}
+	wait4(pid, &status, 0, &usage);
+	wall = nowNs() - start;
+	posix_spawn_file_actions_destroy(&actions);
+	unlink(file);
+
+	cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	fprintf(out, "{\"cpus\": %ld, \"jobs\": %ld, \"wall_s\": %.3f, "
+			"\"cpu_s\": %.3f, \"saturation\": %.3f}", cpus, 
+			SATURATEJOBS * cpus, wall / 1e9, cpu, 
+			cpu / (wall / 1e9) / cpus);
+}
+
+
+
+
+/*******************************************************************************
+ * waitPrompt
+ * reads the shell's output from the pty until it ends with the ": " prompt.
+ * Returns false if the shell went away or took over 5 seconds.
+ *
+ * ****************************************************************************/
+bool waitPrompt(int fd){
+	char buf[4096];
+	char last[2] = {0, 0};   // the last two bytes read
+	ssize_t got;
+	struct pollfd pfd = {fd, POLLIN, 0};
+
+	while (1){
+		if (poll(&pfd, 1, 5000) <= 0){
+			return false;
+		}
+		got = read(fd, buf, sizeof(buf));
+		if (got <= 0){
+			return false;
+		}
+		if (got == 1){
+			last[0] = last[1];
+			last[1] = buf[0];
+		}
+		else {
+			last[0] = buf[got - 2];
+			last[1] = buf[got - 1];
+		}
+		if (last[0] == ':' && last[1] == ' '){
+			return true;
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * benchPrompt
+ * starts the shell on a pty, as a user at a terminal would, and times line
+ * from being written to the terminal until the next prompt, runs times after
+ * a few untimed ones. The line editor is left off (TERM=dumb) so the prompt
+ * is easy to spot, and the history is kept in memory. SMALLSH_SPAWN is set
+ * to spawn, and extraVars more variables are put in the shell's environment.
+ *
+ * ****************************************************************************/
+void benchPrompt(const char* shell, const char* line, const char* spawn,
+		int extraVars, int runs, struct samples* s){
+	char* argv[] = {(char*)shell, NULL};
+	size_t len = strlen(line);
+	long long start;
+	pid_t pid;
+	int master;
+	int status;
+	char name[32];
+	int i;
+
+	initSamples(s, runs);
+	pid = forkpty(&master, NULL, NULL, NULL);
+	if (pid == -1){
+		perror("forkpty");
+		exit(1);
+	}
+	if (pid == 0){
+		setenv("TERM", "dumb", 1);
+		setenv("HISTFILE", "", 1);
+		setenv("SMALLSH_SPAWN", spawn, 1);
+		for (i = 0; i < extraVars; i++){
+			snprintf(name, sizeof(name), "BENCH_VAR_%d", i);
+			setenv(name, "/some/fairly/typical/value/of/forty/bytes", 1);
+		}
+		execv(shell, argv);
+		perror(shell);
+		_exit(127);
+	}
+	if (!waitPrompt(master)){
+		fprintf(stderr, "bench: no prompt from %s\n", shell);
+		exit(1);
+	}
+	for (i = -runs / 10; i < runs; i++){
+		start = nowNs();
+		if (write(master, line, len) != (ssize_t)len ||
+				!waitPrompt(master)){
+			fprintf(stderr, "bench: %s stopped answering '%.*s'\n",
+					shell, (int)len - 1, line);
+			exit(1);
+		}
+		if (i >= 0){
+			s->ns[s->count++] = nowNs() - start;
+		}
+	}
+	if (write(master, "exit\n", 5) != 5){
+		kill(pid, SIGKILL);
+	}
+	waitpid(pid, &status, 0);
+	close(master);
+}
+
+
+
+
+/*******************************************************************************
+ * fillLine
+ * fills line with copies of text, up to len bytes, and returns the bytes
+ * used. Only whole copies are used so no quote is left open.
+ *
+ * ****************************************************************************/
+size_t fillLine(char* line, size_t len, const char* text){
+	size_t textLen = strlen(text);
+	size_t used = 0;
+	while (used + textLen <= len){
+		memcpy(line + used, text, textLen);
+		used += textLen;
+	}
+	return used;
+}
+
+
+
+
+/*******************************************************************************
+ * benchTokenize
+ * times tokenizeInput on a line of copies of text, for at least BENCHTIME,
+ * and writes the MB/s and tokens/s it managed.
+ *
+ * ****************************************************************************/
+void benchTokenize(FILE* out, const char* text){
+	struct arena arena = {0};
+	char* line = malloc(TOKENBYTES);
+	size_t len;
+	char** words;
+	int count = 0;
+	long long start, elapsed;
+	long long passes = 0;
+
+	if (line == NULL){
+		perror("malloc");
+		exit(1);
+	}
+	len = fillLine(line, TOKENBYTES, text);
+	start = nowNs();
+	do {
+		arenaReset(&arena);
+		tokenizeInput(line, len, &arena, &words, &count, NULL);
+		passes++;
+		elapsed = nowNs() - start;
+	} while (elapsed < BENCHTIME);
+	fprintf(out, "{\"bytes\": %zu, \"tokens\": %d, \"mb_per_s\": %.1f, "
+			"\"mtokens_per_s\": %.2f}", len, count,
+			(double)len * passes / elapsed * 1000,
+			(double)count * passes / elapsed * 1000);
+	arenaReset(&arena);
+	free(line);
+}
+
+
+
+
+/*******************************************************************************
+ * benchExpand
+ * times expandWords on EXPANDWORDS words taken round robin from text's
+ * tokens, for at least BENCHTIME, and writes the ns per word and MB/s of
+ * words it managed. Each pass expands a fresh copy of the word pointers.
+ *
+ * ****************************************************************************/
+void benchExpand(FILE* out, const char* text){
+	struct arena words = {0};     // the tokens, kept for every pass
+	struct arena scratch = {0};   // the expanded words, freed each pass
+	char** tokens;
+	int tokenCount;
+	char** userCmds[2];           // the words, and the copy expanded
+	size_t bytes = 0;
+	long long start, elapsed;
+	long long passes = 0;
+	int i;
+
+	tokenizeInput(text, strlen(text), &words, &tokens, &tokenCount, 
+			NULL);
+	userCmds[0] = arenaAlloc(&words, EXPANDWORDS * sizeof(char*));
+	userCmds[1] = arenaAlloc(&words, EXPANDWORDS * sizeof(char*));
+	for (i = 0; i < EXPANDWORDS; i++){
+		userCmds[0][i] = tokens[i % tokenCount];
+		bytes += strlen(userCmds[0][i]);
+	}
+	start = nowNs();
+	do {
+		arenaReset(&scratch);
+		memcpy(userCmds[1], userCmds[0], EXPANDWORDS * sizeof(char*));
+		expandWords(userCmds[1], EXPANDWORDS, 0, 4242, &scratch);
+		passes++;
+		elapsed = nowNs() - start;
+	} while (elapsed < BENCHTIME);
+	fprintf(out, "{\"words\": %d, \"bytes\": %zu, \"ns_per_word\": %.1f, "
+			"\"mb_per_s\": %.1f}", EXPANDWORDS, bytes,
+			(double)elapsed / passes / EXPANDWORDS,
+			(double)bytes * passes / elapsed * 1000);
+	arenaReset(&scratch);
+	arenaReset(&words);
+}
+
+
+
+
+/*******************************************************************************
+ * benchEnv
+ * with ENVVARS more variables exported, writes the ns it takes to get the 
+ * environment for a command when nothing changed, after an exported 
+ * variable changed in place, after one was exported, and for a command 
+ * with a VAR=x word, and to set an unexported variable as a for loop does.
+ *
+ * ****************************************************************************/
+void benchEnv(FILE* out){
+	struct arena arena = {0};
+	char name[32];
+	char* assign[] = {"BENCH_VAR_7=changed"};
+	char value[32];
+	long long start, same, changed, exported, prefix, loop;
+	int i;
+
+	initVars();
+	for (i = 0; i < ENVVARS; i++){
+		snprintf(name, sizeof(name), "BENCH_VAR_%d", i);
+		exportVar(setVar(name, strlen(name), 
+				"/some/fairly/typical/value/of/forty/bytes"));
+	}
+	exportedEnv();
+
+	start = nowNs();
+	for (i = 0; i < ENVCALLS; i++){
+		exportedEnv();
+	}
+	same = nowNs() - start;
+
+	start = nowNs();
+	for (i = 0; i < ENVCALLS; i++){
+		snprintf(value, sizeof(value), "%d", i);
+		setVar("BENCH_VAR_0", 11, value);
+		exportedEnv();
+	}
+	changed = nowNs() - start;
+
+	start = nowNs();
+	for (i = 0; i < ENVCALLS; i++){
+		exportVar(findVar("BENCH_NEW", 9, true));
+		setVar("BENCH_NEW", 9, "x");
+		exportedEnv();
+		unsetVar(findVar("BENCH_NEW", 9, false));
+	}
+	exported = nowNs() - start;
+
+	start = nowNs();
+	for (i = 0; i < ENVCALLS; i++){
+		arenaReset(&arena);
+		commandEnv(assign, 1, &arena);
+	}
+	prefix = nowNs() - start;
+
+	start = nowNs();
+	for (i = 0; i < ENVCALLS; i++){
+		snprintf(value, sizeof(value), "%d", i);
+		setVar("i", 1, value);
+	}
+	loop = nowNs() - start;
+
+	fprintf(out, "{\"vars\": %d, \"unchanged_ns\": %.1f, "
+			"\"value_changed_ns\": %.1f, \"export_changed_ns\": %.1f, "
+			"\"prefix_ns\": %.1f, \"loop_var_ns\": %.1f}", 
+			vars.envCount, (double)same / ENVCALLS, 
+			(double)changed / ENVCALLS, (double)exported / ENVCALLS, 
+			(double)prefix / ENVCALLS, (double)loop / ENVCALLS);
+	arenaReset(&arena);
+}
+
+
+
+
+/*******************************************************************************
+ * countExecs
+ * runs name in a traced child with PATH set to pathVar, exec'ing path if it
+ * is given and searching PATH with execvp the way children used to if not.
+ * Returns how many execve calls it took until one worked, or -1 if the child
+ * can't be traced. It is killed as soon as the exec works.
+ *
+ * ****************************************************************************/
+int countExecs(char* name, char* path, const char* pathVar){
+	char* argv[] = {name, NULL};
+	struct __ptrace_syscall_info info;   // a system call the child made
+	int execs = 0;
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1){
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0){
+		setenv("PATH", pathVar, 1);
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1){
+			_exit(127);
+		}
+		raise(SIGSTOP);
+		if (path){
+			execv(path, argv);
+		}
+		else {
+			execvp(name, argv);
+		}
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status)){
+		return -1;
+	}
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD | 
+			PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
+	while (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == 0 &&
+			waitpid(pid, &status, 0) == pid && WIFSTOPPED(status)){
+		// the exec worked, that's all we wanted to see
+		if (status >> 8 == (SIGTRAP | PTRACE_EVENT_EXEC << 8)){
+			break;
+		}
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80) &&
+				ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info),
+					&info) > 0 &&
+				info.op == PTRACE_SYSCALL_INFO_ENTRY &&
+				info.entry.nr == SYS_execve){
+			execs++;
+		}
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, &status, 0);
+	return execs;
+}
+
+
+
+
+/*******************************************************************************
+ * benchPath
+ * compares launching name with and without the path cache, with PATH set to
+ * BENCHPATH. Writes the execve calls a child makes searching PATH itself, as
+ * children did before the cache, and exec'ing the path findCommand resolved,
+ * then the ns findCommand takes for a cached name, and for one it has to look
+ * up again after a hash -r.
+ *
+ * ****************************************************************************/
+void benchPath(FILE* out, char* name){
+	struct arena arena = {0};
+	char* path;
+	long long start, hit, miss;
+	int i;
+
+	setVar("PATH", 4, BENCHPATH);
+	clearPaths();
+	path = findCommand(name, &arena);
+	if (path == NULL){
+		fprintf(out, "null");
+		return;
+	}
+	fprintf(out, "{\"command\": \"%s\", \"path\": \"%s\", "
+			"\"execvp_execs\": %d, \"resolved_execs\": %d, ", name,
+			path, countExecs(name, NULL, BENCHPATH),
+			countExecs(name, path, BENCHPATH));
+
+	start = nowNs();
+	for (i = 0; i < PATHCALLS; i++){
+		findCommand(name, &arena);
+	}
+	hit = nowNs() - start;
+
+	start = nowNs();
+	for (i = 0; i < PATHCALLS; i++){
+		clearPaths();
+		findCommand(name, &arena);
+	}
+	miss = nowNs() - start;
+
+	fprintf(out, "\"hit_ns\": %.1f, \"miss_ns\": %.1f}", 
+			(double)hit / PATHCALLS, (double)miss / PATHCALLS);
+	arenaReset(&arena);
+}
+
+
+
+
+/*******************************************************************************
+ * initSignals
+ * blocks SIGCHLD and SIGINT and reads them from a signalfd, as main does,
+ * so reapChildren and the job table work in this process.
+ *
+ * ****************************************************************************/
+void initSignals(void){
+	sigset_t readMask;
+	sigemptyset(&readMask);
+	sigaddset(&readMask, SIGCHLD);
+	sigaddset(&readMask, SIGINT);
+	sigprocmask(SIG_BLOCK, &readMask, &childMask);
+	signalFd = signalfd(-1, &readMask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signalFd == -1){
+		perror("signalfd");
+		exit(1);
+	}
+	pidStringLen = snprintf(pidString, sizeof(pidString), "%d", getpid());
+}
+
+
+
+
+/*******************************************************************************
+ * timeReap
+ * waits for a SIGCHLD and returns the ns reapChildren took to deal with it.
+ *
+ * ****************************************************************************/
+long long timeReap(struct jobTable* jobs){
+	struct pollfd pfd = {signalFd, POLLIN, 0};
+	long long start;
+	if (poll(&pfd, 1, 5000) <= 0){
+		fprintf(stderr, "bench: no SIGCHLD from the jobs\n");
+		exit(1);
+	}
+	start = nowNs();
+	reapChildren(jobs);
+	return nowNs() - start;
+}
+
+
+
+
+/*******************************************************************************
+ * startJobs
+ * runs line, a background command, count times with runCommand.
+ *
+ * ****************************************************************************/
+void startJobs(struct shell* sh, const char* line, int count){
+	char** words;
+	int wordCount;
+	int i;
+
+	for (i = 0; i < count; i++){
+		arenaReset(&sh->arena);
+		tokenizeInput((char*)line, strlen(line), &sh->arena, &words, 
+				&wordCount, NULL);
+		runCommand(sh, words, wordCount, (char*)line);
+	}
+	arenaReset(&sh->arena);
+	fflush(stdout);
+}
+
+
+
+
+/*******************************************************************************
+ * timeShutdown
+ * times the shell's exit with the jobs in sh running: killJobs and then 
+ * reapJobs, giving them SHUTDOWNWAIT seconds. Returns the ms it took, and
+ * sets *reapedAll if the shell has no children left after it.
+ *
+ * ****************************************************************************/
+double timeShutdown(struct shell* sh, bool* reapedAll){
+	int saved = dup(STDERR_FILENO);   // reapJobs' summary goes nowhere
+	int devNull = open("/dev/null", O_WRONLY);
+	long long start;
+
+	dup2(devNull, STDERR_FILENO);
+	start = nowNs();
+	killJobs(&sh->jobs, SIGTERM);
+	reapJobs(&sh->jobs, SHUTDOWNWAIT);
+	start = nowNs() - start;
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+	close(devNull);
+	*reapedAll = wait4(-1, NULL, WNOHANG, NULL) == -1 && errno == ECHILD;
+	return start / 1e6;
+}
+
+
+
+
+/*******************************************************************************
+ * benchShutdown
+ * starts jobCount background sleeps and times the shell's exit with them 
+ * running, then again with one of them a job that ignores SIGTERM, which 
+ * should take SHUTDOWNWAIT however many jobs there are.
+ *
+ * ****************************************************************************/
+void benchShutdown(FILE* out, int jobCount, struct sigaction* normal_action){
+	struct shell sh = {0};
+	double polite, stubborn;
+	bool politeReaped, stubbornReaped;
+
+	sh.normal_action = normal_action;
+	initJobs(&sh.jobs);
+	startJobs(&sh, "sleep 1000 &", jobCount);
+	polite = timeShutdown(&sh, &politeReaped);
+
+	// the stubborn one goes first, so it has set its trap by the end
+	initJobs(&sh.jobs);
+	startJobs(&sh, "sh -c \"trap '' TERM; while :; do sleep 1; done\" &",
+			1);
+	startJobs(&sh, "sleep 1000 &", jobCount - 1);
+	usleep(100000);
+	stubborn = timeShutdown(&sh, &stubbornReaped);
+	arenaFree(&sh.arena);
+
+	fprintf(out, "{\"jobs\": %d, \"polite_ms\": %.2f, \"stubborn_ms\": "
+			"%.2f, \"wait_ms\": %.0f, \"reaped_all\": %s}", 
+			jobCount, polite, stubborn, SHUTDOWNWAIT * 1000,
+			politeReaped && stubbornReaped ? "true" : "false");
+}
+
+
+
+
+/*******************************************************************************
+ * benchStress
+ * tries to start jobCount background sleeps, far more than benchShutdown's,
+ * and writes how many the shell managed, how long that took, and how long
+ * its exit took with them running. Running out of processes on the way is 
+ * fine, it's the shell that mustn't fail: what it says about it goes to 
+ * /dev/null and the jobs it did start are counted.
+ *
+ * ****************************************************************************/
+void benchStress(FILE* out, int jobCount, struct sigaction* normal_action){
+	struct shell sh = {0};
+	int saved = dup(STDERR_FILENO);   // fork errors go nowhere
+	int devNull = open("/dev/null", O_WRONLY);
+	long long start, launch;
+	double shutdown;
+	bool reaped;
+	int started;
+
+	sh.normal_action = normal_action;
+	initJobs(&sh.jobs);
+	dup2(devNull, STDERR_FILENO);
+	start = nowNs();
+	startJobs(&sh, "sleep 1000 &", jobCount);
+	launch = nowNs() - start;
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+	close(devNull);
+	started = sh.jobs.count;
+	shutdown = timeShutdown(&sh, &reaped);
+	arenaFree(&sh.arena);
+
+	fprintf(out, "{\"jobs\": %d, \"started\": %d, \"start_ms\": %.1f, "
+			"\"us_per_start\": %.1f, \"shutdown_ms\": %.1f, "
+			"\"reaped_all\": %s}", jobCount, started, launch / 1e6,
+			started ? launch / 1e3 / started : 0.0, shutdown,
+			reaped ? "true" : "false");
+}
+
+
+
+
+/*******************************************************************************
+ * benchReap
+ * starts jobCount background sleeps with runCommand and writes how long
+ * reapChildren takes with all of them running and nothing to reap, to reap
+ * one of them, and to reap the rest once they're all killed. Only the time
+ * in reapChildren counts, not the waits for the SIGCHLDs.
+ *
+ * ****************************************************************************/
+void benchReap(FILE* out, int jobCount, struct sigaction* normal_action){
+	struct shell sh = {0};
+	long long start, idle, one, rest = 0;
+	int reaped;
+	int i;
+
+	initJobs(&sh.jobs);
+	sh.normal_action = normal_action;
+	startJobs(&sh, "sleep 1000 &", jobCount);
+
+	start = nowNs();
+	for (i = 0; i < IDLECALLS; i++){
+		reapChildren(&sh.jobs);
+	}
+	idle = nowNs() - start;
+
+	kill(sh.jobs.head->pids[0], SIGKILL);
+	one = timeReap(&sh.jobs);
+
+	reaped = sh.jobs.count;
+	killJobs(&sh.jobs, SIGTERM);
+	while (sh.jobs.count > 0){
+		rest += timeReap(&sh.jobs);
+	}
+	fflush(stdout);
+	fprintf(out, "{\"jobs\": %d, \"idle_ns\": %.1f, \"reap_one_us\": %.2f, "
+			"\"reap_rest_us\": %.2f, \"us_per_job\": %.3f}", jobCount,
+			(double)idle / IDLECALLS, one / 1000.0, rest / 1000.0,
+			reaped ? rest / 1000.0 / reaped : 0.0);
+}
+
+
+
+
+/*******************************************************************************
+ * checkQuotes
+ * tokenizes and expands lines where a quote or '\' ends a variable name, or
+ * keeps a '$' from expanding, with X set to 1, and compares the words with 
+ * what sh makes of them. Returns how many differ, saying which on stderr.
+ *
+ * ****************************************************************************/
+long checkQuotes(void){
+	static const char* cases[][2] = {    // a line, and its one word
+		{"\"$X\"y", "1y"},
+		{"\"$X\"\"_y\"", "1_y"},
+		{"$X'_z'", "1_z"},
+		{"$X\\_w", "1_w"},
+		{"\"$X\"2", "12"},
+		{"'$X'a", "$Xa"},
+		{"\\$X$X", "$X1"},
+		{"${X}b\"$X\"", "1b1"},
+		{"a\"b\"'c'\\d", "abcd"},
+		{"\"$X$\"$X", "1$1"},
+	};
+	struct arena arena = {0};
+	char** words;
+	int count;
+	long bad = 0;
+	size_t i;
+
+	initVars();
+	setVar("X", 1, "1");
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++){
+		arenaReset(&arena);
+		tokenizeInput(cases[i][0], strlen(cases[i][0]), &arena, &words, 
+				&count, NULL);
+		expandWords(words, count, 0, 0, &arena);
+		if (count != 1 || strcmp(words[0], cases[i][1]) != 0){
+			fprintf(stderr, "quotes: %s gave %s, not %s\n", cases[i][0],
+					count > 0 ? words[0] : "nothing", cases[i][1]);
+			bad++;
+		}
+	}
+	arenaFree(&arena);
+	return bad;
+}
+
+
+
+
+/*******************************************************************************
+ * fuzzLexer
+ * checks lexSpan against lexSpanScalar at every offset of lineCount random
+ * lines, so the SSE2 and AVX2 scans stay honest, and tokenizes each line for
+ * ASan to look at. The lines are up to FUZZBYTES long and each is given its
+ * own share of lexSpecials, from none to mostly specials, with the other bytes
+ * anything but '\0'. checkQuotes is run as well. Writes a summary to out and
+ * returns the mismatches, the first few of which go to stderr.
+ *
+ * ****************************************************************************/
+long fuzzLexer(FILE* out, long lineCount){
+	struct arena arena = {0};
+	char line[FUZZBYTES];
+	unsigned seed = time(NULL) ^ getpid();  // printed, to replay a failure
+	long spans = 0;               // offsets compared
+	long bad = 0;                 // offsets where the scans disagree
+	long quotes;                  // checkQuotes cases that went wrong
+	long n;
+	size_t len, i, fast, slow;
+	int odds;                     // in 16, that a byte is special
+	char** words;
+	int count;
+
+	srandom(seed);
+	for (n = 0; n < lineCount; n++){
+		len = random() % (FUZZBYTES + 1);
+		odds = random() % 17;
+		for (i = 0; i < len; i++){
+			if (random() % 16 < odds){
+				line[i] = lexSpecials[random() % (sizeof(lexSpecials) - 1)];
+			}
+			else {
+				line[i] = random() % 255 + 1;
+			}
+		}
+		for (i = 0; i <= len; i++){
+			fast = lexSpan(line + i, len - i);
+			slow = lexSpanScalar(line + i, len - i);
+			spans++;
+			if (fast != slow && bad++ < 10){
+				fprintf(stderr, "fuzz: seed %u line %ld offset %zu of %zu: "
+						"lexSpan %zu, lexSpanScalar %zu\n", seed, n, i, len,
+						fast, slow);
+			}
+		}
+		arenaReset(&arena);
+		tokenizeInput(line, len, &arena, &words, &count, NULL);
+	}
+	arenaFree(&arena);
+	quotes = checkQuotes();
+	fflush(stdout);
+	fprintf(out, "{\"fuzz\": {\"seed\": %u, \"lines\": %ld, \"spans\": %ld, "
+			"\"mismatches\": %ld, \"quote_mismatches\": %ld}}\n", seed, 
+			lineCount, spans, bad, quotes);
+	return bad + quotes;
+}
+
+
+
+
+/*******************************************************************************
+ * main
+ * reads the options, then runs each benchmark in turn, writing its results as
+ * part of one JSON object on stdout. The shell code called here prints to
+ * the stdout it knows, which goes to /dev/null. With -f it runs fuzzLexer
+ * instead and exits 1 if that found a mismatch.
+ *
+ * ****************************************************************************/
+int main(int argc, char** argv){
+	const char* shell = "./smallsh";
+	int runs = 1000;             // timings for each process test
+	int maxJobs = 1000;          // most background jobs for benchReap and
+	                             // benchShutdown
+	int stressJobs = 10000;      // jobs benchStress tries, 0 to skip it
+	struct sigaction normal_action = {0};
+	struct samples s;
+	FILE* out;                   // the JSON, stdout is the shell's output
+	long fuzzLines = 0;          // lines for fuzzLexer, 0 to benchmark
+	char dense[DENSECOPIES * 12 + 1];   // a word that's all expansions
+	int opt;
+	int jobs;
+
+	// bench [-n runs] [-j maxjobs] [-s stressjobs] [-f lines] [shell]
+	while ((opt = getopt(argc, argv, "n:j:s:f:")) != -1){
+		switch (opt){
+			case 'n':
+				runs = atoi(optarg);
+				break;
+			case 'j':
+				maxJobs = atoi(optarg);
+				break;
+			case 's':
+				stressJobs = atoi(optarg);
+				break;
+			case 'f':
+				fuzzLines = atol(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-j maxjobs] "
+						"[-s stressjobs] [-f lines] [shell]\n",
+						argv[0]);
+				exit(2);
+		}
+	}
+	if (optind < argc){
+		shell = argv[optind];
+	}
+	if (fuzzLines == 0 && (runs < 1 || access(shell, X_OK) != 0)){
+		fprintf(stderr, "bench: can't run %s %d times\n", shell, runs);
+		exit(2);
+	}
+
+	// what the shell code run here prints goes nowhere
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	if (out == NULL || freopen("/dev/null", "w", stdout) == NULL){
+		perror("stdout");
+		exit(1);
+	}
+	if (fuzzLines > 0){
+		return fuzzLexer(out, fuzzLines) > 0;
+	}
+	normal_action.sa_handler = SIG_DFL;
+
+	fprintf(out, "{\n\"build\": {\"rev\": \"%s\", \"cflags\": \"%s\", "
+			"\"compiler\": \"%s\", \"scan\": \"%s\"},\n", BENCH_REV,
+			BENCH_CFLAGS, __VERSION__,
+#if defined(__AVX2__)
+			"avx2"
+#elif defined(__SSE2__)
+			"sse2"
+#else
+			"bytes"
+#endif
+			);
+
+	// the shell run as its own process, timings in microseconds
+	fprintf(out, "\"startup_us\": {\n  \"true\": ");
+	benchStartup(shell, "true", runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"exit\": ");
+	benchStartup(shell, "exit", runs, &s);
+	printSamples(out, &s);
+
+	fprintf(out, "\n},\n\"prompt_us\": {\n  \"true\": ");
+	benchPrompt(shell, "true\n", "1", 0, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"cd\": ");
+	benchPrompt(shell, "cd .\n", "1", 0, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"echo\": ");
+	benchPrompt(shell, "echo hello\n", "1", 0, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"status\": ");
+	benchPrompt(shell, "status\n", "1", 0, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"spawn\": ");
+	benchPrompt(shell, "/bin/true\n", "1", 0, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"fork\": ");
+	benchPrompt(shell, "/bin/true\n", "0", 0, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"pipeline\": ");
+	benchPrompt(shell, "/bin/true | /bin/true\n", "1", 0, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"assign\": ");
+	benchPrompt(shell, "X=1\n", "1", 0, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"spawn_env%d\": ", ENVVARS);
+	benchPrompt(shell, "/bin/true\n", "1", ENVVARS, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"fork_env%d\": ", ENVVARS);
+	benchPrompt(shell, "/bin/true\n", "0", ENVVARS, runs, &s);
+	printSamples(out, &s);
+	fprintf(out, ",\n  \"prefix_env%d\": ", ENVVARS);
+	benchPrompt(shell, "X=1 /bin/true\n", "1", ENVVARS, runs, &s);
+	printSamples(out, &s);
+
+	fprintf(out, "\n},\n\"pipe\": {\n  \"pipe\": ");
+	benchPipe(out, shell, "|");
+	fprintf(out, ",\n  \"relay\": ");
+	benchPipe(out, shell, "|>");
+	fprintf(out, "\n},\n\"parallel\": ");
+	benchParallel(out, shell);
+	fprintf(out, ",\n\"alloc\": ");
+	benchAlloc(out);
+	fprintf(out, ",\n\"loop\": {\n  \"builtin\": ");
+	benchLoop(out, shell, "echo $i; test $i -gt 0");
+	fprintf(out, ",\n  \"forked\": ");
+	benchLoop(out, shell, "/bin/echo $i; /bin/test $i -gt 0");
+	fprintf(out, "\n}");
+
+	// the rest is timed in this process
+	initSignals();
+	fprintf(out, ",\n\"tokenize\": {\n  \"words\": ");
+	benchTokenize(out, "/usr/bin/some_long_program_name "
+			"--with-a-long-option=value/under/a/directory ");
+	fprintf(out, ",\n  \"mixed\": ");
+	benchTokenize(out, "echo 'a b' \"$HOME/x\" c\\ d>out 2>&1|wc -l;");
+	fprintf(out, "\n},\n\"expand\": {\n  \"plain\": ");
+	benchExpand(out, "ls -l /tmp/file.txt --color=auto");
+	fprintf(out, ",\n  \"pid\": ");
+	benchExpand(out, "$$ out$$.txt /tmp/dir$$/file \"$?\" $! x$$y$$z");
+	// one word of hundreds of expansions, $HOME among them
+	initVars();
+	dense[fillLine(dense, sizeof(dense) - 1, "$$/$?/$HOME/")] = '\0';
+	fprintf(out, ",\n  \"dense\": ");
+	benchExpand(out, dense);
+	fprintf(out, "\n},\n\"env\": ");
+	benchEnv(out);
+	fprintf(out, ",\n\"path\": ");
+	benchPath(out, "true");
+	fprintf(out, ",\n\"reap\": [");
+	for (jobs = 1; jobs <= maxJobs; jobs *= 10){
+		fprintf(out, "%s\n  ", jobs > 1 ? "," : "");
+		benchReap(out, jobs, &normal_action);
+	}
+	fprintf(out, "\n],\n\"shutdown\": [");
+	for (jobs = 1; jobs <= maxJobs; jobs *= 10){
+		fprintf(out, "%s\n  ", jobs > 1 ? "," : "");
+		benchShutdown(out, jobs, &normal_action);
+	}
+	fprintf(out, "\n],\n\"stress\": ");
+	if (stressJobs > 0){
+		benchStress(out, stressJobs, &normal_action);
+	}
+	else {
+		fprintf(out, "null");
+	}
+	fprintf(out, "\n}\n");
+	fclose(out);
+	return 0;
+}
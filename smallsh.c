@@ -3,18 +3,31 @@
  * Parker Howell
  * CS 344
  * 11/15/17
- * Description - This is a small shell program with 3 built in commands (exit,
- * cd, and status. Non-built in commands will be forked and exec'd and may be
- * ran in the background by including '&' at the end of your user command.
+ * Description - This is a small shell program with built in commands like 
+ * exit, cd, status, jobs and limit (see builtins for all of them). echo, 
+ * true, false, test and printf are built in too, saving a fork when they run
+ * in the foreground (BUILTIN_FAST). Non-built in commands will be forked and
+ * exec'd and may be ran in the background by including '&' at the end of 
+ * your user command.
  * Additionally the shell supports input and output re-direction with the use 
- * of '<' and/or '>' followed by filenames.
+ * of '<', '>', '>>', '2>', '&>', '2>&1', '<>' and '<<<' (see findReDirect).
+ * Commands can be chained into a pipeline with '|', or with '|>' to have the
+ * shell move the data between the two stages itself and report throughput.
+ * Commands can be joined with ';', '&&' and '||', and grouped with { ...; }
+ * or run in a subshell with ( ... ). Shell variables are set with NAME=value
+ * and passed on to commands with export. limit puts jobs under rlimits, nice,
+ * io class, cpu affinity and cgroup v2 limits.
  *
  * The general syntax of a command is:
- * command [arg1 arg2 ...] [< input_file] [> outputfile] [&]
+ * command [arg1 arg2 ...] [< input_file] [> outputfile] [| command ...] [&]
  * ... where items in [] are optional.
  *
+ * Usage: smallsh [-c command | -f script | script]
+ *
  * ****************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -22,53 +35,662 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <ctype.h>
+#include <spawn.h>
+#include <sched.h>
+#include <termios.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+// USDT probes for perf and bpftrace, where systemtap's header is installed.
+// They're a nop until something attaches, see PROBE
+#if defined(__has_include) && !defined(SMALLSH_NO_SDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SMALLSH_SDT 1
+#endif
+#endif
+
+
+#define INPUTBLOCK 65536 // bytes read from the input at a time
+#define OUTPUTBUF 65536  // size of stdout's buffer when running a script
+#define ARENACHUNK 65536 // bytes in each chunk of the parse arena
+#define ARENAALIGN 16    // alignment of everything handed out by the arena
+#define JOBSLOTS 64      // starting size of the job table, a power of two
+#define EXITWAIT 2       // seconds jobs get to end on exit before SIGKILL
+#define RELAYCHUNK (1 << 20)  // most bytes moved by one splice on a '|>'
+#define QUOTEMARK '\001' // lexer: the '$' after it was quoted, see expandWord
+#define QUOTEEND '\002'  // lexer: a quote or '\' was here, ends a $NAME
+
+#define STATSLOTS 64     // starting size of the stats table, a power of two
+#define STATBUCKETS 32   // wall time histogram buckets, powers of 2 usec
+#define TRACEMAX 4096    // longest SMALLSH_TRACE record
+#define PATHSLOTS 64     // starting size of the path cache, a power of two
+#define VARSLOTS 256     // starting size of the variable table, a power of 2
+#define HISTREBUILD 4096 // history records added before the prefix index is
+                         // sorted again, see historyPrefix
+#define COMPLETEDIRS 32  // directories indexed for completion, besides PATH
+#define COMPLETELIST 256 // most names a second tab lists
+#define DIRWATCH (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+#define RUN_BG 1         // runPipeline flags: user asked for '&'
+#define RUN_PARALLEL 2   // started by parallel, don't wait or announce it
+
+#define BUILTIN_STATUS 1 // builtin flags: its exit value becomes the status
+#define BUILTIN_FAST 2   // stands in for a utility, see builtins
+#define BUILTIN_PREFIX 4 // runs the command after its options, see runCommand
+
+#define JOB_RUNNING 0    // job states
+#define JOB_DONE 1
+#define JOB_STOPPED 2
+
+#define REDIR_OPEN 0     // re-direct types: open a file onto the fd
+#define REDIR_DUP 1      // make the fd a copy of another one
+#define REDIR_STRING 2   // read a here-string
+
+#define KEY_NONE 0x100   // editor keys past the byte values, see readKey
+#define KEY_UP 0x101
+#define KEY_DOWN 0x102
+#define KEY_RIGHT 0x103
+#define KEY_LEFT 0x104
+#define KEY_HOME 0x105
+#define KEY_END 0x106
+#define KEY_DELETE 0x107
+#define KEY_META 0x200   // or'ed with the key typed after an ESC (alt)
+
+#define LIMIT_CPU 1      // limits flags: which fields are set, see struct limits
+#define LIMIT_AS 2
+#define LIMIT_FILES 4
+#define LIMIT_NICE 8
+#define LIMIT_IO 16
+#define LIMIT_CPUS 32
+#define LIMIT_MEMORY 64  // the rest need a cgroup for the job
+#define LIMIT_WEIGHT 128
+#define LIMIT_CGROUP 256
+#define LIMIT_CGROUPS (LIMIT_MEMORY | LIMIT_WEIGHT | LIMIT_CGROUP)
+
+#define IOPRIO_WHO_PROCESS 1  // ioprio_set, which glibc has no wrapper for
+#define IOPRIO_CLASS_SHIFT 13
+
+#define NAME_DIR 1       // directory index entry types, see nameType
+#define NAME_EXEC 2
+
+#define PHASE_TOKENIZE 0 // hot paths timed for the perf builtin, see phases
+#define PHASE_EXPAND 1
+#define PHASE_REDIRECT 2
+#define PHASE_LAUNCH 3
+#define PHASE_REAP 4
+#define PHASES 5
+
+// PROBE(name, args...) is the USDT probe smallsh:name, or nothing
+#ifdef SMALLSH_SDT
+#define PROBE(...) STAP_PROBEV(smallsh, __VA_ARGS__)
+#else
+#define PROBE(...) ((void)0)
+#endif
+
+#define NODE_COMMAND 0   // node types, see struct node
+#define NODE_IF 1
+#define NODE_WHILE 2
+#define NODE_UNTIL 3
+#define NODE_FOR 4
+#define NODE_AND 5       // cond && body
+#define NODE_OR 6        // cond || body
+#define NODE_GROUP 7     // { body; }
+#define NODE_SUBSHELL 8  // ( body ), or a list run with '&'
+
+// how much of an arena was in use, see arenaSave
+struct arenaMark {
+	struct arenaChunk* cur;
+	size_t used;
+};
+
+// where the shell's commands come from, read in blocks
+struct inputReader {
+	int fd;                  // file descriptor read from
+	char* buf;               // input read but not handed out yet
+	size_t start;            // first unread byte in buf
+	size_t end;              // end of the bytes read into buf
+	size_t size;             // size of buf
+	bool eof;                // nothing more to read
+	bool edit;               // a terminal, lines are read with editLine
+};
+
+// a block of memory the arena hands out pieces of
+struct arenaChunk {
+	struct arenaChunk* next; // chunks are kept in a list
+	size_t size;             // usable bytes in data
+	char data[] __attribute__((aligned(ARENAALIGN)));
+};
+
+// bump allocator for everything that only lives as long as one command
+struct arena {
+	struct arenaChunk* head; // first chunk, kept across resets
+	struct arenaChunk* cur;  // chunk we're allocating from
+	size_t used;             // bytes of cur handed out
+};
+
+// a word being expanded into the arena
+struct expandBuf {
+	char* out;               // where the expanded word is written
+	size_t len;              // bytes written so far
+	size_t room;             // bytes available at out
+};
+
+// the values of $$, $? and $! for the command being expanded
+struct expansion {
+	const char* pid;
+	size_t pidLen;
+	const char* status;
+	size_t statusLen;
+	const char* bgPid;
+	size_t bgPidLen;
+};
+
+// one command of a pipeline, ready to launch
+// one re-direct of a command. They are applied in order, so "> f 2>&1" 
+// sends both stdout and stderr to f, and "2>&1 > f" only stdout
+struct redirect {
+	int type;                // REDIR_OPEN, REDIR_DUP or REDIR_STRING
+	int fd;                  // the descriptor re-directed, 0 to 2
+	int flags;               // open flags of a REDIR_OPEN
+	int dupFd;               // what a REDIR_DUP copies
+	char* path;              // file opened, or a REDIR_STRING's text
+};
+
+struct stage {
+	char** argv;             // NULL terminated arguments for exec
+	char* path;              // file to exec from findCommand, or NULL
+	struct redirect* redirects;  // the stage's re-directs
+	int redirectCount;       // how many
+	int pipeIn;              // read end of pipe from previous stage, or -1
+	int pipeOut;             // write end of pipe to next stage, or -1
+	bool nullIn;             // read /dev/null if input isn't re-directed
+	bool nullOut;            // write /dev/null if output isn't re-directed
+	char** envp;             // environment with its VAR=x words, or NULL
+	struct limits* limits;   // set in the child before exec, or NULL
+	char* cgroup;            // the job's cgroup, joined before exec, or NULL
+	const struct builtin* builtin;  // run in the child instead of exec'ing
+	struct shell* sh;        // for the builtin
+};
+
+// resource limits and scheduling for the processes of a job, set with the
+// limit builtin. Only the fields flagged in set are applied
+struct limits {
+	int set;                 // LIMIT_ flags of the fields that are set
+	rlim_t cpuTime;          // RLIMIT_CPU, seconds
+	rlim_t addressSpace;     // RLIMIT_AS, bytes
+	rlim_t openFiles;        // RLIMIT_NOFILE
+	int nice;                // added to the nice value
+	int ioClass;             // 1 realtime, 2 best effort or 3 idle
+	int ioLevel;             // 0 (first) to 7 within realtime and best effort
+	cpu_set_t cpus;          // cpus it may run on
+	long long memory;        // cgroup memory.max, bytes
+	int weight;              // cgroup cpu.weight, 1 to 10000 (100 is even)
+};
+
+// the cgroup v2 directory the shell runs in, where jobs get cgroups of their
+// own. Set up the first time a job needs one, see setupCgroups
+struct cgroupTree {
+	int dirFd;               // the directory, -1 until it's set up
+	char* path;              // its path, for messages
+	int enabled;             // LIMIT_MEMORY and LIMIT_WEIGHT once their
+	                         // controllers are enabled for the jobs
+	int next;                // numbers the jobs' cgroups
+};
+
+// a '|>' link, the shell moves the data between two stages itself
+struct relay {
+	int from;                // shell's read end, written by stage before
+	int to;                  // shell's write end, read by stage after
+	bool full;               // last splice found 'to' full
+	long long bytes;         // bytes moved so far
+	double seconds;          // time spent relaying them, for the throughput
+};
+
+// a background job we launched and haven't reaped yet
+struct job {
+	int id;                  // job number, for %n
+	pid_t pid;               // last process of the job, reported to user
+	pid_t pgid;              // process group of the job, 0 if the shell's
+	pid_t* pids;             // every process in the job
+	int procCount;           // how many pids
+	int running;             // how many of them haven't been reaped
+	int status;              // how the last process exited
+	char* cmdLine;           // command line that started it
+	struct timespec start;   // when it was launched (CLOCK_MONOTONIC)
+	int state;               // JOB_RUNNING, JOB_STOPPED or JOB_DONE
+	bool parallel;           // started by the parallel builtin?
+	struct termios modes;    // terminal modes it had when it was stopped
+	bool savedModes;         // is modes set?
+	struct rusage usage;     // resources used by its reaped processes
+	char* cgroup;            // its cgroup under cgroups.dirFd, or NULL
+	struct relay* relays;    // its '|>' links still moving data, or NULL
+	int relayCount;          // how many
+	struct job* prev;        // jobs in launch order
+	struct job* next;
+};
+
+// one slot of the job table, a pid of 0 marks an empty slot
+struct jobSlot {
+	pid_t pid;
+	struct job* job;
+};
+
+// open addressed (linear probing) hash of pid -> job, grows as needed
+struct jobTable {
+	struct jobSlot* slots;   // capacity slots, kept at most half full
+	int capacity;            // always a power of two
+	int shift;               // 32 - log2(capacity), used by jobHash
+	int count;               // pids in the table
+	struct job* head;        // oldest job
+	struct job* tail;        // newest job
+	pid_t lastPid;           // pid reported for the newest job, for $!
+	int parallelRunning;     // jobs of the parallel builtin still running
+	bool parallelStop;       // one was interrupted, don't start any more
+	bool parallelFailed;     // one failed, parallel returns 1
+	int doneId;              // last job reapPid finished, for wait
+	int doneStatus;          // and how it exited
+};
+
+// everything the shell keeps from one command to the next
+struct shell {
+	struct jobTable jobs;    // unreaped background processes
+	struct arena arena;      // memory for parsing the current command
+	struct inputReader* input;          // where commands are read from
+	struct sigaction* normal_action;    // SIGINT handling for fg children
+	int status;              // how the last command exited, for status/$?
+	bool exiting;            // exit was run or the input ran out
+	int exitValue;           // what the shell exits with
+	int loopDepth;           // loops being run, for break and continue
+	int breakLevels;         // loops a break or continue is leaving
+	bool continuing;         // it was a continue, the last loop goes on
+	bool interrupted;        // a command was ^C'd, abandon the rest
+	bool parseError;         // the last line parsed had a syntax error
+	char* histLine;          // the lines of the command, for the history
+	size_t histLen;          // bytes of it used
+	size_t histSize;         // size of histLine
+};
+
+// one command of a parsed command line, kept until the line is finished so
+// loops run it again without parsing it again
+struct node {
+	int type;                // NODE_COMMAND, NODE_IF, NODE_WHILE, ...
+	char** words;            // words of a command, or the list of a for
+	int wordCount;           // how many
+	char* cmdLine;           // a command's words as typed, for the job table
+	char* name;              // variable set by a for
+	struct node* cond;       // condition of an if, while or until
+	struct node* body;       // then part of an if, body of a loop
+	struct node* elseBody;   // else part of an if, elifs are nested ifs
+	struct node* next;       // next command of the list
+	bool background;         // a subshell run with '&'
+	char** redirWords;       // re-directs after a compound command, as words
+	int redirWordCount;      // how many
+};
+
+// reads the words of a command line, and of more lines while an if, while 
+// or for is still open
+struct parser {
+	struct shell* sh;        // for its input and arena
+	char** words;            // tokens of the current line
+	char** spans;            // where each is in the line, see tokenizeInput
+	int count;               // how many
+	int pos;                 // the next one to look at
+	int depth;               // compound commands still open
+	bool error;              // a syntax error was reported
+};
+
+// a command the shell runs itself, see builtins
+struct builtin {
+	const char* name;        // what the user types
+	int (*run)(struct shell* sh, char** userCmds, int cmdCount);
+	int flags;               // BUILTIN_STATUS and/or BUILTIN_FAST
+};
+
+// the words of a test expression being evaluated
+struct testArgs {
+	char** argv;             // the words
+	int pos;                 // the next one to look at
+	int end;                 // one past the last
+	bool error;              // couldn't be evaluated, test returns 2
+};
+
+// what the stats builtin knows about one command
+struct cmdStats {
+	char* name;              // the command, NULL marks an empty slot
+	long count;              // how many times it finished
+	double wall;             // total seconds of wall time
+	double user;             // total seconds of user cpu time
+	double sys;              // total seconds of system cpu time
+	long maxRss;             // largest max RSS seen, in KB
+	long ctxSwitches;        // total context switches
+	long hist[STATBUCKETS];  // wall times, bucket i is 2^i to 2^(i+1) usec
+};
+
+// what the perf builtin knows about one hot path, in timestamp counter ticks
+struct phaseTimer {
+	const char* name;        // the phase, as perf prints it
+	long count;              // times it ran
+	uint64_t ticks;          // total ticks spent in it
+	uint64_t max;            // longest single run
+};
+
+// open addressed hash of command name -> stats
+struct statsTable {
+	struct cmdStats* slots;  // capacity slots, kept at most half full
+	int capacity;            // always a power of two (or 0 before use)
+	int count;               // commands in the table
+	struct cmdStats total;   // every command together
+};
+
+// a command found by searching PATH
+struct pathEntry {
+	char* name;              // the command, NULL marks an empty slot
+	char* path;              // where it was found, NULL once forgotten
+	long hits;               // launches since it was found
+};
+
+// open addressed hash of command name -> path, like bash's hash table
+struct pathCache {
+	struct pathEntry* slots; // capacity slots, kept at most half full
+	int capacity;            // always a power of two (or 0 before use)
+	int count;               // names in the table
+	char* pathVar;           // the PATH the answers were found with
+};
+
+// a shell variable, set by NAME=value, export or a for loop
+struct shellVar {
+	char* name;              // the variable, NULL marks an empty slot
+	size_t nameLen;          // its length
+	char* entry;             // "name=value", as the environment holds it
+	size_t size;             // bytes allocated for entry
+	bool set;                // has a value, unset keeps the slot
+	bool exported;           // goes in the environment of commands
+};
+
+// open addressed hash of name -> variable, and the environment commands get,
+// built from the exported ones
+struct varTable {
+	struct shellVar* slots;  // capacity slots, kept at most half full
+	int capacity;            // always a power of two (or 0 before use)
+	int count;               // variables in the table
+	char** env;              // entries of the set, exported ones, NULL ended
+	int envCount;            // how many
+	int envSize;             // room in env
+	bool envDirty;           // a variable was exported or unset since
+};
+
+// a variable as it was before a builtin's VAR=x word changed it, see pushVars
+struct savedVar {
+	char* name;              // the variable
+	size_t len;              // length of the name
+	char* value;             // its value, NULL if it wasn't set
+	bool exported;           // was it exported?
+};
+
+// the command history: an append-only log with one line per command, and an
+// index of where each record of the log starts. Both are mapped, so opening
+// a history of any size reads nothing, see historySync
+struct history {
+	int logFd;               // the log, -1 until historyOpen
+	int indexFd;             // the index, one uint64_t offset per record
+	char* log;               // the log mapped, or NULL
+	size_t logSize;          // bytes of the log mapped
+	uint64_t* offsets;       // the index mapped, or NULL
+	size_t indexSize;        // bytes of the index mapped
+	size_t count;            // records in the index
+	struct histSorted* sorted;  // records sorted by command, or NULL
+	size_t sortedCount;      // records in sorted, see historyPrefix
+};
+
+// an entry of the history's prefix index, see historyPrefix
+struct histSorted {
+	uint64_t key;            // the command's first 8 bytes, big end first
+	uint64_t cmd;            // offset of the command in the log
+	uint32_t len;            // its length
+	uint32_t record;         // its record number
+};
+
+// one record of the history log, pointing into the mapped log
+struct histEntry {
+	long long time;          // when it was entered
+	int status;              // its $? once it finished
+	const char* cwd;         // the directory it was entered in
+	size_t cwdLen;
+	const char* cmd;         // the command line
+	size_t cmdLen;
+};
+
+// the line being typed at a terminal, see editLine
+struct lineEditor {
+	char* line;              // the line, NUL terminated
+	size_t len;              // bytes in it
+	size_t size;             // size of line
+	size_t cursor;           // byte the cursor is on
+	size_t offset;           // first byte on the screen, for long lines
+	int columns;             // width of the terminal
+	bool dirty;              // the screen needs drawing again
+	bool lastTab;            // the last key was a tab, see completeWord
+	long histPos;            // history record on the line, or -1
+	char* saved;             // the line typed before going into the history
+	size_t savedLen;
+	size_t savedSize;
+	char* yank;              // text last killed, for ^Y
+	size_t yankLen;
+	size_t yankSize;
+	bool searching;          // in a ^R search?
+	char search[128];        // the text searched for
+	size_t searchLen;
+	long searchPos;          // the record it was last found in
+	char searchPrompt[192];  // shown in place of the prompt while searching
+	char keys[256];          // bytes read but not handled yet, see readKey
+	size_t keyStart;
+	size_t keyEnd;
+	char* out;               // screen update being built, see editOut
+	size_t outLen;
+	size_t outSize;
+	struct arena arena;      // memory for a completion
+};
+
+// a name in a directory index
+struct dirName {
+	char* name;
+	int type;                // NAME_DIR, NAME_EXEC or 0
+};
+
+// the names in one directory, sorted, for completion. After it has been 
+// read once inotify says what changed, so a tab never reads it again
+struct dirIndex {
+	char* path;              // the directory
+	int wd;                  // its inotify watch, or -1
+	struct timespec mtime;   // its mtime when read, checked if not watched
+	struct dirName* names;   // what's in it
+	size_t count;
+	size_t capacity;
+	bool stale;              // read it again before it's used
+	bool onPath;             // a directory of PATH, kept
+	unsigned long used;      // when it was last used, to drop the oldest
+};
+
+// the directories indexed for completion, see indexDir
+struct completion {
+	bool started;            // inotifyFd made yet?
+	int inotifyFd;           // reports changes to them, or -1
+	struct dirIndex** dirs;
+	int dirCount;
+	int dirCapacity;
+	char* pathVar;           // the PATH whose directories are onPath
+	unsigned long clock;     // counts lookups, for used
+};
+
+extern char** environ;     // the variable table's environment, see exportedEnv
+extern const struct builtin builtins[];   // completed as commands
+
+bool canRunBG = true;      // can user run background process? see fgonly
+
+bool jobControl = false;   // jobs get process groups and the terminal?
+pid_t shellPgid;           // the shell's process group
+struct termios shellModes; // the shell's terminal modes
+
+bool useSpawn = true;      // launch with posix_spawn instead of fork?
+struct limits bgLimits;    // what every background job gets, see setLimits
+struct cgroupTree cgroups = {-1};   // where jobs get cgroups of their own
+
+bool interactive = true;   // reading commands from a user at a terminal?
+
+int signalFd = -1;         // SIGCHLD and SIGINT are read from here
+int timerFd = -1;          // expires when TMOUT runs out at the prompt
+long idleTimeout = 0;      // TMOUT, seconds the prompt waits before exiting
+bool childWoken = false;   // a SIGCHLD was read, see reapChildren
+sigset_t childMask;        // signal mask children start with
+bool promptShown = false;  // the prompt is waiting for input, see clearPrompt
+const char* promptText = "";   // the prompt showing, drawn again by editLine
+
+// the limit builtin's io classes, by their number in ioprio_set
+const char* const ioClasses[] = {"none", "rt", "be", "idle"};
+
+// operators the lexer splits out, longest first so ">>" wins over ">". An
+// operator token points at one of these strings, which is how it is told
+// apart from a quoted word with the same text, see isOperator
+char* const operators[] = {"<<<", "2>&", "&&", "||", ">>", "2>", "|>", ">&", 
+	"&>", "<>", "<", ">", "|", "&", ";", "(", ")"};
+#define OPERATORCOUNT (sizeof(operators) / sizeof(operators[0]))
+
+// chars that end a run of plain word chars outside of quotes, see lexSpan
+const char lexSpecials[] = " \t'\"\\<>|&;()";
+const bool lexSpecial[256] = {   // the same as a lookup table
+	[' '] = true, ['\t'] = true, ['\''] = true, ['"'] = true, 
+	['\\'] = true, ['<'] = true, ['>'] = true, ['|'] = true, 
+	['&'] = true, [';'] = true, ['('] = true, [')'] = true
+};
+
+char pidString[16];        // our pid as text, worked out once for $$
+size_t pidStringLen;
+
+struct statsTable stats;   // resource usage of finished commands
+struct phaseTimer phases[PHASES] = {  // time spent on the hot paths
+	{"tokenize"}, {"expand"}, {"redirect"}, {"launch"}, {"reap"}
+};
+uint64_t startTicks;       // the tick counter and clock when we started,
+struct timespec startTime; // to work out the tick rate, see tickRate
+int traceFd = -1;          // SMALLSH_TRACE file, or -1
+struct pathCache paths;    // where commands were found in PATH
+struct varTable vars;      // shell variables, and the environment from them
+struct history history = {-1, -1};  // commands entered, see historyOpen
+struct lineEditor editor;  // the line being typed at a terminal
+struct completion completion = {false, -1};  // directories indexed for tab
+
+
+
 
+/*******************************************************************************
+ * readTicks
+ * returns the CPU's timestamp counter, which takes a few cycles to read, or 
+ * the monotonic clock in ns where there isn't one.
+ *
+ * ****************************************************************************/
+uint64_t readTicks(void){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+
+
+
+/*******************************************************************************
+ * phaseStart
+ * starts timing one run of a hot path (a PHASE_ number), see phases. Returns
+ * the ticks to hand to phaseEnd. Fires the phase__start probe.
+ *
+ * ****************************************************************************/
+uint64_t phaseStart(int phase){
+	PROBE(phase__start, phase);
+	return readTicks();
+}
 
-#define MAXINPUT 2048    // number of chars a user can enter at prompt
-#define MAXARGS 512      // most arguments in that string can be composed of
 
-// needed for signal handler
-bool canRunBG = true;      // can user run background process? 
+
+
+/*******************************************************************************
+ * phaseEnd
+ * adds the run of phase started at start to its timer and fires the
+ * phase__end probe with the ticks it took.
+ *
+ * ****************************************************************************/
+void phaseEnd(int phase, uint64_t start){
+	uint64_t ticks = readTicks() - start;
+	phases[phase].count++;
+	phases[phase].ticks += ticks;
+	if (ticks > phases[phase].max){
+		phases[phase].max = ticks;
+	}
+	PROBE(phase__end, phase, ticks);
+}
 
 
 /*******************************************************************************
  * printPrompt
- * prints the prompt for the user shell input. 
+ * prints the prompt for the user shell input. Scripts and -c commands don't 
+ * get a prompt. If TMOUT is set the idle timer starts now.
  *
  * ****************************************************************************/
 void printPrompt(void){
-	printf(": ");
+	struct itimerspec idle = {{0, 0}, {idleTimeout, 0}};
+
+	if (!interactive){
+		return;
+	}
+	promptText = ": ";
+	printf("%s", promptText);
 	fflush(stdout);
+	promptShown = true;
+	if (idleTimeout > 0){
+		timerfd_settime(timerFd, 0, &idle, NULL);
+	}
 }
 
 
 
 
 /*******************************************************************************
- * tokenizeInput
- * goes through the userInput string and seperates the string into tokens by
- * spaces, saving each token in the userCmds array. Also tracks the amount of 
- * tokens saved in the cmdCount variable.
+ * clearPrompt
+ * called before printing a message while the prompt is waiting for input 
+ * (a background job finishing) so it goes on a line of its own. The prompt 
+ * is printed again afterwards, see shellLoop.
  *
  * ****************************************************************************/
-void tokenizeInput(char* userInput, char** userCmds, int* cmdCount){
-	//printf("in tokenize\n");
-	char* token;      // stores each token form strtok
-	
-	// get first token
-	token = strtok(userInput, " ");
-	// while we havent reached the end of the input
-	while (token != NULL){
-		// allocate space for the token
-		userCmds[*cmdCount] = calloc(50, sizeof(char));
-		// copy the token into the array
-		strcpy(userCmds[*cmdCount], token);
-		// track how many commands we have
-		(*cmdCount)++;
-		// get the next token
-		token = strtok(NULL, " ");
+void clearPrompt(void){
+	if (promptShown){
+		putchar('\n');
+		promptShown = false;
 	}
 }
 
@@ -76,115 +698,8349 @@ void tokenizeInput(char* userInput, char** userCmds, int* cmdCount){
 
 
 /*******************************************************************************
- * printInput
- * loops through userCmds array and prints each command to the console.
+ * readSignals
+ * reads every signal waiting on the signalfd. A SIGCHLD sets childWoken for 
+ * reapChildren. Returns true if a SIGINT was among them.
  *
  * ****************************************************************************/
-void printInput(char** userCmds, int cmdCount){	
-	printf("tokenized input is:\n");
+bool readSignals(void){
+	struct signalfd_siginfo info[4];   // signals read at once
+	ssize_t bytesRead;
+	bool interrupt = false;            // was there a SIGINT?
 	int i;
-	for (i = 0; i < cmdCount; i++){
-		printf("%s\n", userCmds[i]);
-	} 
+
+	// standard signals don't queue, so one read nearly always does
+	while ((bytesRead = read(signalFd, info, sizeof(info))) > 0){
+		for (i = 0; i < bytesRead / (ssize_t)sizeof(info[0]); i++){
+			if (info[i].ssi_signo == SIGCHLD){
+				childWoken = true;
+			}
+			else if (info[i].ssi_signo == SIGINT){
+				interrupt = true;
+			}
+		}
+	}
+	return interrupt;
+}
+
+
+
+
+/*******************************************************************************
+ * waitInput
+ * waits until the input can be read, with poll on the input, the signalfd 
+ * and the TMOUT timer together. This is the one place the shell sleeps 
+ * between commands, so anything else that should wake it up belongs here. 
+ * Returns 0 once the input is readable, otherwise -1 with errno EINTR if a
+ * signal came in (a child finished or stopped, or ^C) or ETIMEDOUT if TMOUT
+ * ran out. A ^C at the prompt sets promptShown false so a fresh prompt is 
+ * printed.
+ *
+ * ****************************************************************************/
+int waitInput(struct inputReader* input){
+	struct pollfd fds[3];      // input, signals and timer
+	uint64_t expirations;      // read from the timer
+
+	fds[0].fd = input->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = signalFd;
+	fds[1].events = POLLIN;
+	fds[2].fd = idleTimeout > 0 ? timerFd : -1;
+	fds[2].events = POLLIN;
+	fds[0].revents = fds[1].revents = fds[2].revents = 0;
+
+	while (poll(fds, 3, -1) == -1){
+		if (errno != EINTR){
+			// can't wait, let read find out what's wrong
+			return 0;
+		}
+	}
+	if (fds[1].revents){
+		if (readSignals() && interactive){
+			clearPrompt();
+		}
+		errno = EINTR;
+		return -1;
+	}
+	if (fds[2].revents && read(timerFd, &expirations, 
+				sizeof(expirations)) > 0){
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * flushOutput
+ * pushes anything the shell has printed out to the user. At a terminal that 
+ * happens after every message, running a script the output is left to build
+ * up in stdout's buffer and is flushed before a child is launched or more 
+ * input is read.
+ *
+ * ****************************************************************************/
+void flushOutput(void){
+	if (interactive){
+		fflush(stdout);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * initInput
+ * sets up an input reader that reads blocks from the file descriptor fd. If
+ * str isn't NULL it is the whole input instead (for -c) and fd is ignored.
+ *
+ * ****************************************************************************/
+void initInput(struct inputReader* input, int fd, char* str){
+	input->fd = fd;
+	input->start = 0;
+	input->eof = false;
+	input->edit = false;
+	if (str){
+		input->size = strlen(str) + 1;
+		input->end = input->size - 1;
+		input->eof = true;
+	}
+	else {
+		input->size = INPUTBLOCK;
+		input->end = 0;
+	}
+	input->buf = malloc(input->size);
+	if (input->buf == NULL){
+		perror("malloc - input buffer");
+		exit(1);
+	}
+	if (str){
+		memcpy(input->buf, str, input->size);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * fillInput
+ * reads the next block of input after what is already buffered, first moving
+ * the unread bytes to the front of the buffer, and growing the buffer if a
+ * single line has filled it. One byte is always kept free past the end so
+ * readLine can terminate a last line that has no newline. Returns the bytes 
+ * read, 0 at end of file or -1 on error (EINTR if a signal came in while we 
+ * waited, see waitInput).
+ *
+ * ****************************************************************************/
+ssize_t fillInput(struct inputReader* input){
+	ssize_t bytesRead;     // result of read
+
+	if (input->eof){
+		return 0;
+	}
+	// slide the unread bytes down to make room, only the part of a line
+	// the last block ended in is ever moved
+	if (input->start > 0){
+		memmove(input->buf, input->buf + input->start, 
+				input->end - input->start);
+		input->end -= input->start;
+		input->start = 0;
+	}
+	// a line longer than the buffer, make it bigger
+	if (input->end + 1 >= input->size){
+		input->size *= 2;
+		input->buf = realloc(input->buf, input->size);
+		if (input->buf == NULL){
+			perror("realloc - input buffer");
+			exit(1);
+		}
+	}
+	// anything we printed should be out before we wait for more input
+	fflush(stdout);
+	if (waitInput(input) == -1){
+		return -1;
+	}
+	bytesRead = read(input->fd, input->buf + input->end, 
+			input->size - input->end - 1);
+	if (bytesRead > 0){
+		input->end += bytesRead;
+	}
+	else if (bytesRead == 0){
+		input->eof = true;
+	}
+	return bytesRead;
+}
+
+
+
+
+ssize_t editLine(struct inputReader* input, char** line);
+
+/*******************************************************************************
+ * readLine
+ * points line at the next line of input, right in the input buffer, so
+ * nothing is copied or allocated. The newline (and a '\r' before it) is 
+ * replaced with a '\0'. The line is only good until the next call, which may
+ * move the buffer. The last line doesn't need a newline. Returns the length 
+ * of the line, or -1 at end of input or if a signal interrupted the read 
+ * (errno is EINTR, call again) or TMOUT ran out (errno is ETIMEDOUT). At a 
+ * terminal the line editor reads the line instead, see editLine.
+ *
+ * ****************************************************************************/
+ssize_t readLine(struct inputReader* input, char** line){
+	char* newline;        // end of the line in the buffer
+	size_t scanned = 0;   // bytes already known not to be a newline
+	size_t len;           // length of the line
+
+	if (input->edit){
+		return editLine(input, line);
+	}
+	while (1){
+		newline = memchr(input->buf + input->start + scanned, '\n', 
+				input->end - input->start - scanned);
+		if (newline){
+			len = newline - (input->buf + input->start);
+			break;
+		}
+		scanned = input->end - input->start;
+		if (fillInput(input) <= 0){
+			// out of input, hand back whatever is left over
+			if (input->eof && input->end > input->start){
+				len = input->end - input->start;
+				break;
+			}
+			if (input->eof){
+				errno = 0;
+			}
+			return -1;
+		}
+	}
+
+	*line = input->buf + input->start;
+	// skip the newline too, if there was one
+	input->start += len + (newline != NULL);
+	// a line from a DOS file ends in "\r\n"
+	if (len > 0 && (*line)[len - 1] == '\r'){
+		len--;
+	}
+	(*line)[len] = '\0';
+	return len;
+}
+
+
+
+
+/*******************************************************************************
+ * arenaAlloc
+ * hands out size bytes from the arena by bumping a pointer. Chunks stay 
+ * allocated across resets, so once the arena has grown to fit the biggest 
+ * command seen no more heap allocations are made. A request that doesn't fit
+ * in the current chunk moves on to the next chunk big enough for it, making a
+ * new one only when there isn't one.
+ *
+ * ****************************************************************************/
+void* arenaAlloc(struct arena* arena, size_t size){
+	struct arenaChunk* chunk;     // chunk we'll allocate from
+	void* mem;                    // memory handed back
+
+	// keep everything aligned for any type
+	size = (size + ARENAALIGN - 1) & ~(size_t)(ARENAALIGN - 1);
+
+	// fits in the current chunk?
+	if (arena->cur && arena->used + size <= arena->cur->size){
+		mem = arena->cur->data + arena->used;
+		arena->used += size;
+		return mem;
+	}
+
+	// look for a later chunk that fits, left over from a bigger command
+	chunk = arena->cur ? arena->cur->next : arena->head;
+	while (chunk && chunk->size < size){
+		chunk = chunk->next;
+	}
+	// none, so make one and link it in after the current chunk
+	if (chunk == NULL){
+		size_t chunkSize = size > ARENACHUNK ? size : ARENACHUNK;
+		chunk = malloc(sizeof(struct arenaChunk) + chunkSize);
+		if (chunk == NULL){
+			perror("malloc - arena");
+			exit(1);
+		}
+		chunk->size = chunkSize;
+		if (arena->cur){
+			chunk->next = arena->cur->next;
+			arena->cur->next = chunk;
+		}
+		else {
+			chunk->next = arena->head;
+			arena->head = chunk;
+		}
+	}
+	arena->cur = chunk;
+	arena->used = size;
+	return chunk->data;
+}
+
+
+
+
+/*******************************************************************************
+ * arenaCopy
+ * copies len bytes of a string into the arena and NUL terminates it.
+ *
+ * ****************************************************************************/
+char* arenaCopy(struct arena* arena, const char* str, size_t len){
+	char* copy = arenaAlloc(arena, len + 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+
+
+
+/*******************************************************************************
+ * arenaReserve
+ * makes sure at least size bytes are free at the end of the arena's current
+ * chunk and returns a pointer to them without handing them out. room is set
+ * to how many bytes can be written there. Follow with arenaCommit once the 
+ * length of what was written is known.
+ *
+ * ****************************************************************************/
+char* arenaReserve(struct arena* arena, size_t size, size_t* room){
+	char* mem = arenaAlloc(arena, size);
+
+	// give it back, the next allocation starts from mem again
+	arena->used = mem - arena->cur->data;
+	*room = arena->cur->size - arena->used;
+	return mem;
+}
+
+
+
+
+/*******************************************************************************
+ * arenaCommit
+ * hands out the first size bytes of the space returned by arenaReserve.
+ *
+ * ****************************************************************************/
+void arenaCommit(struct arena* arena, size_t size){
+	arena->used += (size + ARENAALIGN - 1) & ~(size_t)(ARENAALIGN - 1);
+}
+
+
+
+
+/*******************************************************************************
+ * arenaSave
+ * remembers how much of the arena is in use, so everything allocated after
+ * this can be freed with arenaRestore without resetting the whole arena.
+ *
+ * ****************************************************************************/
+struct arenaMark arenaSave(struct arena* arena){
+	struct arenaMark mark;
+	mark.cur = arena->cur;
+	mark.used = arena->used;
+	return mark;
+}
+
+
+
+
+/*******************************************************************************
+ * arenaRestore
+ * frees everything allocated from the arena since mark was saved.
+ *
+ * ****************************************************************************/
+void arenaRestore(struct arena* arena, struct arenaMark mark){
+	arena->cur = mark.cur;
+	arena->used = mark.used;
+}
+
+
+
+
+/*******************************************************************************
+ * arenaReset
+ * frees everything allocated from the arena at once, in constant time. The 
+ * chunks are kept for the next command.
+ *
+ * ****************************************************************************/
+void arenaReset(struct arena* arena){
+	arena->cur = arena->head;
+	arena->used = 0;
+}
+
+
+
+
+/*******************************************************************************
+ * arenaFree
+ * gives the arena's chunks back to the heap.
+ *
+ * ****************************************************************************/
+void arenaFree(struct arena* arena){
+	struct arenaChunk* next;
+	while (arena->head){
+		next = arena->head->next;
+		free(arena->head);
+		arena->head = next;
+	}
+	arena->cur = NULL;
+	arena->used = 0;
+}
+
+
+
+
+/*******************************************************************************
+ * isOperator
+ * checks if a token is the operator op, or any operator if op is NULL. A 
+ * quoted '<' is just a word, so operators are recognized by pointing into 
+ * the operators table rather than by their text.
+ *
+ * ****************************************************************************/
+bool isOperator(const char* word, const char* op){
+	size_t i;
+
+	for (i = 0; i < OPERATORCOUNT; i++){
+		if (word == operators[i]){
+			return op == NULL || strcmp(word, op) == 0;
+		}
+	}
+	return false;
+}
+
+
+
+
+/*******************************************************************************
+ * matchOperator
+ * returns the operator the input at c starts with, or NULL. Only called at
+ * the start of a token, so "2>" is only an operator there.
+ *
+ * ****************************************************************************/
+char* matchOperator(const char* c, const char* end){
+	size_t i;
+	size_t len;
+
+	// most tokens are words, and can't start with one
+	if (*c != '2' && !lexSpecial[(unsigned char)*c]){
+		return NULL;
+	}
+	for (i = 0; i < OPERATORCOUNT; i++){
+		len = strlen(operators[i]);
+		if ((size_t)(end - c) >= len && 
+				memcmp(c, operators[i], len) == 0){
+			return operators[i];
+		}
+	}
+	return NULL;
+}
+
+
+
+
+/*******************************************************************************
+ * lexSpan
+ * returns how many of the len bytes at s are plain word chars, ones that mean
+ * nothing special outside of quotes. Most words are all plain, so this is 
+ * where the lexer spends its time. Long runs are checked 32 (AVX2) or 16 
+ * (SSE2) bytes at a time, lexSpanScalar does the rest and is the fallback 
+ * on other machines.
+ *
+ * ****************************************************************************/
+size_t lexSpanScalar(const char* s, size_t len){
+	size_t i = 0;
+
+	while (i < len && !lexSpecial[(unsigned char)s[i]]){
+		i++;
+	}
+	return i;
+}
+
+#if defined(__AVX2__)
+size_t lexSpan(const char* s, size_t len){
+	size_t i = 0;
+	__m256i specials[sizeof(lexSpecials) - 1];  // each one in every byte
+	__m256i block;            // 32 bytes of s
+	__m256i hits;             // 0xff where a byte is special
+	unsigned mask;            // one bit per byte of hits
+	size_t j;
+
+	if (len < 32){
+		return lexSpanScalar(s, len);
+	}
+	for (j = 0; j < sizeof(specials) / sizeof(specials[0]); j++){
+		specials[j] = _mm256_set1_epi8(lexSpecials[j]);
+	}
+	for (; i + 32 <= len; i += 32){
+		block = _mm256_loadu_si256((const __m256i*)(s + i));
+		hits = _mm256_setzero_si256();
+		for (j = 0; j < sizeof(specials) / sizeof(specials[0]); j++){
+			hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, specials[j]));
+		}
+		mask = _mm256_movemask_epi8(hits);
+		if (mask){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + lexSpanScalar(s + i, len - i);
+}
+#elif defined(__SSE2__)
+size_t lexSpan(const char* s, size_t len){
+	size_t i = 0;
+	__m128i specials[sizeof(lexSpecials) - 1];  // each one in every byte
+	__m128i block;            // 16 bytes of s
+	__m128i hits;             // 0xff where a byte is special
+	unsigned mask;            // one bit per byte of hits
+	size_t j;
+
+	if (len < 16){
+		return lexSpanScalar(s, len);
+	}
+	for (j = 0; j < sizeof(specials) / sizeof(specials[0]); j++){
+		specials[j] = _mm_set1_epi8(lexSpecials[j]);
+	}
+	for (; i + 16 <= len; i += 16){
+		block = _mm_loadu_si128((const __m128i*)(s + i));
+		hits = _mm_setzero_si128();
+		for (j = 0; j < sizeof(specials) / sizeof(specials[0]); j++){
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, specials[j]));
+		}
+		mask = _mm_movemask_epi8(hits);
+		if (mask){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + lexSpanScalar(s + i, len - i);
+}
+#else
+size_t lexSpan(const char* s, size_t len){
+	return lexSpanScalar(s, len);
+}
+#endif
+
+
+
+
+/*******************************************************************************
+ * tokenizeInput
+ * splits len bytes of input into tokens: words separated by spaces and tabs,
+ * and the operators (see operators) which need no spaces around them. In a
+ * word, '...' keeps everything in it as is, "..." keeps everything but '$'
+ * expansions and a '\' before one of $ " \ `, and outside of quotes '\'
+ * keeps the next char as is. The quotes and backslashes are removed, and a
+ * quoted '$' gets a QUOTEMARK in front so expandWord leaves it alone. In a
+ * word with a '$' each quote and '\' leaves a QUOTEEND behind instead, so
+ * "$HOME"x still ends the name at the quote; expandWords strips them, and 
+ * only looks at words with a '$'. The words are copied into the arena, so the input can go away, and the
+ * userCmds array of token pointers is allocated from the arena too. The
+ * array is NULL terminated and the amount of tokens saved is tracked in the
+ * cmdCount variable. If spans isn't NULL the input is copied into the arena
+ * as well, and token i is (*spans)[2i] up to (*spans)[2i+1] in the copy, 
+ * quotes and all, so a command can be shown as it was typed. Returns false,
+ * with no tokens, if a quote isn't closed.
+ *
+ * ****************************************************************************/
+bool tokenizeInput(const char* input, size_t len, struct arena* arena, 
+		char*** userCmds, int* cmdCount, char*** spans){
+	const char* c = input;        // walks the input
+	const char* end = input + len;
+	const char* close;            // closing quote
+	const char* dollar;           // '$' in single quotes
+	char* text;                   // arena space for the words
+	char* out;                    // where the words are written
+	char* word;                   // start of the current word
+	char* op;                     // operator at c
+	size_t room;                  // bytes the arena gave us
+	size_t span;                  // plain chars at c
+	bool unclosed = false;        // a quote was never closed
+	char* raw = NULL;             // the copy of the input spans point into
+	uint64_t start = phaseStart(PHASE_TOKENIZE);
+
+	// every token takes at least one byte of input, and a word is never 
+	// more than twice as long as its input (counting its NUL) since only 
+	// a quoted '$' grows, and it needs a quote or '\' to be quoted, which
+	// leave at most a QUOTEEND each
+	*userCmds = arenaAlloc(arena, (len + 1) * sizeof(char*));
+	if (spans){
+		*spans = arenaAlloc(arena, 2 * len * sizeof(char*));
+		raw = arenaCopy(arena, input, len);
+	}
+	text = out = arenaReserve(arena, len * 2 + 1, &room);
+	*cmdCount = 0;
+
+	while (!unclosed){
+		// skip the blanks before the token
+		while (c < end && (*c == ' ' || *c == '\t')){
+			c++;
+		}
+		if (c == end){
+			break;
+		}
+		if (spans){
+			(*spans)[2 * *cmdCount] = raw + (c - input);
+		}
+		// an operator is its own token
+		op = matchOperator(c, end);
+		if (op){
+			c += strlen(op);
+			if (spans){
+				(*spans)[2 * *cmdCount + 1] = raw + (c - input);
+			}
+			(*userCmds)[(*cmdCount)++] = op;
+			continue;
+		}
+
+		// a word runs up to a blank or an operator outside of quotes
+		word = out;
+		while (c < end){
+			span = lexSpan(c, end - c);
+			memcpy(out, c, span);
+			out += span;
+			c += span;
+			if (c == end || *c == ' ' || *c == '\t' || 
+					strchr("<>|&;()", *c)){
+				break;
+			}
+			// a quote or '\' ends a $NAME before it
+			if (memchr(word, '$', out - word)){
+				*out++ = QUOTEEND;
+			}
+			// a backslash keeps the next char, if there is one
+			if (*c == '\\'){
+				if (++c == end){
+					*out++ = '\\';
+					break;
+				}
+				if (*c == '$'){
+					*out++ = QUOTEMARK;
+				}
+				*out++ = *c++;
+			}
+			// single quotes keep everything up to the next one
+			else if (*c == '\''){
+				c++;
+				close = memchr(c, '\'', end - c);
+				if (close == NULL){
+					unclosed = true;
+					break;
+				}
+				while ((dollar = memchr(c, '$', close - c))){
+					memcpy(out, c, dollar - c);
+					out += dollar - c;
+					*out++ = QUOTEMARK;
+					*out++ = '$';
+					c = dollar + 1;
+				}
+				memcpy(out, c, close - c);
+				out += close - c;
+				c = close + 1;
+				if (memchr(word, '$', out - word)){
+					*out++ = QUOTEEND;
+				}
+			}
+			// double quotes keep '$' and some backslashes working
+			else {
+				for (c++; c < end && *c != '"'; c++){
+					if (*c == '\\' && c + 1 < end && 
+							strchr("$\"\\`", c[1])){
+						c++;
+						if (*c == '$'){
+							*out++ = QUOTEMARK;
+						}
+					}
+					*out++ = *c;
+				}
+				if (c == end){
+					unclosed = true;
+					break;
+				}
+				c++;
+				if (memchr(word, '$', out - word)){
+					*out++ = QUOTEEND;
+				}
+			}
+		}
+		*out++ = '\0';
+		if (spans){
+			(*spans)[2 * *cmdCount + 1] = raw + (c - input);
+		}
+		(*userCmds)[(*cmdCount)++] = word;
+	}
+	arenaCommit(arena, out - text);
+
+	if (unclosed){
+		printf("syntax error: unterminated quote\n");
+		flushOutput();
+		*cmdCount = 0;
+	}
+	(*userCmds)[*cmdCount] = NULL;
+	phaseEnd(PHASE_TOKENIZE, start);
+	PROBE(tokenize__done, len, *cmdCount);
+	return !unclosed;
+}
+
+
+
+
+/*******************************************************************************
+ * printInput
+ * loops through userCmds array and prints each command to the console.
+ *
+ * ****************************************************************************/
+void printInput(char** userCmds, int cmdCount){	
+	printf("tokenized input is:\n");
+	int i;
+	for (i = 0; i < cmdCount; i++){
+		printf("%s\n", userCmds[i]);
+	} 
+}
+
+
+
+
+/*******************************************************************************
+ * appendTo
+ * adds len bytes of str to the end of a word being expanded, if there is 
+ * room. Returns false if the word has run out of room.
+ *
+ * ****************************************************************************/
+bool appendTo(struct expandBuf* buf, const char* str, size_t len){
+	if (buf->len + len >= buf->room){
+		return false;
+	}
+	memcpy(buf->out + buf->len, str, len);
+	buf->len += len;
+	return true;
+}
+
+
+
+
+char* getVar(const char* name);
+
+/*******************************************************************************
+ * expandWord
+ * makes one pass over a command, copying it into buf with each expansion 
+ * replaced by its value:
+ *   $$        the process ID of the shell
+ *   $?        exit value of the last foreground command (128 + signal number
+ *             if it was terminated or stopped by a signal)
+ *   $!        process ID of the last background job
+ *   $NAME     the shell variable NAME, ${NAME} also works
+ * A '$' that doesn't start one of these is kept as is, and the QUOTEENDs 
+ * tokenizeInput left are dropped. Returns false if buf ran out of room.
+ *
+ * ****************************************************************************/
+bool expandWord(char* word, struct expandBuf* buf, struct expansion* values){
+	char* dollar;         // next '$' in the word
+	char* name;           // start of a variable name
+	char* nameEnd;        // just past the end of it
+	char* value;          // value of the variable
+	char saved;           // char overwritten to NUL terminate the name
+
+	while (*word){
+		// copy everything up to the next '$' in one go, leaving out
+		// where quotes were
+		dollar = strpbrk(word, "$" "\002");
+		if (dollar == NULL){
+			return appendTo(buf, word, strlen(word));
+		}
+		if (*dollar == QUOTEEND){
+			if (!appendTo(buf, word, dollar - word)){
+				return false;
+			}
+			word = dollar + 1;
+			continue;
+		}
+		// a quoted '$' is just a '$', see tokenizeInput
+		if (dollar > word && dollar[-1] == QUOTEMARK){
+			if (!appendTo(buf, word, dollar - word - 1) || 
+					!appendTo(buf, "$", 1)){
+				return false;
+			}
+			word = dollar + 1;
+			continue;
+		}
+		if (!appendTo(buf, word, dollar - word)){
+			return false;
+		}
+		word = dollar + 1;
+
+		// $$, $? and $! were worked out once up front
+		if (*word == '$' || *word == '?' || *word == '!'){
+			if (*word == '$' && 
+				!appendTo(buf, values->pid, values->pidLen)){
+				return false;
+			}
+			if (*word == '?' && 
+				!appendTo(buf, values->status, values->statusLen)){
+				return false;
+			}
+			if (*word == '!' && 
+				!appendTo(buf, values->bgPid, values->bgPidLen)){
+				return false;
+			}
+			word++;
+			continue;
+		}
+
+		// find the variable name, with or without braces
+		name = *word == '{' ? word + 1 : word;
+		nameEnd = name;
+		if (isalpha((unsigned char)*nameEnd) || *nameEnd == '_'){
+			while (isalnum((unsigned char)*nameEnd) || 
+					*nameEnd == '_'){
+				nameEnd++;
+			}
+		}
+		// not a variable, or a '{' without its '}', keep the '$'
+		if (nameEnd == name || (name != word && *nameEnd != '}')){
+			if (!appendTo(buf, "$", 1)){
+				return false;
+			}
+			continue;
+		}
+
+		// NUL terminate the name in place just long enough to look it up
+		saved = *nameEnd;
+		*nameEnd = '\0';
+		value = getVar(name);
+		*nameEnd = saved;
+		if (value && !appendTo(buf, value, strlen(value))){
+			return false;
+		}
+		word = name != word ? nameEnd + 1 : nameEnd;
+	}
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * statusValue
+ * returns what $? shows for a wait status: the exit value, or 128 + the 
+ * signal number if the command was terminated or stopped by a signal.
+ *
+ * ****************************************************************************/
+int statusValue(int childExitMethod){
+	return WIFSIGNALED(childExitMethod) ? 128 + WTERMSIG(childExitMethod) :
+		WIFSTOPPED(childExitMethod) ? 128 + WSTOPSIG(childExitMethod) :
+		WEXITSTATUS(childExitMethod);
+}
+
+
+
+
+/*******************************************************************************
+ * expandWords
+ * loops through array of user commands and expands any that contain a '$' 
+ * (see expandWord). Each expanded command is written straight into the free
+ * space at the end of the arena and then committed, so nothing is copied 
+ * twice. If an expansion outgrows the space the arena had, it is redone in a
+ * chunk with twice the room.
+ *
+ * ****************************************************************************/
+void expandWords(char** userCmds, int cmdCount, int childExitMethod, 
+		pid_t lastBgPid, struct arena* arena){
+	int i;                        // tracks loop
+	size_t want;                  // room to ask the arena for
+	struct expandBuf buf;         // where the expanded command goes
+	struct expansion values;      // what $$, $? and $! expand to
+	char status[16];              // text of $?
+	char bgPid[16];               // text of $!
+	uint64_t start = phaseStart(PHASE_EXPAND);
+
+	// work out $? and $! once for the whole command
+	values.pid = pidString;
+	values.pidLen = pidStringLen;
+	values.status = status;
+	values.statusLen = snprintf(status, sizeof(status), "%d", 
+			statusValue(childExitMethod));
+	values.bgPid = bgPid;
+	values.bgPidLen = 0;
+	bgPid[0] = '\0';
+	if (lastBgPid > 0){
+		values.bgPidLen = snprintf(bgPid, sizeof(bgPid), "%d", 
+				(int)lastBgPid);
+	}
+
+	// loop through all the commands in array
+	for (i = 0; i < cmdCount; i++){
+		// most commands have nothing to expand
+		if (userCmds[i] == NULL || strchr(userCmds[i], '$') == NULL){
+			continue;
+		}
+		want = strlen(userCmds[i]) * 2 + 64;
+		while (1){
+			buf.out = arenaReserve(arena, want, &buf.room);
+			buf.len = 0;
+			if (expandWord(userCmds[i], &buf, &values)){
+				break;
+			}
+			// didn't fit, try again with more room
+			want = buf.room * 2;
+		}
+		buf.out[buf.len] = '\0';
+		arenaCommit(arena, buf.len + 1);
+		userCmds[i] = buf.out;
+	}
+	phaseEnd(PHASE_EXPAND, start);
+}
+
+
+
+
+/*******************************************************************************
+ * changeDirectory
+ * the cd builtin:  cd [dir]
+ * checks if a directory path argument was entered and if so changes the 
+ * current workiing directory to that location. If a path argument wasn't 
+ * provided, the current working directory is set to the users HOME directory.
+ * Returns 1 if the directory couldn't be changed, the shell carries on.
+ *
+ * ****************************************************************************/
+int changeDirectory(struct shell* sh, char** userCmds, int cmdCount){
+	int ret;   // stores returned value from chdir 
+
+	// check if just 'cd' command or if has path
+	if (userCmds[1] == NULL){
+		// change to home directory
+		//Ref:   https://tinyurl.com/yd3yk2ez
+		ret = getVar("HOME") ? chdir(getVar("HOME")) : -1;
+		// check if chdir error
+		if (ret == -1){
+			printf("error changing to HOME dir\n");
+			flushOutput();
+			return 1;
+		}
+	}
+	// else a path was specified
+	else{
+		ret = chdir(userCmds[1]);
+		// check if chdir error
+		if (ret == -1){
+			printf("error changing to %s\n", userCmds[1]);
+			flushOutput();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * checkIfBG
+ * checks the last element of userCmds array to see if the user wanted to run
+ * the process in the background. Updates the wantRunGB bool appropriately.
+ *
+ * ****************************************************************************/
+void checkIfBG(char** userCmds, int cmdCount, bool* wantRunBG){
+	// if the last command is '&'
+	if (isOperator(userCmds[cmdCount - 1], "&")){
+		//printf("user wants bg process\n");
+		*wantRunBG = true;
+		// null out the bg command so not passed to execvp
+		userCmds[cmdCount - 1] = NULL;
+	}
+	else {
+		*wantRunBG = false;
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * checkStatus
+ * the status builtin. Checks if the last process exited, recieved a signal or
+ * was stopped and prints the cooresponding exit or signal information. Only 
+ * one of WIFEXITED, WIFSIGNALED or WIFSTOPPED should return a non-zero value.
+ *
+ * ****************************************************************************/
+int checkStatus(struct shell* sh, char** userCmds, int cmdCount){
+	//printf("in checkStatus\n");
+	// check if process exited
+	if (WIFEXITED(sh->status) != 0){
+		// get and print the exit status
+		int exitStatus = WEXITSTATUS(sh->status);
+		printf("exit value %d\n", exitStatus);
+		flushOutput();
+	}
+	// check if the process recieved a signal
+	else if (WIFSIGNALED(sh->status) != 0){
+		// get and print the signal number
+		int sigStatus = WTERMSIG(sh->status);
+		printf("terminated by signal %d\n", sigStatus);
+		flushOutput();
+	}
+	// or was stopped, and is in the job table now
+	else if (WIFSTOPPED(sh->status) != 0){
+		printf("stopped by signal %d\n", WSTOPSIG(sh->status));
+		flushOutput();
+	}
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * isRedirect
+ * checks if a token is one of the re-direct operators findReDirect handles.
+ *
+ * ****************************************************************************/
+bool isRedirect(const char* word){
+	return isOperator(word, "<") || isOperator(word, ">") || 
+			isOperator(word, ">>") || isOperator(word, "2>") ||
+			isOperator(word, "<>") || isOperator(word, "&>") ||
+			isOperator(word, ">&") || isOperator(word, "2>&") ||
+			isOperator(word, "<<<");
+}
+
+
+
+
+/*******************************************************************************
+ * findReDirect
+ * scans the user commands for re-directs and records them, in order, in an 
+ * array allocated from the arena:
+ *   < file     input from file            <> file    file read and written
+ *   > file     output to file             >> file    output appended to file
+ *   2> file    errors to file             &> file    output and errors to file
+ *   >&n, 2>&n  output or errors to fd n   <<< word   input is word, a line
+ * A re-direct and its word are removed from the commands, and the rest are
+ * moved down so nothing after it is lost, with cmdCount updated. This is 
+ * done in the parent so the same re-directs can be handed to posix_spawn, a
+ * forked child or a builtin. Returns how many re-directs there were, or -1
+ * (having said so) if one is missing its word.
+ *
+ * ****************************************************************************/
+int findReDirect(char** userCmds, int* cmdCount, struct arena* arena,
+		struct redirect** redirects){
+	struct redirect* redirect;   // the one being filled in
+	int count = 0;               // re-directs found
+	int kept = 0;                // commands kept
+	char* op;                    // the re-direct symbol
+	char* word;                  // the word after it
+	int i;    // for looping
+	uint64_t start = phaseStart(PHASE_REDIRECT);
+
+	// each re-direct uses two commands and makes at most two entries
+	*redirects = arenaAlloc(arena, (*cmdCount + 1) * sizeof(struct redirect));
+
+	// loop through all of the user commands
+	for (i = 0; i < *cmdCount; i++){
+		op = userCmds[i];
+		// check value wasn't NULL'd out
+		if (op == NULL){
+			continue;
+		}
+		// not a re-direct, leave it alone
+		if (!isRedirect(op)){
+			userCmds[kept++] = op;
+			continue;
+		}
+		// every re-direct needs a word after it, 2>& needs a number
+		word = i + 1 < *cmdCount ? userCmds[++i] : NULL;
+		if (word == NULL || isOperator(word, word) || 
+				(isOperator(op, "2>&") && (word[0] == '\0' ||
+				 word[strspn(word, "0123456789")] != '\0'))){
+			printf("syntax error near '%s'\n", word ? word : op);
+			flushOutput();
+			phaseEnd(PHASE_REDIRECT, start);
+			return -1;
+		}
+
+		redirect = &(*redirects)[count++];
+		redirect->type = REDIR_OPEN;
+		redirect->fd = op[0] == '2' ? 2 : op[0] == '<' ? 0 : 1;
+		redirect->flags = O_WRONLY | O_CREAT | O_TRUNC;
+		redirect->dupFd = -1;
+		redirect->path = word;
+		if (isOperator(op, "<")){
+			redirect->flags = O_RDONLY;
+		}
+		else if (isOperator(op, "<>")){
+			redirect->flags = O_RDWR | O_CREAT;
+		}
+		else if (isOperator(op, ">>")){
+			redirect->flags = O_WRONLY | O_CREAT | O_APPEND;
+		}
+		else if (isOperator(op, "<<<")){
+			redirect->type = REDIR_STRING;
+		}
+		// >&n copies fd n, >&file is the same as &>file
+		else if (isOperator(op, "2>&") || (isOperator(op, ">&") && 
+				word[0] != '\0' && 
+				word[strspn(word, "0123456789")] == '\0')){
+			redirect->type = REDIR_DUP;
+			redirect->dupFd = atoi(word);
+		}
+		// errors go wherever output went
+		if (isOperator(op, "&>") || (isOperator(op, ">&") && 
+					redirect->type == REDIR_OPEN)){
+			redirect = &(*redirects)[count++];
+			redirect->type = REDIR_DUP;
+			redirect->fd = 2;
+			redirect->dupFd = 1;
+			redirect->path = NULL;
+		}
+	}
+	userCmds[kept] = NULL;
+	*cmdCount = kept;
+	phaseEnd(PHASE_REDIRECT, start);
+	return count;
+}
+
+
+
+
+/*******************************************************************************
+ * hereString
+ * returns a file descriptor that reads text and a newline, for '<<<'. It is a
+ * memfd, so text of any size is fine and nothing has to write it while the 
+ * command reads. Returns -1 if it can't be made.
+ *
+ * ****************************************************************************/
+int hereString(const char* text){
+	size_t len = strlen(text);
+	ssize_t written;
+	size_t done = 0;
+	int fd = memfd_create("here-string", MFD_CLOEXEC);
+
+	if (fd == -1){
+		return -1;
+	}
+	while (done < len + 1){
+		// the text, then its newline
+		written = done < len ? write(fd, text + done, len - done) :
+			write(fd, "\n", 1);
+		if (written == -1 && errno != EINTR){
+			close(fd);
+			return -1;
+		}
+		if (written > 0){
+			done += written;
+		}
+	}
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+
+
+
+/*******************************************************************************
+ * applyRedirect
+ * does one re-direct in this process, used by forked children and builtins.
+ * A file is opened close on exec and then dup2'd onto the fd, and the 
+ * original is closed so the command doesn't inherit a second copy. Returns 
+ * false, having reported why, if it couldn't be done.
+ *
+ * ****************************************************************************/
+bool applyRedirect(struct redirect* redirect){
+	int file;                // the file opened, or here-string
+
+	if (redirect->type == REDIR_DUP){
+		if (dup2(redirect->dupFd, redirect->fd) == -1){
+			printf("%d: bad file descriptor\n", redirect->dupFd);
+			return false;
+		}
+		return true;
+	}
+	if (redirect->type == REDIR_STRING){
+		file = hereString(redirect->path);
+		if (file == -1){
+			perror("here-string");
+			return false;
+		}
+	}
+	else {
+		file = open(redirect->path, redirect->flags | O_CLOEXEC, 0644);
+		if (file == -1){
+			printf("cannot open %s for %s\n", redirect->path, 
+					redirect->fd == 0 ? "input" : "output");
+			return false;
+		}
+	}
+	// it may have landed on the fd itself, which has to survive exec
+	if (file == redirect->fd){
+		fcntl(file, F_SETFD, 0);
+		return true;
+	}
+	if (dup2(file, redirect->fd) == -1){
+		perror("dup2 - re-direct");
+		close(file);
+		return false;
+	}
+	close(file);
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * checkReDirect
+ * used by forked children. Background processes (nullIn and nullOut) read 
+ * and write /dev/null unless their input or output is piped, then the user's
+ * re-directs are applied on top, so they still win. Exits the child if one 
+ * can't be done.
+ *
+ * ****************************************************************************/
+void checkReDirect(struct stage* stage){
+	//printf("checking for input/output re-direction\n");
+	struct redirect devNull = {REDIR_OPEN, 0, O_RDONLY, -1, "/dev/null"};
+	int i;
+
+	// the child's timers are lost when it execs, but a probe still fires
+	PROBE(redirect__child, stage->redirectCount);
+
+	// if we're running process in bg we need to redirect input and output
+	// from their default values
+	if (stage->nullIn && !applyRedirect(&devNull)){
+		exit(1);
+	}
+	devNull.fd = 1;
+	devNull.flags = O_WRONLY;
+	if (stage->nullOut && !applyRedirect(&devNull)){
+		exit(1);
+	}
+	// then the user's, in the order given
+	for (i = 0; i < stage->redirectCount; i++){
+		if (!applyRedirect(&stage->redirects[i])){
+			fflush(stdout);
+			exit(1);
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * parseAmount
+ * reads a whole number, which may end in K, M, G or T (powers of 1024), into
+ * value. Returns false if str isn't one.
+ *
+ * ****************************************************************************/
+bool parseAmount(const char* str, long long* value){
+	char* end;               // where the digits stop
+	int shift = 0;           // the suffix, as a power of 2
+
+	errno = 0;
+	*value = strtoll(str, &end, 10);
+	if (end == str || errno != 0){
+		return false;
+	}
+	if (*end != '\0' && strchr("KkMmGgTt", *end)){
+		shift = (strchr("KMGT", toupper((unsigned char)*end)) - "KMGT" 
+				+ 1) * 10;
+		end++;
+	}
+	if (*end != '\0' || *value > (INT64_MAX >> shift) || 
+			*value < -(INT64_MAX >> shift)){
+		return false;
+	}
+	*value *= 1LL << shift;
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * parseCpus
+ * reads a list of cpus like 0-3,6 into cpus. Returns false if str isn't one.
+ *
+ * ****************************************************************************/
+bool parseCpus(const char* str, cpu_set_t* cpus){
+	char* end;               // where a number stops
+	long first, last;        // a range of cpus
+
+	CPU_ZERO(cpus);
+	while (1){
+		if (!isdigit((unsigned char)*str)){
+			return false;
+		}
+		first = last = strtol(str, &end, 10);
+		if (*end == '-'){
+			str = end + 1;
+			if (!isdigit((unsigned char)*str)){
+				return false;
+			}
+			last = strtol(str, &end, 10);
+		}
+		if (last < first || last >= CPU_SETSIZE){
+			return false;
+		}
+		for (; first <= last; first++){
+			CPU_SET(first, cpus);
+		}
+		if (*end == '\0'){
+			return true;
+		}
+		if (*end != ','){
+			return false;
+		}
+		str = end + 1;
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * parseLimits
+ * reads the options of the limit builtin (see setLimits) from words[1] on 
+ * into limits. The rlimits are checked against their hard limits here, so 
+ * a job isn't launched only to fail. -r sets *clear. Returns the index of 
+ * the first word that isn't an option, or -1 after saying what's wrong.
+ *
+ * ****************************************************************************/
+int parseLimits(char** words, int count, struct limits* limits, bool* clear){
+	struct rlimit hard;      // what an rlimit can't be raised past
+	long long value;         // an option's value
+	char* option;            // the option being read
+	char* arg;               // and its value
+	char* level;             // the level of an io class
+	int resource = 0;        // rlimit an option sets
+	size_t len;              // of the io class's name
+	int i;
+
+	for (i = 1; i < count && words[i] && words[i][0] == '-'; i++){
+		option = words[i];
+		if (strcmp(option, "--") == 0){
+			return i + 1;
+		}
+		if (strcmp(option, "-r") == 0){
+			*clear = true;
+			continue;
+		}
+		if (strcmp(option, "-g") == 0){
+			limits->set |= LIMIT_CGROUP;
+			continue;
+		}
+		if (option[1] == '\0' || option[2] != '\0' || 
+				strchr("tvnpicmw", option[1]) == NULL){
+			printf("limit: %s: unknown option\n", option);
+			return -1;
+		}
+		if (i + 1 >= count || words[i + 1] == NULL){
+			printf("limit: %s needs a value\n", option);
+			return -1;
+		}
+		arg = words[++i];
+
+		// io class, with the level after a ':'
+		if (option[1] == 'i'){
+			level = strchr(arg, ':');
+			len = level ? (size_t)(level - arg) : strlen(arg);
+			for (value = 1; value <= 3; value++){
+				if (strlen(ioClasses[value]) == len && 
+						strncmp(arg, ioClasses[value], len)
+						== 0){
+					break;
+				}
+			}
+			if (value > 3 || (level && (level[1] < '0' || 
+					level[1] > '7' || level[2] != '\0'))){
+				printf("limit: -i %s: expected idle, be[:0-7] or "
+						"rt[:0-7]\n", arg);
+				return -1;
+			}
+			limits->ioClass = value;
+			limits->ioLevel = level ? level[1] - '0' : 4;
+			limits->set |= LIMIT_IO;
+			continue;
+		}
+		if (option[1] == 'c'){
+			if (!parseCpus(arg, &limits->cpus)){
+				printf("limit: -c %s: expected cpus like 0-3,6\n",
+						arg);
+				return -1;
+			}
+			limits->set |= LIMIT_CPUS;
+			continue;
+		}
+
+		// the rest are numbers, in range
+		if (!parseAmount(arg, &value) || 
+				(option[1] == 'p' ? value < -20 || value > 19 :
+				 option[1] == 'w' ? value < 1 || value > 10000 :
+				 value < 1)){
+			printf("limit: %s %s: bad value\n", option, arg);
+			return -1;
+		}
+		switch (option[1]){
+			case 't':
+				resource = RLIMIT_CPU;
+				limits->cpuTime = value;
+				limits->set |= LIMIT_CPU;
+				break;
+			case 'v':
+				resource = RLIMIT_AS;
+				limits->addressSpace = value;
+				limits->set |= LIMIT_AS;
+				break;
+			case 'n':
+				resource = RLIMIT_NOFILE;
+				limits->openFiles = value;
+				limits->set |= LIMIT_FILES;
+				break;
+			case 'p':
+				limits->nice = value;
+				limits->set |= LIMIT_NICE;
+				continue;
+			case 'm':
+				limits->memory = value;
+				limits->set |= LIMIT_MEMORY;
+				continue;
+			case 'w':
+				limits->weight = value;
+				limits->set |= LIMIT_WEIGHT;
+				continue;
+		}
+		// cpu time's hard limit is a second more, see applyLimits
+		getrlimit(resource, &hard);
+		if (hard.rlim_max != RLIM_INFINITY && (rlim_t)value + 
+				(resource == RLIMIT_CPU) > hard.rlim_max){
+			printf("limit: %s %s: over the hard limit of %llu\n", 
+					option, arg, 
+					(unsigned long long)hard.rlim_max);
+			return -1;
+		}
+	}
+	return i;
+}
+
+
+
+
+/*******************************************************************************
+ * mergeLimits
+ * sets every field of into that is set in from, leaving the others alone.
+ *
+ * ****************************************************************************/
+void mergeLimits(struct limits* into, struct limits* from){
+	int set = from->set;
+	if (set & LIMIT_CPU){
+		into->cpuTime = from->cpuTime;
+	}
+	if (set & LIMIT_AS){
+		into->addressSpace = from->addressSpace;
+	}
+	if (set & LIMIT_FILES){
+		into->openFiles = from->openFiles;
+	}
+	if (set & LIMIT_NICE){
+		into->nice = from->nice;
+	}
+	if (set & LIMIT_IO){
+		into->ioClass = from->ioClass;
+		into->ioLevel = from->ioLevel;
+	}
+	if (set & LIMIT_CPUS){
+		into->cpus = from->cpus;
+	}
+	if (set & LIMIT_MEMORY){
+		into->memory = from->memory;
+	}
+	if (set & LIMIT_WEIGHT){
+		into->weight = from->weight;
+	}
+	into->set |= set;
+}
+
+
+
+
+/*******************************************************************************
+ * cgroupFile
+ * opens file in the cgroup dir under the shell's (the shell's own if dir is
+ * NULL). Returns the fd, or -1.
+ *
+ * ****************************************************************************/
+int cgroupFile(const char* dir, const char* file, int flags){
+	char path[128];
+	snprintf(path, sizeof(path), "%s/%s", dir ? dir : ".", file);
+	return openat(cgroups.dirFd, path, flags | O_CLOEXEC);
+}
+
+
+
+
+/*******************************************************************************
+ * writeCgroup
+ * writes text to a cgroup file (see cgroupFile). Returns false with errno 
+ * set if it couldn't, see cgroupError.
+ *
+ * ****************************************************************************/
+bool writeCgroup(const char* dir, const char* file, const char* text){
+	int fd = cgroupFile(dir, file, O_WRONLY);
+	ssize_t len = strlen(text);
+	int saved;
+	bool ok;
+
+	if (fd == -1){
+		return false;
+	}
+	ok = write(fd, text, len) == len;
+	saved = errno;
+	close(fd);
+	errno = saved;
+	return ok;
+}
+
+
+
+
+/*******************************************************************************
+ * readCgroup
+ * reads a cgroup file (see cgroupFile) into buf as a string. Returns its 
+ * length, or -1.
+ *
+ * ****************************************************************************/
+ssize_t readCgroup(const char* dir, const char* file, char* buf, size_t size){
+	int fd = cgroupFile(dir, file, O_RDONLY);
+	ssize_t got;
+
+	if (fd == -1){
+		return -1;
+	}
+	got = read(fd, buf, size - 1);
+	close(fd);
+	buf[got > 0 ? got : 0] = '\0';
+	return got;
+}
+
+
+
+
+/*******************************************************************************
+ * cgroupError
+ * says which cgroup file couldn't be changed, and why (errno).
+ *
+ * ****************************************************************************/
+void cgroupError(const char* dir, const char* file){
+	printf("limit: %s%s%s%s%s: %s\n", cgroups.path, dir ? "/" : "", 
+			dir ? dir : "", file ? "/" : "", file ? file : "", 
+			strerror(errno));
+}
+
+
+
+
+/*******************************************************************************
+ * findCgroup
+ * finds the cgroup v2 directory the shell runs in, from where cgroup2 is 
+ * mounted and the shell's entry in /proc/self/cgroup, and opens it. It has
+ * to be ours to change: delegated to us, or we're root. Returns false after
+ * saying why if there isn't one.
+ *
+ * ****************************************************************************/
+bool findCgroup(void){
+	FILE* file;              // mountinfo, then the shell's cgroups
+	char* line = NULL;       // a line of it
+	size_t size = 0;         // size of line
+	char* root = NULL;       // cgroup the mount shows, normally /
+	char* mount = NULL;      // where cgroup2 is mounted
+	char* group = NULL;      // the shell's cgroup
+	size_t len;
+	int fd = -1;
+
+	file = fopen("/proc/self/mountinfo", "re");
+	while (file && mount == NULL && getline(&line, &size, file) != -1){
+		if (strstr(line, " - cgroup2 ") && sscanf(line, 
+				"%*s %*s %*s %ms %ms", &root, &mount) != 2){
+			free(root);
+			root = NULL;
+		}
+	}
+	if (file){
+		fclose(file);
+	}
+	file = fopen("/proc/self/cgroup", "re");
+	while (file && group == NULL && getline(&line, &size, file) != -1){
+		if (strncmp(line, "0::", 3) == 0){
+			line[strcspn(line, "\n")] = '\0';
+			group = line + 3;
+		}
+	}
+	if (file){
+		fclose(file);
+	}
+
+	// the shell's cgroup is under the mount's root
+	len = root && strcmp(root, "/") != 0 ? strlen(root) : 0;
+	if (mount && group && strncmp(group, root, len) == 0){
+		cgroups.path = malloc(strlen(mount) + strlen(group) + 1);
+		if (cgroups.path == NULL){
+			perror("malloc - cgroup");
+			exit(1);
+		}
+		sprintf(cgroups.path, "%s%s", mount, 
+				strcmp(group + len, "/") == 0 ? "" : group + len);
+		fd = open(cgroups.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+	if (fd == -1){
+		printf("limit: can't find the shell's cgroup v2 directory\n");
+		free(cgroups.path);
+		cgroups.path = NULL;
+	}
+	else if (faccessat(fd, "cgroup.procs", W_OK, 0) == -1){
+		printf("limit: cgroup %s isn't delegated to us\n", 
+				cgroups.path);
+		close(fd);
+		fd = -1;
+		free(cgroups.path);
+		cgroups.path = NULL;
+	}
+	cgroups.dirFd = fd;
+	free(line);
+	free(root);
+	free(mount);
+	return fd != -1;
+}
+
+
+
+
+/*******************************************************************************
+ * enableController
+ * makes the controller called name available to the jobs' cgroups, if it 
+ * isn't already. A cgroup other than the root can't both hold processes 
+ * and hand controllers down, so if the shell is in the way it moves itself
+ * to a cgroup of its own and tries again. Returns false after saying why 
+ * if it can't be done.
+ *
+ * ****************************************************************************/
+bool enableController(const char* name, int flag){
+	char buf[512];           // the controllers the shell's cgroup has
+	char text[32];           // what's written to enable name
+	char leaf[32];           // the shell's own cgroup, if it needs one
+	char* word;
+	bool ok;
+
+	if (cgroups.enabled & flag){
+		return true;
+	}
+	readCgroup(NULL, "cgroup.controllers", buf, sizeof(buf));
+	for (word = strtok(buf, " \n"); word; word = strtok(NULL, " \n")){
+		if (strcmp(word, name) == 0){
+			break;
+		}
+	}
+	if (word == NULL){
+		printf("limit: cgroup %s has no %s controller\n", cgroups.path,
+				name);
+		return false;
+	}
+	snprintf(text, sizeof(text), "+%s", name);
+	ok = writeCgroup(NULL, "cgroup.subtree_control", text);
+	if (!ok && errno == EBUSY){
+		snprintf(leaf, sizeof(leaf), "smallsh-%d", (int)getpid());
+		snprintf(buf, sizeof(buf), "%d", (int)getpid());
+		if ((mkdirat(cgroups.dirFd, leaf, 0755) == 0 || 
+				errno == EEXIST) && 
+				writeCgroup(leaf, "cgroup.procs", buf)){
+			ok = writeCgroup(NULL, "cgroup.subtree_control", text);
+		}
+		else {
+			errno = EBUSY;
+		}
+	}
+	if (!ok){
+		cgroupError(NULL, "cgroup.subtree_control");
+		return false;
+	}
+	cgroups.enabled |= flag;
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * setupCgroups
+ * gets the cgroup tree ready for jobs with the cgroup limits in set, the 
+ * first time they are needed. Returns false after saying why if it can't.
+ *
+ * ****************************************************************************/
+bool setupCgroups(int set){
+	if (cgroups.dirFd == -1 && !findCgroup()){
+		return false;
+	}
+	return (!(set & LIMIT_MEMORY) || enableController("memory", 
+				LIMIT_MEMORY)) &&
+		(!(set & LIMIT_WEIGHT) || enableController("cpu", 
+				LIMIT_WEIGHT));
+}
+
+
+
+
+/*******************************************************************************
+ * jobCgroup
+ * makes a cgroup of its own for a job whose limits need one (-m, -w or -g), 
+ * with its memory.max and cpu.weight, and returns its name under 
+ * cgroups.dirFd for the job's processes to join. Returns NULL if it doesn't
+ * need one, or after saying why it can't have one, and then the job runs 
+ * without it.
+ *
+ * ****************************************************************************/
+char* jobCgroup(struct limits* limits){
+	char name[64];           // the job's cgroup
+	char value[32];          // a limit, as written to the cgroup
+	bool ok = true;
+
+	if (!(limits->set & LIMIT_CGROUPS) || !setupCgroups(limits->set)){
+		return NULL;
+	}
+	snprintf(name, sizeof(name), "smallsh-%d-%d", (int)getpid(), 
+			++cgroups.next);
+	if (mkdirat(cgroups.dirFd, name, 0755) == -1){
+		cgroupError(name, NULL);
+		return NULL;
+	}
+	if (limits->set & LIMIT_MEMORY){
+		snprintf(value, sizeof(value), "%lld", limits->memory);
+		if (!(ok = writeCgroup(name, "memory.max", value))){
+			cgroupError(name, "memory.max");
+		}
+	}
+	if (ok && (limits->set & LIMIT_WEIGHT)){
+		snprintf(value, sizeof(value), "%d", limits->weight);
+		if (!(ok = writeCgroup(name, "cpu.weight", value))){
+			cgroupError(name, "cpu.weight");
+		}
+	}
+	if (!ok){
+		unlinkat(cgroups.dirFd, name, AT_REMOVEDIR);
+		return NULL;
+	}
+	return strdup(name);
+}
+
+
+
+
+/*******************************************************************************
+ * printCgroupUsage
+ * prints the cpu time and memory a job's cgroup has used so far. cpu.stat 
+ * is always there, memory.current only with the memory controller.
+ *
+ * ****************************************************************************/
+void printCgroupUsage(const char* cgroup){
+	char buf[1024];          // a cgroup file
+	char* usage;             // cpu.stat's usage_usec
+
+	if (readCgroup(cgroup, "cpu.stat", buf, sizeof(buf)) > 0 &&
+			(usage = strstr(buf, "usage_usec ")) != NULL){
+		printf("  cpu %.2fs", atoll(usage + 11) / 1e6);
+	}
+	if (readCgroup(cgroup, "memory.current", buf, sizeof(buf)) > 0){
+		printf("  mem %.1fM", atoll(buf) / 1048576.0);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * setResource
+ * sets the soft and hard rlimits of resource, in a forked child. Says what 
+ * failed and returns false if it can't.
+ *
+ * ****************************************************************************/
+bool setResource(int resource, rlim_t soft, rlim_t hard, const char* what){
+	struct rlimit limit = {soft, hard};
+	if (setrlimit(resource, &limit) == -1){
+		perror(what);
+		return false;
+	}
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * applyLimits
+ * used by forked children to join the job's cgroup, if it has one, and put
+ * themselves under its limits before they exec. They are inherited by 
+ * anything the child starts. Says what failed and returns false if one 
+ * can't be applied.
+ *
+ * ****************************************************************************/
+bool applyLimits(struct limits* limits, char* cgroup){
+	int set = limits->set;
+
+	if (cgroup && !writeCgroup(cgroup, "cgroup.procs", "0")){
+		perror("limit - cgroup");
+		return false;
+	}
+	// a second past the cpu time SIGXCPU becomes SIGKILL
+	if (((set & LIMIT_CPU) && 
+			!setResource(RLIMIT_CPU, limits->cpuTime, 
+				limits->cpuTime + 1, "limit - cpu time")) ||
+			((set & LIMIT_AS) && 
+			 !setResource(RLIMIT_AS, limits->addressSpace,
+				 limits->addressSpace, "limit - address space")) ||
+			((set & LIMIT_FILES) && 
+			 !setResource(RLIMIT_NOFILE, limits->openFiles,
+				 limits->openFiles, "limit - open files"))){
+		return false;
+	}
+	errno = 0;
+	if ((set & LIMIT_NICE) && nice(limits->nice) == -1 && errno != 0){
+		perror("limit - nice");
+		return false;
+	}
+	if ((set & LIMIT_IO) && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+			limits->ioClass << IOPRIO_CLASS_SHIFT | 
+			limits->ioLevel) == -1){
+		perror("limit - io class");
+		return false;
+	}
+	if ((set & LIMIT_CPUS) && sched_setaffinity(0, sizeof(cpu_set_t), 
+			&limits->cpus) == -1){
+		perror("limit - cpus");
+		return false;
+	}
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * spawnAndExec
+ * launches the command with posix_spawn instead of fork. glibc implements 
+ * posix_spawn with clone(CLONE_VM | CLONE_VFORK) so the parent's page tables
+ * are never copied, which keeps launches cheap no matter how large the shell
+ * grows. The work checkReDirect does in a forked child is expressed here as 
+ * spawn file actions, and the signal resets and process group as spawn 
+ * attributes. A foreground job under job control takes the terminal with a
+ * file action too, where glibc has one.
+ *
+ * The command is exec'd from the path findCommand already resolved, so the
+ * child doesn't search PATH, with the environment forkAndExec picked.
+ *
+ * Returns 0 and sets spawnPid on success, otherwise the error number from 
+ * posix_spawn (a failed open or exec is reported here as well).
+ *
+ * ****************************************************************************/
+int spawnAndExec(struct stage* stage, bool runBG, pid_t pgid, 
+		pid_t* spawnPid){
+	posix_spawn_file_actions_t actions;   // re-directs done in the child
+	posix_spawnattr_t attr;               // signal setup for the child
+	sigset_t defaults;                    // signals reset to SIG_DFL
+	// the signals the shell reads from its signalfd are blocked, the
+	// child starts with the mask the shell started with
+	short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+	int ret;                              // result of posix_spawn
+	struct redirect* redirect;            // one of the stage's re-directs
+	int i;
+
+	// the fork path reports commands that weren't found
+	if (stage->path == NULL){
+		return ENOENT;
+	}
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+	// a foreground job takes the terminal before anything else, while 
+	// stdin is still the terminal. Otherwise runPipeline hands it over
+	if (!runBG && jobControl && pgid != -1){
+		posix_spawn_file_actions_addtcsetpgrp_np(&actions, 0);
+	}
+#endif
+	// hook up to the rest of the pipeline first so re-directs win
+	if (stage->pipeIn != -1){
+		posix_spawn_file_actions_adddup2(&actions, stage->pipeIn, 0);
+	}
+	if (stage->pipeOut != -1){
+		posix_spawn_file_actions_adddup2(&actions, stage->pipeOut, 1);
+	}
+
+	// bg processes use /dev/null, then the user's re-directs go on top
+	if (stage->nullIn){
+		posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", 
+				O_RDONLY, 0);
+	}
+	if (stage->nullOut){
+		posix_spawn_file_actions_addopen(&actions, 1, "/dev/null",
+				O_WRONLY, 0);
+	}
+	for (i = 0; i < stage->redirectCount; i++){
+		redirect = &stage->redirects[i];
+		if (redirect->type == REDIR_OPEN){
+			posix_spawn_file_actions_addopen(&actions, redirect->fd,
+					redirect->path, redirect->flags, 0644);
+			continue;
+		}
+		// a here-string is made here and handed over like a dup,
+		// spawn's dup2 clears its close on exec flag
+		if (redirect->type == REDIR_STRING){
+			redirect->dupFd = hereString(redirect->path);
+		}
+		posix_spawn_file_actions_adddup2(&actions, redirect->dupFd, 
+				redirect->fd);
+	}
+
+	// the shell ignores the job control signals, its children don't.
+	// foreground procces accept SIGINT again, bg ones keep ignoring it
+	// unless they have a process group the terminal's ^C can't reach
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGTSTP);
+	sigaddset(&defaults, SIGTTIN);
+	sigaddset(&defaults, SIGTTOU);
+	if (!runBG || jobControl){
+		sigaddset(&defaults, SIGINT);
+	}
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setsigmask(&attr, &childMask);
+	if (pgid != -1){
+		flags |= POSIX_SPAWN_SETPGROUP;
+		posix_spawnattr_setpgroup(&attr, pgid);
+	}
+#ifdef POSIX_SPAWN_USEVFORK
+	// older glibc only uses vfork when asked to
+	flags |= POSIX_SPAWN_USEVFORK;
+#endif
+	posix_spawnattr_setflags(&attr, flags);
+
+	ret = posix_spawn(spawnPid, stage->path, &actions, &attr, 
+			stage->argv, stage->envp);
+
+	// cleanup
+	for (i = 0; i < stage->redirectCount; i++){
+		if (stage->redirects[i].type == REDIR_STRING &&
+				stage->redirects[i].dupFd != -1){
+			close(stage->redirects[i].dupFd);
+		}
+	}
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	return ret;
+}
+
+
+
+
+/*******************************************************************************
+ * jobHash
+ * returns the home slot of a pid in the job table. Fibonacci hashing spreads
+ * the mostly sequential pids the kernel hands out across the whole table.
+ *
+ * ****************************************************************************/
+unsigned int jobHash(struct jobTable* jobs, pid_t pid){
+	return ((uint32_t)pid * 2654435761u) >> jobs->shift;
+}
+
+
+
+
+/*******************************************************************************
+ * initJobs
+ * sets up an empty job table with room for JOBSLOTS pids.
+ *
+ * ****************************************************************************/
+void initJobs(struct jobTable* jobs){
+	jobs->capacity = JOBSLOTS;
+	jobs->shift = 32 - __builtin_ctz(JOBSLOTS);
+	jobs->count = 0;
+	jobs->head = NULL;
+	jobs->tail = NULL;
+	jobs->lastPid = 0;
+	jobs->parallelRunning = 0;
+	jobs->parallelStop = false;
+	jobs->parallelFailed = false;
+	jobs->slots = calloc(jobs->capacity, sizeof(struct jobSlot));
+	if (jobs->slots == NULL){
+		perror("calloc - job table");
+		exit(1);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * insertSlot
+ * puts a pid and its job in the first free slot at or after the pid's home
+ * slot. The caller makes sure the table has room.
+ *
+ * ****************************************************************************/
+void insertSlot(struct jobTable* jobs, pid_t pid, struct job* job){
+	unsigned int mask = jobs->capacity - 1;   // wraps slot index
+	unsigned int i = jobHash(jobs, pid);      // slot we're probing
+
+	// linear probe to the first empty slot
+	while (jobs->slots[i].pid != 0){
+		i = (i + 1) & mask;
+	}
+	jobs->slots[i].pid = pid;
+	jobs->slots[i].job = job;
+}
+
+
+
+
+/*******************************************************************************
+ * growJobs
+ * doubles the size of the job table and re-inserts every pid. Called when 
+ * the table would become more than half full so probes stay short.
+ *
+ * ****************************************************************************/
+void growJobs(struct jobTable* jobs){
+	struct jobSlot* old = jobs->slots;   // slots being replaced
+	int oldCapacity = jobs->capacity;    // how many of them
+	int i;
+
+	jobs->capacity *= 2;
+	jobs->shift--;
+	jobs->slots = calloc(jobs->capacity, sizeof(struct jobSlot));
+	if (jobs->slots == NULL){
+		perror("calloc - job table");
+		exit(1);
+	}
+	for (i = 0; i < oldCapacity; i++){
+		if (old[i].pid != 0){
+			insertSlot(jobs, old[i].pid, old[i].job);
+		}
+	}
+	free(old);
+}
+
+
+
+
+/*******************************************************************************
+ * addJob
+ * As jobs are created they are added to the job table along with the command
+ * line that started them and their start time. Every process of the job gets
+ * a slot pointing at the job. The new job is also appended to the table's 
+ * list of jobs, which keeps launch order, and numbered one past the newest.
+ *
+ * ****************************************************************************/
+struct job* addJob(struct jobTable* jobs, pid_t* pids, int procCount, 
+		pid_t pgid, char* cmdLine){
+	int i;
+	struct job* job = calloc(1, sizeof(struct job));
+	if (job == NULL){
+		perror("calloc - job");
+		exit(1);
+	}
+	job->pids = calloc(procCount, sizeof(pid_t));
+	if (job->pids == NULL){
+		perror("calloc - job pids");
+		exit(1);
+	}
+	memcpy(job->pids, pids, procCount * sizeof(pid_t));
+	job->procCount = procCount;
+	job->running = procCount;
+	job->pid = pids[procCount - 1];
+	job->pgid = pgid;
+	job->cmdLine = strdup(cmdLine);
+	job->state = JOB_RUNNING;
+	job->id = jobs->tail ? jobs->tail->id + 1 : 1;
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+	// append to the launch ordered list
+	job->prev = jobs->tail;
+	if (jobs->tail){
+		jobs->tail->next = job;
+	}
+	else {
+		jobs->head = job;
+	}
+	jobs->tail = job;
+
+	for (i = 0; i < procCount; i++){
+		// keep the table at most half full
+		if ((jobs->count + 1) * 2 > jobs->capacity){
+			growJobs(jobs);
+		}
+		insertSlot(jobs, pids[i], job);
+		jobs->count++;
+	}
+	return job;
+}
+
+
+
+
+/*******************************************************************************
+ * findJob
+ * looks up the job a pid belongs to. Returns NULL if we aren't tracking it.
+ *
+ * ****************************************************************************/
+struct job* findJob(struct jobTable* jobs, pid_t pid){
+	unsigned int mask = jobs->capacity - 1;   // wraps slot index
+	unsigned int i = jobHash(jobs, pid);      // slot we're probing
+
+	// probe until we find the pid or hit an empty slot
+	while (jobs->slots[i].pid != 0){
+		if (jobs->slots[i].pid == pid){
+			return jobs->slots[i].job;
+		}
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+
+
+
+/*******************************************************************************
+ * removePid
+ * searches for (and should find) PID of a recently finished background process.
+ * When found the pid is removed from the table without leaving a tombstone: 
+ * later entries of the probe run are shifted back into the hole. The job's
+ * count of running processes is decremented. Returns 1 if the pid was 
+ * tracked, otherwise 0.
+ *
+ * ****************************************************************************/
+int removePid(struct jobTable* jobs, pid_t pid){
+	unsigned int mask = jobs->capacity - 1;   // wraps slot index
+	unsigned int i = jobHash(jobs, pid);      // slot we're probing
+	unsigned int j;                           // slot after the hole
+	unsigned int home;                        // home slot of entry at j
+
+	// find the pid
+	while (jobs->slots[i].pid != pid){
+		if (jobs->slots[i].pid == 0){
+			return 0;
+		}
+		i = (i + 1) & mask;
+	}
+	jobs->slots[i].job->running--;
+
+	// backward shift: move entries that probed past the hole back into it
+	j = i;
+	while (1){
+		j = (j + 1) & mask;
+		if (jobs->slots[j].pid == 0){
+			break;
+		}
+		home = jobHash(jobs, jobs->slots[j].pid);
+		// entry can move if the hole is between its home slot and j
+		if (((j - home) & mask) >= ((j - i) & mask)){
+			jobs->slots[i] = jobs->slots[j];
+			i = j;
+		}
+	}
+	jobs->slots[i].pid = 0;
+	jobs->slots[i].job = NULL;
+	jobs->count--;
+	return 1;
+}
+
+
+
+
+/*******************************************************************************
+ * removeJob
+ * unlinks a job from the job list and frees it, and removes its cgroup. Any
+ * of its pids still in the table are removed first, and any '|>' links left
+ * are closed.
+ *
+ * ****************************************************************************/
+void removeJob(struct jobTable* jobs, struct job* job){
+	int i;
+	for (i = 0; i < job->procCount && job->running > 0; i++){
+		if (findJob(jobs, job->pids[i]) == job){
+			removePid(jobs, job->pids[i]);
+		}
+	}
+	if (job->prev){
+		job->prev->next = job->next;
+	}
+	else {
+		jobs->head = job->next;
+	}
+	if (job->next){
+		job->next->prev = job->prev;
+	}
+	else {
+		jobs->tail = job->prev;
+	}
+	// fails if something the job started is still running in it
+	if (job->cgroup){
+		unlinkat(cgroups.dirFd, job->cgroup, AT_REMOVEDIR);
+		free(job->cgroup);
+	}
+	for (i = 0; i < job->relayCount; i++){
+		if (job->relays[i].from != -1){
+			close(job->relays[i].from);
+			close(job->relays[i].to);
+		}
+	}
+	free(job->relays);
+	free(job->pids);
+	free(job->cmdLine);
+	free(job);
+}
+
+
+
+
+/*******************************************************************************
+ * addUsage
+ * adds the resource usage of one reaped process to the total for its job. 
+ * Times and context switches add up, max RSS is the biggest of any process.
+ *
+ * ****************************************************************************/
+void addUsage(struct rusage* total, struct rusage* usage){
+	timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+	timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+	if (usage->ru_maxrss > total->ru_maxrss){
+		total->ru_maxrss = usage->ru_maxrss;
+	}
+	total->ru_nvcsw += usage->ru_nvcsw;
+	total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+
+
+
+/*******************************************************************************
+ * fnvHash
+ * returns the FNV-1a hash of len bytes of name, used by the tables keyed on
+ * command names.
+ *
+ * ****************************************************************************/
+uint32_t fnvHash(const char* name, size_t len){
+	uint32_t hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < len; i++){
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+
+
+
+/*******************************************************************************
+ * statsSlot
+ * returns the slot of the stats table holding the command name (len bytes 
+ * long), or the empty slot where it belongs. The table is open addressed 
+ * like the job table and keyed by an FNV-1a hash of the name.
+ *
+ * ****************************************************************************/
+struct cmdStats* statsSlot(const char* name, size_t len){
+	unsigned int mask = stats.capacity - 1;      // wraps slot index
+	unsigned int i;                              // slot we're probing
+
+	i = fnvHash(name, len) & mask;
+	while (stats.slots[i].name){
+		if (strncmp(stats.slots[i].name, name, len) == 0 &&
+				stats.slots[i].name[len] == '\0'){
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return &stats.slots[i];
+}
+
+
+
+
+/*******************************************************************************
+ * findStats
+ * returns the stats for the command name (len bytes long), adding an empty
+ * entry the first time a command is seen.
+ *
+ * ****************************************************************************/
+struct cmdStats* findStats(const char* name, size_t len){
+	struct cmdStats* entry;             // slot for name
+	struct cmdStats* old;               // slots when growing
+	int oldCapacity;
+	int i;
+
+	// keep the table at most half full, rehash into twice the slots
+	if ((stats.count + 1) * 2 > stats.capacity){
+		old = stats.slots;
+		oldCapacity = stats.capacity;
+		stats.capacity = oldCapacity ? oldCapacity * 2 : STATSLOTS;
+		stats.slots = calloc(stats.capacity, sizeof(struct cmdStats));
+		if (stats.slots == NULL){
+			perror("calloc - stats");
+			exit(1);
+		}
+		for (i = 0; i < oldCapacity; i++){
+			if (old[i].name){
+				*statsSlot(old[i].name, strlen(old[i].name)) = 
+					old[i];
+			}
+		}
+		free(old);
+	}
+
+	entry = statsSlot(name, len);
+	if (entry->name == NULL){
+		entry->name = strndup(name, len);
+		stats.count++;
+	}
+	return entry;
+}
+
+
+
+
+/*******************************************************************************
+ * addStats
+ * adds one finished command to a command's stats.
+ *
+ * ****************************************************************************/
+void addStats(struct cmdStats* entry, long wallUsec, struct rusage* usage){
+	int bucket = 0;     // histogram bucket, floor(log2(wallUsec))
+
+	entry->count++;
+	entry->wall += wallUsec / 1e6;
+	entry->user += usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+	entry->sys += usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+	if (usage->ru_maxrss > entry->maxRss){
+		entry->maxRss = usage->ru_maxrss;
+	}
+	entry->ctxSwitches += usage->ru_nvcsw + usage->ru_nivcsw;
+	while (wallUsec > 1 && bucket < STATBUCKETS - 1){
+		wallUsec >>= 1;
+		bucket++;
+	}
+	entry->hist[bucket]++;
+}
+
+
+
+
+/*******************************************************************************
+ * recordCommand
+ * accounts for a command that has finished: how long it ran since start, 
+ * how it exited and the resources its processes used. The command's stats 
+ * are kept under the first word of its command line. If SMALLSH_TRACE named 
+ * a file one JSON record per command is also appended to it.
+ *
+ * ****************************************************************************/
+void recordCommand(char* cmdLine, pid_t pid, bool background, int status,
+		struct timespec* start, struct rusage* usage){
+	struct timespec end;     // when we reaped it
+	long wallUsec;           // how long it ran
+	char* name;              // first word of the command line
+	size_t nameLen;
+	char record[TRACEMAX];   // trace record being built
+	int len;                 // length of record
+	char* c;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wallUsec = (end.tv_sec - start->tv_sec) * 1000000L + 
+		(end.tv_nsec - start->tv_nsec) / 1000;
+
+	name = cmdLine + strspn(cmdLine, " \t");
+	nameLen = strcspn(name, " \t");
+	addStats(findStats(name, nameLen), wallUsec, usage);
+	addStats(&stats.total, wallUsec, usage);
+
+	if (traceFd == -1){
+		return;
+	}
+	// one line of JSON, written with a single append so records from 
+	// several shells sharing a file don't interleave
+	len = snprintf(record, sizeof(record), "{\"time\":%ld,\"pid\":%d,"
+			"\"background\":%s,\"status\":%d,\"wall_us\":%ld,"
+			"\"user_us\":%ld,\"sys_us\":%ld,\"maxrss_kb\":%ld,"
+			"\"nvcsw\":%ld,\"nivcsw\":%ld,\"cmd\":\"",
+			(long)time(NULL), (int)pid, background ? "true" : "false",
+			statusValue(status), wallUsec,
+			usage->ru_utime.tv_sec * 1000000L + usage->ru_utime.tv_usec,
+			usage->ru_stime.tv_sec * 1000000L + usage->ru_stime.tv_usec,
+			usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+	// escape the command line, cutting it short if it doesn't fit
+	for (c = cmdLine; *c && len < TRACEMAX - 8; c++){
+		if (*c == '"' || *c == '\\'){
+			record[len++] = '\\';
+			record[len++] = *c;
+		}
+		else if ((unsigned char)*c < 0x20){
+			len += snprintf(record + len, 7, "\\u%04x", *c);
+		}
+		else {
+			record[len++] = *c;
+		}
+	}
+	record[len++] = '"';
+	record[len++] = '}';
+	record[len++] = '\n';
+	// a trace that can't be written, say the disk is full, is given up
+	// on rather than failing on every command
+	if (write(traceFd, record, len) != len){
+		perror("SMALLSH_TRACE");
+		close(traceFd);
+		traceFd = -1;
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * printHistogram
+ * prints the wall time histogram of a command's stats, one line per bucket
+ * from the fastest to the slowest bucket used.
+ *
+ * ****************************************************************************/
+void printHistogram(struct cmdStats* entry){
+	int first = 0;                 // first bucket used
+	int last = STATBUCKETS - 1;    // last bucket used
+	int i, j;
+	long most = 1;                 // fullest bucket, for scaling the bars
+
+	while (first < STATBUCKETS && entry->hist[first] == 0){
+		first++;
+	}
+	while (last > first && entry->hist[last] == 0){
+		last--;
+	}
+	for (i = first; i <= last; i++){
+		if (entry->hist[i] > most){
+			most = entry->hist[i];
+		}
+	}
+	for (i = first; i <= last; i++){
+		// bucket i holds wall times from 2^i up to 2^(i+1) usec
+		printf("  %10.3f ms  %8ld ", (1L << i) / 1000.0, 
+				entry->hist[i]);
+		for (j = 0; j < entry->hist[i] * 40 / most; j++){
+			putchar('#');
+		}
+		putchar('\n');
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * showStats
+ * the stats builtin:  stats [-r] [command]
+ * prints, for each command that has finished, how often it ran, its average 
+ * wall, user and system time, its largest max RSS and average context 
+ * switches, followed by the wall time histogram of all commands together. 
+ * Given a command name, prints that command's line and histogram. -r clears
+ * all the stats.
+ *
+ * ****************************************************************************/
+int showStats(struct shell* sh, char** userCmds, int cmdCount){
+	int i;
+	struct cmdStats* entry;
+
+	// stats -r
+	if (cmdCount > 1 && strcmp(userCmds[1], "-r") == 0){
+		for (i = 0; i < stats.capacity; i++){
+			free(stats.slots[i].name);
+		}
+		free(stats.slots);
+		memset(&stats, 0, sizeof(stats));
+		return 0;
+	}
+
+	printf("%-16s %8s %10s %10s %10s %11s %8s\n", "command", "count", 
+			"avg wall", "avg user", "avg sys", "maxrss KB", 
+			"avg ctxsw");
+	for (i = 0; i < stats.capacity; i++){
+		entry = &stats.slots[i];
+		if (entry->name == NULL || (cmdCount > 1 && 
+				strcmp(entry->name, userCmds[1]) != 0)){
+			continue;
+		}
+		printf("%-16s %8ld %9.3fs %9.3fs %9.3fs %11ld %8ld\n", 
+				entry->name, entry->count, 
+				entry->wall / entry->count, 
+				entry->user / entry->count, 
+				entry->sys / entry->count, entry->maxRss, 
+				entry->ctxSwitches / entry->count);
+		if (cmdCount > 1){
+			printf("wall time histogram:\n");
+			printHistogram(entry);
+		}
+	}
+	if (cmdCount == 1 && stats.total.count > 0){
+		printf("%-16s %8ld %9.3fs %9.3fs %9.3fs %11ld %8ld\n", 
+				"(all)", stats.total.count,
+				stats.total.wall / stats.total.count, 
+				stats.total.user / stats.total.count, 
+				stats.total.sys / stats.total.count, 
+				stats.total.maxRss, 
+				stats.total.ctxSwitches / stats.total.count);
+		printf("wall time histogram:\n");
+		printHistogram(&stats.total);
+	}
+	flushOutput();
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * tickRate
+ * returns how many readTicks ticks there are in a microsecond, measured 
+ * against the clock since the shell started. Waits until 10ms have gone by,
+ * if they haven't yet, so the rate is close enough.
+ *
+ * ****************************************************************************/
+double tickRate(void){
+	struct timespec now;
+	double usec;          // since the shell started
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		usec = (now.tv_sec - startTime.tv_sec) * 1e6 + 
+			(now.tv_nsec - startTime.tv_nsec) / 1e3;
+	} while (usec < 10000);
+	return (readTicks() - startTicks) / usec;
+}
+
+
+
+
+/*******************************************************************************
+ * showPerf
+ * the perf builtin:  perf [-r]
+ * prints how many times each hot path has run in the shell (tokenizing a 
+ * line, expanding its words, finding its re-directs, launching a process and
+ * reaping children) with the total, average and longest time spent in it.
+ * Only the shell's side of a launch counts, up to the child existing. -r 
+ * clears the timers. The same paths fire the USDT probes phase__start and
+ * phase__end for tools that attach to the shell instead.
+ *
+ * ****************************************************************************/
+int showPerf(struct shell* sh, char** userCmds, int cmdCount){
+	double rate;          // ticks per usec
+	int i;
+
+	// perf -r
+	if (cmdCount > 1 && strcmp(userCmds[1], "-r") == 0){
+		for (i = 0; i < PHASES; i++){
+			phases[i].count = 0;
+			phases[i].ticks = 0;
+			phases[i].max = 0;
+		}
+		return 0;
+	}
+
+	rate = tickRate();
+	printf("%-10s %10s %12s %10s %10s\n", "phase", "count", "total ms", 
+			"avg us", "max us");
+	for (i = 0; i < PHASES; i++){
+		printf("%-10s %10ld %12.3f %10.2f %10.2f\n", phases[i].name, 
+				phases[i].count, phases[i].ticks / rate / 1000,
+				phases[i].count ? 
+				phases[i].ticks / rate / phases[i].count : 0.0,
+				phases[i].max / rate);
+	}
+	flushOutput();
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * pathSlot
+ * returns the slot of the path cache holding the command name, or the empty
+ * slot where it belongs. Same open addressing and hash as the stats table.
+ *
+ * ****************************************************************************/
+struct pathEntry* pathSlot(const char* name){
+	unsigned int mask = paths.capacity - 1;      // wraps slot index
+	unsigned int i;                              // slot we're probing
+
+	i = fnvHash(name, strlen(name)) & mask;
+	while (paths.slots[i].name){
+		if (strcmp(paths.slots[i].name, name) == 0){
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return &paths.slots[i];
+}
+
+
+
+
+/*******************************************************************************
+ * clearPaths
+ * empties the path cache, like hash -r. Also done whenever PATH changes.
+ *
+ * ****************************************************************************/
+void clearPaths(void){
+	int i;
+	for (i = 0; i < paths.capacity; i++){
+		free(paths.slots[i].name);
+		free(paths.slots[i].path);
+	}
+	free(paths.slots);
+	free(paths.pathVar);
+	memset(&paths, 0, sizeof(paths));
+}
+
+
+
+
+/*******************************************************************************
+ * searchPath
+ * walks the directories of pathVar looking for an executable regular file 
+ * called name, the same search execvp does. The result is built in buf 
+ * (size bytes). Returns the length of the result, 0 if name wasn't found, or
+ * -1 if it was found in a relative directory (the answer then depends on the 
+ * current directory and mustn't be cached).
+ *
+ * ****************************************************************************/
+int searchPath(const char* name, const char* pathVar, char* buf, size_t size){
+	const char* dir = pathVar;     // start of the current directory
+	const char* end;               // and its end
+	size_t dirLen;
+	size_t nameLen = strlen(name);
+	struct stat info;              // what's at dir/name
+
+	while (1){
+		end = strchrnul(dir, ':');
+		dirLen = end - dir;
+		// an empty entry means the current directory
+		if (dirLen == 0){
+			dir = ".";
+			dirLen = 1;
+		}
+		if (dirLen + nameLen + 2 <= size){
+			memcpy(buf, dir, dirLen);
+			buf[dirLen] = '/';
+			memcpy(buf + dirLen + 1, name, nameLen + 1);
+			if (stat(buf, &info) == 0 && S_ISREG(info.st_mode) &&
+					access(buf, X_OK) == 0){
+				return buf[0] == '/' ? 
+					(int)(dirLen + nameLen + 1) : -1;
+			}
+		}
+		if (*end == '\0'){
+			return 0;
+		}
+		dir = end + 1;
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * findCommand
+ * resolves a command name to the file to exec, so children don't have to try
+ * every directory of PATH themselves. Answers are cached in the path cache, 
+ * which is emptied if PATH has changed since the last lookup. Names with a 
+ * '/' are used as they are. Returns NULL when the command can't be found, 
+ * otherwise a path that stays good until the cache is next changed (an 
+ * uncached answer is copied into the arena).
+ *
+ * ****************************************************************************/
+char* findCommand(char* name, struct arena* arena){
+	char* pathVar = getVar("PATH");    // where to look
+	struct pathEntry* entry;            // name's slot in the cache
+	struct pathEntry* old;              // slots when growing
+	int oldCapacity;
+	char buf[4096];                     // candidate paths
+	int len;                            // of the answer
+	int i;
+
+	if (strchr(name, '/')){
+		return name;
+	}
+	// no PATH gets execvp's default
+	if (pathVar == NULL){
+		pathVar = "/bin:/usr/bin";
+	}
+	// a different PATH makes every answer suspect
+	if (paths.pathVar && strcmp(paths.pathVar, pathVar) != 0){
+		clearPaths();
+	}
+	if (paths.pathVar == NULL){
+		paths.pathVar = strdup(pathVar);
+	}
+
+	// keep the table at most half full, rehash into twice the slots
+	if ((paths.count + 1) * 2 > paths.capacity){
+		old = paths.slots;
+		oldCapacity = paths.capacity;
+		paths.capacity = oldCapacity ? oldCapacity * 2 : PATHSLOTS;
+		paths.slots = calloc(paths.capacity, sizeof(struct pathEntry));
+		if (paths.slots == NULL){
+			perror("calloc - path cache");
+			exit(1);
+		}
+		for (i = 0; i < oldCapacity; i++){
+			if (old[i].name){
+				*pathSlot(old[i].name) = old[i];
+			}
+		}
+		free(old);
+	}
+
+	// a hit costs no system calls at all
+	entry = pathSlot(name);
+	if (entry->path){
+		entry->hits++;
+		return entry->path;
+	}
+
+	len = searchPath(name, pathVar, buf, sizeof(buf));
+	if (len == 0){
+		return NULL;
+	}
+	if (len == -1){
+		return arenaCopy(arena, buf, strlen(buf));
+	}
+	// a forgotten entry keeps its slot and is simply filled in again
+	if (entry->name == NULL){
+		entry->name = strdup(name);
+		paths.count++;
+	}
+	entry->path = strndup(buf, len);
+	entry->hits = 1;
+	return entry->path;
+}
+
+
+
+
+/*******************************************************************************
+ * forgetPath
+ * drops the cached path of a command, used when exec'ing it failed with 
+ * ENOENT because the file has gone. The next lookup searches PATH again.
+ *
+ * ****************************************************************************/
+void forgetPath(const char* name){
+	struct pathEntry* entry;
+
+	if (paths.capacity == 0){
+		return;
+	}
+	entry = pathSlot(name);
+	free(entry->path);
+	entry->path = NULL;
+}
+
+
+
+
+/*******************************************************************************
+ * hashCommands
+ * the hash builtin:  hash [-r] [command ...]
+ * with no arguments lists the cached commands and how often each was used.
+ * -r empties the cache, and naming commands looks them up and caches them.
+ * Returns 1 if a named command wasn't found.
+ *
+ * ****************************************************************************/
+int hashCommands(struct shell* sh, char** userCmds, int cmdCount){
+	int i;
+	int ret = 0;
+	bool listed = false;           // printed the header yet?
+
+	// hash -r
+	if (cmdCount > 1 && strcmp(userCmds[1], "-r") == 0){
+		clearPaths();
+		return 0;
+	}
+	// hash command ...
+	if (cmdCount > 1){
+		for (i = 1; i < cmdCount; i++){
+			if (findCommand(userCmds[i], &sh->arena) == NULL){
+				printf("hash: %s: not found\n", userCmds[i]);
+				ret = 1;
+			}
+		}
+		flushOutput();
+		return ret;
+	}
+
+	for (i = 0; i < paths.capacity; i++){
+		if (paths.slots[i].path == NULL){
+			continue;
+		}
+		if (!listed){
+			printf("hits\tcommand\n");
+			listed = true;
+		}
+		printf("%4ld\t%s\n", paths.slots[i].hits, paths.slots[i].path);
+	}
+	if (!listed){
+		printf("hash: hash table empty\n");
+	}
+	flushOutput();
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * nameLength
+ * returns how long the variable name at the start of s is, 0 if s doesn't
+ * start with one. A name is a letter or '_' followed by letters, digits and
+ * '_'s.
+ *
+ * ****************************************************************************/
+size_t nameLength(const char* s){
+	size_t len = 0;
+	if (isalpha((unsigned char)s[0]) || s[0] == '_'){
+		while (isalnum((unsigned char)s[len]) || s[len] == '_'){
+			len++;
+		}
+	}
+	return len;
+}
+
+
+
+
+/*******************************************************************************
+ * varSlot
+ * returns the slot of the variable table holding name (len bytes long), or 
+ * the empty slot where it belongs. Same open addressing and hash as the 
+ * stats table.
+ *
+ * ****************************************************************************/
+struct shellVar* varSlot(const char* name, size_t len){
+	unsigned int mask = vars.capacity - 1;       // wraps slot index
+	unsigned int i;                              // slot we're probing
+
+	i = fnvHash(name, len) & mask;
+	while (vars.slots[i].name){
+		if (vars.slots[i].nameLen == len && 
+				memcmp(vars.slots[i].name, name, len) == 0){
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return &vars.slots[i];
+}
+
+
+
+
+/*******************************************************************************
+ * findVar
+ * returns the variable name (len bytes long), or NULL if there isn't one. 
+ * With add an unset variable is added the first time a name is seen. 
+ *
+ * ****************************************************************************/
+struct shellVar* findVar(const char* name, size_t len, bool add){
+	struct shellVar* var;               // slot for name
+	struct shellVar* old;               // slots when growing
+	int oldCapacity;
+	int i;
+
+	if (vars.capacity == 0 && !add){
+		return NULL;
+	}
+	// keep the table at most half full, rehash into twice the slots
+	if (add && (vars.count + 1) * 2 > vars.capacity){
+		old = vars.slots;
+		oldCapacity = vars.capacity;
+		vars.capacity = oldCapacity ? oldCapacity * 2 : VARSLOTS;
+		vars.slots = calloc(vars.capacity, sizeof(struct shellVar));
+		if (vars.slots == NULL){
+			perror("calloc - variables");
+			exit(1);
+		}
+		for (i = 0; i < oldCapacity; i++){
+			if (old[i].name){
+				*varSlot(old[i].name, old[i].nameLen) = old[i];
+			}
+		}
+		free(old);
+	}
+
+	var = varSlot(name, len);
+	if (var->name == NULL){
+		if (!add){
+			return NULL;
+		}
+		var->name = strndup(name, len);
+		var->nameLen = len;
+		vars.count++;
+	}
+	return var;
+}
+
+
+
+
+/*******************************************************************************
+ * getVar
+ * returns the value of the variable name, or NULL if it isn't set. This is
+ * what the shell looks at instead of getenv, unexported variables count too.
+ *
+ * ****************************************************************************/
+char* getVar(const char* name){
+	struct shellVar* var = findVar(name, strlen(name), false);
+	return var && var->set ? var->entry + var->nameLen + 1 : NULL;
+}
+
+
+
+
+/*******************************************************************************
+ * exportedEnv
+ * returns the environment for commands: the entries of the set, exported 
+ * variables. It's only gathered again after a variable was exported or 
+ * unset, or an exported one outgrew its entry. Changing an exported value 
+ * in place needs nothing, the environment points at the entry itself. 
+ * environ is pointed at it too, so a forked child execs with it.
+ *
+ * ****************************************************************************/
+char** exportedEnv(void){
+	int i;
+
+	if (!vars.envDirty && vars.env){
+		return vars.env;
+	}
+	if (vars.envSize < vars.count + 1){
+		vars.envSize = vars.capacity / 2 + 1;
+		free(vars.env);
+		vars.env = malloc(vars.envSize * sizeof(char*));
+		if (vars.env == NULL){
+			perror("malloc - environment");
+			exit(1);
+		}
+	}
+	vars.envCount = 0;
+	for (i = 0; i < vars.capacity; i++){
+		if (vars.slots[i].set && vars.slots[i].exported){
+			vars.env[vars.envCount++] = vars.slots[i].entry;
+		}
+	}
+	vars.env[vars.envCount] = NULL;
+	vars.envDirty = false;
+	environ = vars.env;
+	return vars.env;
+}
+
+
+
+
+/*******************************************************************************
+ * setVar
+ * sets the variable name (len bytes long) to value, adding it if it's new.
+ * Whether it's exported doesn't change. The value is written over the old 
+ * one when it fits, so a for loop doesn't allocate on every pass. Returns 
+ * the variable.
+ *
+ * ****************************************************************************/
+struct shellVar* setVar(const char* name, size_t len, const char* value){
+	struct shellVar* var = findVar(name, len, true);
+	size_t valueLen = strlen(value);
+	char* old = NULL;            // an entry that was too small
+
+	if (len + valueLen + 2 > var->size){
+		old = var->entry;
+		var->size = len + valueLen + 2 < 32 ? 32 : 
+			(len + valueLen + 2) * 2;
+		var->entry = malloc(var->size);
+		if (var->entry == NULL){
+			perror("malloc - variable");
+			exit(1);
+		}
+		memcpy(var->entry, name, len);
+		var->entry[len] = '=';
+	}
+	memcpy(var->entry + len + 1, value, valueLen + 1);
+	if (var->exported && (!var->set || old)){
+		vars.envDirty = true;
+	}
+	var->set = true;
+	// environ mustn't be left pointing at the old entry
+	if (old){
+		if (var->exported){
+			exportedEnv();
+		}
+		free(old);
+	}
+	return var;
+}
+
+
+
+
+/*******************************************************************************
+ * exportVar / unsetVar
+ * exportVar puts the variable in the environment of commands, now and 
+ * whenever it's set later. unsetVar removes its value, and its export.
+ *
+ * ****************************************************************************/
+void exportVar(struct shellVar* var){
+	if (!var->exported && var->set){
+		vars.envDirty = true;
+	}
+	var->exported = true;
+}
+
+void unsetVar(struct shellVar* var){
+	if (var->exported && var->set){
+		vars.envDirty = true;
+	}
+	var->set = false;
+	var->exported = false;
+}
+
+
+
+
+/*******************************************************************************
+ * initVars
+ * fills the variable table from the environment we were started with, every
+ * one of them exported, and points environ at the table's environment.
+ *
+ * ****************************************************************************/
+void initVars(void){
+	char** env;
+	char* equals;
+
+	for (env = environ; *env; env++){
+		equals = strchr(*env, '=');
+		if (equals && equals > *env){
+			exportVar(setVar(*env, equals - *env, equals + 1));
+		}
+	}
+	vars.envDirty = true;
+	exportedEnv();
+}
+
+
+
+
+/*******************************************************************************
+ * countAssignments
+ * returns how many of the first count words are NAME=value assignments, 
+ * before the first word that isn't one.
+ *
+ * ****************************************************************************/
+int countAssignments(char** words, int count){
+	int i;
+	size_t len;
+	for (i = 0; i < count && words[i] && !isOperator(words[i], words[i]); 
+			i++){
+		len = nameLength(words[i]);
+		if (len == 0 || words[i][len] != '='){
+			break;
+		}
+	}
+	return i;
+}
+
+
+
+
+/*******************************************************************************
+ * assignVars
+ * sets the variables of count NAME=value words.
+ *
+ * ****************************************************************************/
+void assignVars(char** words, int count){
+	size_t len;
+	int i;
+	for (i = 0; i < count; i++){
+		len = nameLength(words[i]);
+		setVar(words[i], len, words[i] + len + 1);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * commandEnv
+ * returns the environment for a command with count NAME=value words before
+ * it: the shell's, with those added or replacing the same names. Built in 
+ * the arena, only commands that have such words pay for copying it.
+ *
+ * ****************************************************************************/
+char** commandEnv(char** words, int count, struct arena* arena){
+	char** env = exportedEnv();
+	char** out;
+	int outCount = vars.envCount;
+	size_t len;              // of a name and its '='
+	int i, j;
+
+	out = arenaAlloc(arena, (outCount + count + 1) * sizeof(char*));
+	memcpy(out, env, outCount * sizeof(char*));
+	for (i = 0; i < count; i++){
+		len = nameLength(words[i]) + 1;
+		for (j = 0; j < outCount; j++){
+			if (strncmp(out[j], words[i], len) == 0){
+				break;
+			}
+		}
+		out[j] = words[i];
+		if (j == outCount){
+			outCount++;
+		}
+	}
+	out[outCount] = NULL;
+	return out;
+}
+
+
+
+
+/*******************************************************************************
+ * compareStrings
+ * qsort comparator for an array of strings.
+ *
+ * ****************************************************************************/
+int compareStrings(const void* a, const void* b){
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+
+
+
+/*******************************************************************************
+ * exportVars
+ * the export builtin:  export [NAME[=value] ...]
+ * exports each variable, setting it first if a value is given. With no 
+ * names, lists the exported variables in order.
+ *
+ * ****************************************************************************/
+int exportVars(struct shell* sh, char** userCmds, int cmdCount){
+	char** env;
+	size_t len;
+	int ret = 0;
+	int i;
+
+	if (cmdCount == 1){
+		env = arenaAlloc(&sh->arena, (vars.envCount + 1) * sizeof(char*));
+		memcpy(env, exportedEnv(), (vars.envCount + 1) * sizeof(char*));
+		qsort(env, vars.envCount, sizeof(char*), compareStrings);
+		for (i = 0; env[i]; i++){
+			printf("export %s\n", env[i]);
+		}
+		flushOutput();
+		return 0;
+	}
+	for (i = 1; i < cmdCount; i++){
+		len = nameLength(userCmds[i]);
+		if (len == 0 || (userCmds[i][len] != '=' && userCmds[i][len])){
+			printf("export: '%s': not a valid identifier\n", 
+					userCmds[i]);
+			ret = 1;
+			continue;
+		}
+		if (userCmds[i][len] == '='){
+			exportVar(setVar(userCmds[i], len, userCmds[i] + len + 1));
+		}
+		else {
+			exportVar(findVar(userCmds[i], len, true));
+		}
+	}
+	flushOutput();
+	return ret;
+}
+
+
+
+
+/*******************************************************************************
+ * unsetVars
+ * the unset builtin:  unset NAME ...
+ * removes each variable, from the environment too.
+ *
+ * ****************************************************************************/
+int unsetVars(struct shell* sh, char** userCmds, int cmdCount){
+	struct shellVar* var;
+	size_t len;
+	int ret = 0;
+	int i;
+
+	for (i = 1; i < cmdCount; i++){
+		len = nameLength(userCmds[i]);
+		if (len == 0 || userCmds[i][len]){
+			printf("unset: '%s': not a valid identifier\n", 
+					userCmds[i]);
+			ret = 1;
+			continue;
+		}
+		var = findVar(userCmds[i], len, false);
+		if (var){
+			unsetVar(var);
+		}
+	}
+	flushOutput();
+	return ret;
+}
+
+
+
+
+/*******************************************************************************
+ * pushVars
+ * sets and exports the variables of count NAME=value words for a builtin, 
+ * returning what they were before so popVars can put them back. The table 
+ * can grow while the builtin runs, so they're saved by name.
+ *
+ * ****************************************************************************/
+struct savedVar* pushVars(char** words, int count, struct arena* arena){
+	struct savedVar* saved;
+	struct shellVar* var;
+	int i;
+
+	if (count == 0){
+		return NULL;
+	}
+	saved = arenaAlloc(arena, count * sizeof(struct savedVar));
+	for (i = 0; i < count; i++){
+		saved[i].name = words[i];
+		saved[i].len = nameLength(words[i]);
+		var = findVar(words[i], saved[i].len, false);
+		saved[i].value = var && var->set ? arenaCopy(arena, 
+				var->entry + var->nameLen + 1, 
+				strlen(var->entry + var->nameLen + 1)) : NULL;
+		saved[i].exported = var && var->exported;
+		exportVar(setVar(words[i], saved[i].len, 
+				words[i] + saved[i].len + 1));
+	}
+	return saved;
+}
+
+
+
+
+/*******************************************************************************
+ * popVars
+ * puts back the count variables pushVars saved, last first so a name given 
+ * twice ends up as it started.
+ *
+ * ****************************************************************************/
+void popVars(struct savedVar* saved, int count){
+	struct shellVar* var;
+	int i;
+
+	for (i = count - 1; i >= 0; i--){
+		if (saved[i].value == NULL){
+			var = findVar(saved[i].name, saved[i].len, true);
+			unsetVar(var);
+		}
+		else {
+			var = setVar(saved[i].name, saved[i].len, 
+					saved[i].value);
+			if (!saved[i].exported && var->exported){
+				vars.envDirty = true;
+				var->exported = false;
+			}
+		}
+		if (saved[i].exported){
+			exportVar(var);
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * historyOpen
+ * opens the history log, $HISTFILE or else ~/.smallsh_history, and its index
+ * (the same name with .idx on the end), creating them if need be. Without a
+ * file to keep it in the history goes in memory and lasts as long as the 
+ * shell. Nothing is read, see historySync.
+ *
+ * ****************************************************************************/
+void historyOpen(void){
+	char logPath[4096];           // the log
+	char indexPath[4100];         // its index
+	char* path = getVar("HISTFILE");
+	char* home = getVar("HOME");
+	int flags = O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC;
+
+	logPath[0] = '\0';
+	if (path){
+		snprintf(logPath, sizeof(logPath), "%s", path);
+	}
+	else if (home && *home){
+		snprintf(logPath, sizeof(logPath), "%s/.smallsh_history", home);
+	}
+	if (logPath[0]){
+		snprintf(indexPath, sizeof(indexPath), "%s.idx", logPath);
+		history.logFd = open(logPath, flags, 0600);
+		history.indexFd = open(indexPath, flags, 0600);
+		if (history.logFd == -1 || history.indexFd == -1){
+			if (history.logFd != -1){
+				close(history.logFd);
+			}
+			if (history.indexFd != -1){
+				close(history.indexFd);
+			}
+			history.logFd = history.indexFd = -1;
+		}
+	}
+	// nowhere to keep it, it only lasts as long as we do
+	if (history.logFd == -1){
+		history.logFd = memfd_create("history", MFD_CLOEXEC);
+		history.indexFd = memfd_create("history-index", MFD_CLOEXEC);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * mapFile
+ * maps all of the file fd read-only at *map, remapping it if it has changed 
+ * size since it was last mapped (*mapped bytes). The pages are only read in 
+ * when something looks at them. Returns false if it can't be mapped.
+ *
+ * ****************************************************************************/
+bool mapFile(int fd, char** map, size_t* mapped){
+	struct stat info;
+
+	if (fstat(fd, &info) == -1){
+		return false;
+	}
+	if ((size_t)info.st_size == *mapped){
+		return true;
+	}
+	if (*map){
+		munmap(*map, *mapped);
+	}
+	*map = NULL;
+	*mapped = 0;
+	if (info.st_size == 0){
+		return true;
+	}
+	*map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (*map == MAP_FAILED){
+		*map = NULL;
+		return false;
+	}
+	*mapped = info.st_size;
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * recordEnd
+ * returns the offset in the log just past record i's newline (or the end of
+ * the log, if the last record has none).
+ *
+ * ****************************************************************************/
+size_t recordEnd(size_t i){
+	uint64_t start = history.offsets[i];
+	char* newline = memchr(history.log + start, '\n', 
+			history.logSize - start);
+
+	return newline ? (size_t)(newline - history.log) + 1 : history.logSize;
+}
+
+
+
+
+/*******************************************************************************
+ * writeIndex
+ * appends count offsets to the history index. If they aren't all written 
+ * the index is cut back to its last whole entry, so part of an offset is 
+ * never read as one, and false is returned.
+ *
+ * ****************************************************************************/
+bool writeIndex(const uint64_t* offsets, size_t count){
+	ssize_t len = count * sizeof(uint64_t);
+	struct stat st;
+
+	if (write(history.indexFd, offsets, len) == len){
+		return true;
+	}
+	if (fstat(history.indexFd, &st) == 0 && st.st_size % sizeof(uint64_t) && 
+			ftruncate(history.indexFd, st.st_size - 
+				st.st_size % sizeof(uint64_t)) == -1){
+		perror("history index");
+	}
+	return false;
+}
+
+
+
+
+/*******************************************************************************
+ * historyRepair
+ * maps the log and index, and makes the index cover every record of the log.
+ * Normally every record is indexed as it is added and there's nothing to do,
+ * but the index is rebuilt for a log written without one (or that it doesn't
+ * belong to), and caught up if a shell died between the two writes or a 
+ * write of the index was cut short. The caller holds the lock on the log, 
+ * so no one else is adding records.
+ *
+ * ****************************************************************************/
+void historyRepair(void){
+	uint64_t batch[1024];         // offsets waiting to be written
+	size_t batchCount = 0;
+	uint64_t offset;              // start of the next record
+	char* newline;
+	size_t keep;                  // bytes of the index that are usable
+
+	mapFile(history.logFd, &history.log, &history.logSize);
+	mapFile(history.indexFd, (char**)&history.offsets, &history.indexSize);
+	history.count = history.indexSize / sizeof(uint64_t);
+
+	// an index pointing past the end of the log is for some other log,
+	// and part of an entry at its end is from a write that was cut short
+	if (history.count > 0 && 
+			history.offsets[history.count - 1] >= history.logSize){
+		history.count = 0;
+	}
+	keep = history.count * sizeof(uint64_t);
+	if (keep != history.indexSize){
+		if (ftruncate(history.indexFd, keep) == -1){
+			perror("history index");
+			history.count = 0;
+			return;
+		}
+		mapFile(history.indexFd, (char**)&history.offsets, 
+				&history.indexSize);
+	}
+	offset = history.count > 0 ? recordEnd(history.count - 1) : 0;
+	if (offset == history.logSize){
+		return;
+	}
+	// index the records after the last one we know about
+	while (offset < history.logSize){
+		batch[batchCount++] = offset;
+		if (batchCount == 1024){
+			if (!writeIndex(batch, batchCount)){
+				break;
+			}
+			batchCount = 0;
+		}
+		newline = memchr(history.log + offset, '\n', 
+				history.logSize - offset);
+		offset = newline ? (uint64_t)(newline - history.log) + 1 : 
+			history.logSize;
+	}
+	// what couldn't be written is caught up next time
+	if (offset == history.logSize){
+		writeIndex(batch, batchCount);
+	}
+	mapFile(history.indexFd, (char**)&history.offsets, &history.indexSize);
+	history.count = history.indexSize / sizeof(uint64_t);
+}
+
+
+
+
+/*******************************************************************************
+ * historySync
+ * brings our view of the history up to date with the files, which other 
+ * shells may have added to, opening them the first time. Mapping them is 
+ * all it takes, however long the history is, unless the index needs fixing
+ * (see historyRepair). Returns false if there is no history.
+ *
+ * ****************************************************************************/
+bool historySync(void){
+	if (history.logFd == -1){
+		historyOpen();
+	}
+	if (history.logFd == -1 || history.indexFd == -1){
+		return false;
+	}
+	mapFile(history.logFd, &history.log, &history.logSize);
+	mapFile(history.indexFd, (char**)&history.offsets, &history.indexSize);
+	history.count = history.indexSize / sizeof(uint64_t);
+
+	// the index should end right where the log does, on a whole entry
+	if ((history.count == 0 && history.logSize > 0) || 
+			history.indexSize % sizeof(uint64_t) || (history.count > 0 &&
+			(history.offsets[history.count - 1] >= history.logSize ||
+			 recordEnd(history.count - 1) != history.logSize))){
+		flock(history.logFd, LOCK_EX);
+		historyRepair();
+		flock(history.logFd, LOCK_UN);
+	}
+	// the index was rebuilt under the sorted one
+	if (history.sortedCount > history.count){
+		free(history.sorted);
+		history.sorted = NULL;
+		history.sortedCount = 0;
+	}
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * parseNumber
+ * reads the decimal number from c up to end, for the fields of the log.
+ *
+ * ****************************************************************************/
+long long parseNumber(const char* c, const char* end){
+	long long value = 0;
+	bool negative = c < end && *c == '-';
+
+	for (c += negative; c < end && isdigit((unsigned char)*c); c++){
+		value = value * 10 + (*c - '0');
+	}
+	return negative ? -value : value;
+}
+
+
+
+
+/*******************************************************************************
+ * historyEntry
+ * splits record i of the log into its fields. A record is 
+ *   time <tab> status <tab> cwd <tab> command <newline>
+ * and a line without the three tabs (a history file from somewhere else) is
+ * taken to be all command.
+ *
+ * ****************************************************************************/
+void historyEntry(size_t i, struct histEntry* entry){
+	const char* start = history.log + history.offsets[i];
+	const char* end = history.log + recordEnd(i);
+	const char* tabs[3];          // where each field ends
+	const char* c = start;
+	int j;
+
+	if (end > start && end[-1] == '\n'){
+		end--;
+	}
+	entry->time = 0;
+	entry->status = 0;
+	entry->cwd = "";
+	entry->cwdLen = 0;
+	entry->cmd = start;
+	entry->cmdLen = end - start;
+	for (j = 0; j < 3; j++){
+		tabs[j] = memchr(c, '\t', end - c);
+		if (tabs[j] == NULL){
+			return;
+		}
+		c = tabs[j] + 1;
+	}
+	entry->time = parseNumber(start, tabs[0]);
+	entry->status = parseNumber(tabs[0] + 1, tabs[1]);
+	entry->cwd = tabs[1] + 1;
+	entry->cwdLen = tabs[2] - entry->cwd;
+	entry->cmd = tabs[2] + 1;
+	entry->cmdLen = end - entry->cmd;
+}
+
+
+
+
+/*******************************************************************************
+ * historyAdd
+ * appends a command line to the history with when it was entered, the 
+ * directory it was entered in and its $?. The record and its index entry 
+ * are each written in one go under a lock on the log, so shells sharing the
+ * history don't get in each other's way.
+ *
+ * ****************************************************************************/
+void historyAdd(const char* cmd, size_t len, time_t when, int status, 
+		const char* cwd, struct arena* arena){
+	size_t cwdLen = strlen(cwd);
+	char* record;                 // the line written to the log
+	char* c;
+	size_t recordLen;
+	uint64_t offset;              // where it went
+	size_t i;
+
+	if (history.logFd == -1){
+		historyOpen();
+	}
+	if (history.logFd == -1 || history.indexFd == -1){
+		return;
+	}
+	record = arenaAlloc(arena, len + cwdLen + 64);
+	c = record + sprintf(record, "%lld\t%d\t", (long long)when, status);
+	// the fields can't hold the chars that separate them
+	for (i = 0; i < cwdLen; i++){
+		*c++ = cwd[i] == '\t' || cwd[i] == '\n' ? ' ' : cwd[i];
+	}
+	*c++ = '\t';
+	for (i = 0; i < len; i++){
+		*c++ = cmd[i] == '\n' ? ' ' : cmd[i];
+	}
+	*c++ = '\n';
+	recordLen = c - record;
+
+	flock(history.logFd, LOCK_EX);
+	// the index has to be complete for the new entry to land in place
+	historyRepair();
+	if (write(history.logFd, record, recordLen) == (ssize_t)recordLen){
+		offset = lseek(history.logFd, 0, SEEK_CUR) - recordLen;
+		writeIndex(&offset, 1);
+	}
+	flock(history.logFd, LOCK_UN);
+}
+
+
+
+
+/*******************************************************************************
+ * historyFind
+ * returns the number of the most recent record whose command starts with 
+ * prefix (len bytes), or -1. Searching back from the end finds recent 
+ * commands right away.
+ *
+ * ****************************************************************************/
+long historyFind(const char* prefix, size_t len){
+	struct histEntry entry;
+	size_t i;
+
+	for (i = history.count; i-- > 0;){
+		historyEntry(i, &entry);
+		if (entry.cmdLen >= len && memcmp(entry.cmd, prefix, len) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+
+
+/*******************************************************************************
+ * historyExpand
+ * replaces history references in a line before it is parsed:
+ *   !!        the last command
+ *   !n        command n            !-n       the nth command back
+ *   !word     the last command that starts with word
+ * A '!' in single quotes, after a '\', or before a blank, '=', '(' or an
+ * operator is left alone. Returns 1 and sets out and outLen (in the arena) if
+ * something was replaced, 0 if not, and -1 (having said so) if a command
+ * isn't there.
+ *
+ * ****************************************************************************/
+int historyExpand(const char* line, size_t len, struct arena* arena, 
+		char** out, size_t* outLen){
+	const char* end = line + len;
+	const char* c;                // walks the line
+	const char* next;             // just past a reference
+	struct expandBuf buf;         // where the new line goes
+	struct histEntry entry;       // a command referred to
+	size_t want = len * 2 + 256;  // room to ask the arena for
+	long event;                   // record referred to
+	bool quoted;                  // in single quotes?
+	bool expanded;                // replaced anything?
+	bool fits;
+
+	historySync();
+	do {
+		buf.out = arenaReserve(arena, want, &buf.room);
+		buf.len = 0;
+		quoted = false;
+		expanded = false;
+		fits = true;
+		for (c = line; fits && c < end; c++){
+			if (*c == '\'' ){
+				quoted = !quoted;
+			}
+			// a '\' keeps the next char from meaning anything
+			if (*c == '\\' && !quoted && c + 1 < end){
+				fits = appendTo(&buf, c, 2);
+				c++;
+				continue;
+			}
+			if (*c != '!' || quoted || c + 1 == end || 
+					strchr(" \t=();&|<>'\"", c[1])){
+				fits = appendTo(&buf, c, 1);
+				continue;
+			}
+			next = c + 1;
+			if (*next == '!'){
+				event = (long)history.count - 1;
+				next++;
+			}
+			else if (isdigit((unsigned char)*next) || (*next == '-' &&
+					next + 1 < end && 
+					isdigit((unsigned char)next[1]))){
+				next += *next == '-';
+				while (next < end && isdigit((unsigned char)*next)){
+					next++;
+				}
+				event = parseNumber(c + 1, next);
+				event = event < 0 ? (long)history.count + event : 
+					event - 1;
+			}
+			else {
+				next += strcspn(next, " \t;&|<>()'\"");
+				if (next > end){
+					next = end;
+				}
+				event = historyFind(c + 1, next - c - 1);
+			}
+			if (event < 0 || event >= (long)history.count){
+				printf("%.*s: event not found\n", (int)(next - c), c);
+				flushOutput();
+				return -1;
+			}
+			historyEntry(event, &entry);
+			fits = appendTo(&buf, entry.cmd, entry.cmdLen);
+			expanded = true;
+			c = next - 1;
+		}
+		// didn't fit, try again with more room
+		want = buf.room * 2;
+	} while (!fits);
+
+	if (!expanded){
+		return 0;
+	}
+	buf.out[buf.len] = '\0';
+	arenaCommit(arena, buf.len + 1);
+	*out = buf.out;
+	*outLen = buf.len;
+	return 1;
+}
+
+
+
+
+/*******************************************************************************
+ * commandKey
+ * gives the 8 bytes of a command starting at depth as a number, big end 
+ * first and padded with 0s, so comparing keys compares those bytes.
+ *
+ * ****************************************************************************/
+uint64_t commandKey(const struct histSorted* item, size_t depth){
+	const unsigned char* cmd = (const unsigned char*)history.log + item->cmd;
+	uint64_t key = 0;
+	size_t i;
+
+	if (item->len >= depth + 8){
+		memcpy(&key, cmd + depth, 8);
+		return be64toh(key);
+	}
+	for (i = depth; i < depth + 8; i++){
+		key = key << 8 | (i < item->len ? cmd[i] : 0);
+	}
+	return key;
+}
+
+
+
+
+/*******************************************************************************
+ * compareCommands
+ * orders the prefix index by whole command, then oldest first, for qsort.
+ *
+ * ****************************************************************************/
+int compareCommands(const void* a, const void* b){
+	const struct histSorted* x = a;
+	const struct histSorted* y = b;
+	int order = memcmp(history.log + x->cmd, history.log + y->cmd, 
+			x->len < y->len ? x->len : y->len);
+
+	if (order == 0){
+		order = x->len < y->len ? -1 : x->len > y->len;
+	}
+	if (order == 0){
+		order = x->record < y->record ? -1 : x->record > y->record;
+	}
+	return order;
+}
+
+
+
+
+/*******************************************************************************
+ * commandBefore
+ * says whether a's command sorts before b's, given they agree up to depth.
+ *
+ * ****************************************************************************/
+bool commandBefore(const struct histSorted* a, const struct histSorted* b, 
+		size_t depth){
+	size_t len = a->len < b->len ? a->len : b->len;
+	int order;
+
+	if (a->key != b->key){
+		return a->key < b->key;
+	}
+	order = memcmp(history.log + a->cmd + depth, history.log + b->cmd + depth,
+			len - depth);
+	return order < 0 || (order == 0 && a->len < b->len);
+}
+
+
+
+
+/*******************************************************************************
+ * sortCommands
+ * sorts part of the prefix index by command, keeping records with the same 
+ * command oldest first. It's a radix sort on each item's key, a byte at a 
+ * time from the low end, skipping bytes they all share, with every byte 
+ * counted in one pass and the items passed back and forth between items and
+ * temp. Runs that still tie and go on past the key are given the next 8 bytes
+ * as their key and sorted the same way. Commands can't hold a 0, so equal
+ * keys that don't go on are equal commands. Short runs are insertion sorted
+ * instead, which beats counting bytes for a handful of items, and runs that
+ * share a long prefix go to qsort so the stack stays small. temp needs room
+ * for count items.
+ *
+ * ****************************************************************************/
+void sortCommands(struct histSorted* items, struct histSorted* temp, 
+		size_t count, size_t depth){
+	size_t counts[8][256];        // items with each byte, then where they go
+	struct histSorted* from = items;  // the items as sorted so far
+	struct histSorted* to = temp;     // where the next pass puts them
+	struct histSorted* swap;
+	struct histSorted item;
+	size_t i, j, run, total;
+	int shift;
+
+	if (count < 32){
+		for (i = 1; i < count; i++){
+			item = items[i];
+			for (j = i; j > 0 && commandBefore(&item, &items[j - 1], depth); 
+					j--){
+				items[j] = items[j - 1];
+			}
+			items[j] = item;
+		}
+		return;
+	}
+	if (depth >= 64){
+		qsort(items, count, sizeof(struct histSorted), compareCommands);
+		return;
+	}
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < count; i++){
+		for (shift = 0; shift < 8; shift++){
+			counts[shift][items[i].key >> shift * 8 & 0xff]++;
+		}
+	}
+	for (shift = 0; shift < 8; shift++){
+		if (counts[shift][items[0].key >> shift * 8 & 0xff] == count){
+			continue;
+		}
+		total = 0;
+		for (i = 0; i < 256; i++){
+			run = counts[shift][i];
+			counts[shift][i] = total;
+			total += run;
+		}
+		for (i = 0; i < count; i++){
+			to[counts[shift][from[i].key >> shift * 8 & 0xff]++] = from[i];
+		}
+		swap = from;
+		from = to;
+		to = swap;
+	}
+	if (from != items){
+		memcpy(items, from, count * sizeof(struct histSorted));
+	}
+	for (i = 0; i < count; i += run){
+		for (run = 1; i + run < count && items[i + run].key == items[i].key;
+				run++);
+		if (run > 1 && items[i].len >= depth + 8){
+			for (j = i; j < i + run; j++){
+				items[j].key = commandKey(&items[j], depth + 8);
+			}
+			sortCommands(items + i, temp, run, depth + 8);
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * compareNumbers
+ * qsort comparison for the command numbers historyPrefix finds, putting them
+ * in the order they were run.
+ *
+ * ****************************************************************************/
+int compareNumbers(const void* a, const void* b){
+	uint32_t i = *(const uint32_t*)a;
+	uint32_t j = *(const uint32_t*)b;
+
+	return i < j ? -1 : i > j;
+}
+
+
+
+
+/*******************************************************************************
+ * historyPrefix
+ * finds every command that starts with prefix, putting their numbers in 
+ * order into an array from the arena. The records are kept sorted by 
+ * command, so a prefix is found by binary search however long the history 
+ * is. The sorted index is made the first time it's needed, and records added
+ * since are checked one by one until there are HISTREBUILD of them, when it
+ * is sorted again. Returns how many were found.
+ *
+ * ****************************************************************************/
+size_t historyPrefix(const char* prefix, struct arena* arena, 
+		uint32_t** found){
+	size_t len = strlen(prefix);
+	size_t low, high, mid;        // binary search bounds
+	size_t count = 0;             // commands found
+	struct histSorted* sorted;    // an entry of the index
+	struct histSorted* temp;      // room for sorting the index
+	struct histEntry entry;
+	size_t i;
+
+	if (history.sorted == NULL || 
+			history.count - history.sortedCount > HISTREBUILD){
+		free(history.sorted);
+		history.sorted = malloc((history.count + 1) * 
+				sizeof(struct histSorted));
+		if (history.sorted == NULL){
+			perror("malloc - history index");
+			exit(1);
+		}
+		for (i = 0; i < history.count; i++){
+			historyEntry(i, &entry);
+			history.sorted[i].cmd = entry.cmd - history.log;
+			history.sorted[i].len = entry.cmdLen;
+			history.sorted[i].record = i;
+			history.sorted[i].key = commandKey(&history.sorted[i], 0);
+		}
+		temp = malloc((history.count + 1) * sizeof(struct histSorted));
+		if (temp == NULL){
+			perror("malloc - history index");
+			exit(1);
+		}
+		if (history.count > 0){
+			sortCommands(history.sorted, temp, history.count, 0);
+		}
+		free(temp);
+		history.sortedCount = history.count;
+	}
+	*found = arenaAlloc(arena, (history.count + 1) * sizeof(uint32_t));
+
+	// the first command not less than the prefix
+	low = 0;
+	high = history.sortedCount;
+	while (low < high){
+		mid = low + (high - low) / 2;
+		sorted = &history.sorted[mid];
+		if (memcmp(history.log + sorted->cmd, prefix, 
+				sorted->len < len ? sorted->len : len) < 0 || 
+				(sorted->len < len && memcmp(history.log + 
+				 sorted->cmd, prefix, sorted->len) == 0)){
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	// the matches are all together from there
+	for (i = low; i < history.sortedCount; i++){
+		sorted = &history.sorted[i];
+		if (sorted->len < len || memcmp(history.log + sorted->cmd, 
+				prefix, len) != 0){
+			break;
+		}
+		(*found)[count++] = sorted->record;
+	}
+	qsort(*found, count, sizeof(uint32_t), compareNumbers);
+	// then anything added since the index was sorted
+	for (i = history.sortedCount; i < history.count; i++){
+		historyEntry(i, &entry);
+		if (entry.cmdLen >= len && memcmp(entry.cmd, prefix, len) == 0){
+			(*found)[count++] = i;
+		}
+	}
+	return count;
+}
+
+
+
+
+/*******************************************************************************
+ * historySearch
+ * finds every command containing text, putting their numbers in order into
+ * an array from the arena. The whole mapped log is searched with memmem, 
+ * which is far faster than going record by record, and each hit is turned 
+ * into a record number by a binary search of the index. Returns how many 
+ * were found.
+ *
+ * ****************************************************************************/
+size_t historySearch(const char* text, struct arena* arena, 
+		uint32_t** found){
+	size_t len = strlen(text);
+	size_t count = 0;             // commands found
+	size_t from = 0;              // where the search goes on from
+	size_t low, high, mid;        // binary search bounds
+	struct histEntry entry;
+	char* hit;                    // text in the log
+	size_t at;                    // its offset
+
+	*found = arenaAlloc(arena, (history.count + 1) * sizeof(uint32_t));
+	while (history.count > 0 && from < history.logSize && (hit = memmem(
+			history.log + from, history.logSize - from, text, len))){
+		at = hit - history.log;
+		// the last record starting at or before the hit
+		low = 0;
+		high = history.count;
+		while (high - low > 1){
+			mid = low + (high - low) / 2;
+			if (history.offsets[mid] <= at){
+				low = mid;
+			}
+			else {
+				high = mid;
+			}
+		}
+		historyEntry(low, &entry);
+		// a hit in the time or cwd only counts if the command has it
+		if (hit < entry.cmd){
+			from = entry.cmd - history.log;
+			continue;
+		}
+		if (hit + len <= entry.cmd + entry.cmdLen){
+			(*found)[count++] = low;
+		}
+		from = recordEnd(low);
+	}
+	return count;
+}
+
+
+
+
+/*******************************************************************************
+ * printHistory
+ * prints record i as the history builtin lists it, with its time, $? and 
+ * directory too if verbose.
+ *
+ * ****************************************************************************/
+void printHistory(size_t i, bool verbose){
+	struct histEntry entry;
+	char when[32];                // time it was entered
+	time_t time;
+
+	historyEntry(i, &entry);
+	if (verbose){
+		time = entry.time;
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", 
+				localtime(&time));
+		printf("%6zu  %s  %3d  %.*s  %.*s\n", i + 1, when, entry.status,
+				(int)entry.cwdLen, entry.cwd, 
+				(int)entry.cmdLen, entry.cmd);
+	}
+	else {
+		printf("%6zu  %.*s\n", i + 1, (int)entry.cmdLen, entry.cmd);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * showHistory
+ * the history builtin:  history [-l] [n | -p prefix | -s text]
+ * lists the commands entered so far (the last n of them), those starting 
+ * with prefix, or those containing text. -l adds when each was entered, its
+ * exit value and the directory it ran in. Commands can be run again with
+ * !n, !! and the rest, see historyExpand.
+ *
+ * ****************************************************************************/
+int showHistory(struct shell* sh, char** userCmds, int cmdCount){
+	bool verbose = false;         // -l
+	uint32_t* found = NULL;       // commands matched by -p or -s
+	size_t foundCount = 0;
+	size_t first = 0;             // first command listed
+	size_t last;                  // how many to list, for history n
+	int i = 1;
+	size_t j;
+
+	if (i < cmdCount && strcmp(userCmds[i], "-l") == 0){
+		verbose = true;
+		i++;
+	}
+	if (!historySync()){
+		printf("history: no history\n");
+		flushOutput();
+		return 1;
+	}
+	if (i + 1 < cmdCount && strcmp(userCmds[i], "-p") == 0){
+		foundCount = historyPrefix(userCmds[i + 1], &sh->arena, &found);
+	}
+	else if (i + 1 < cmdCount && strcmp(userCmds[i], "-s") == 0){
+		foundCount = historySearch(userCmds[i + 1], &sh->arena, &found);
+	}
+	else if (i < cmdCount && isdigit((unsigned char)userCmds[i][0])){
+		last = strtoul(userCmds[i], NULL, 10);
+		first = last < history.count ? history.count - last : 0;
+	}
+	else if (i < cmdCount){
+		printf("usage: history [-l] [n | -p prefix | -s text]\n");
+		flushOutput();
+		return 1;
+	}
+
+	if (found){
+		for (j = 0; j < foundCount; j++){
+			printHistory(found[j], verbose);
+		}
+	}
+	else {
+		for (j = first; j < history.count; j++){
+			printHistory(j, verbose);
+		}
+	}
+	flushOutput();
+	return found && foundCount == 0;
+}
+
+
+
+
+/*******************************************************************************
+ * keepHistory
+ * adds a line of the command being read to the text that goes in the 
+ * history. The lines of a compound command are joined with "; ", which 
+ * means the same, so it can be run again as one line. A line ending in && 
+ * or || goes on in the next, where a ';' would be an error, so that one is
+ * joined with a space.
+ *
+ * ****************************************************************************/
+void keepHistory(struct shell* sh, const char* line, size_t len){
+	size_t need = sh->histLen + len + 3;    // with "; " and a NUL
+	size_t end = sh->histLen;               // where the text so far ends
+
+	if (need > sh->histSize){
+		sh->histSize = need * 2;
+		sh->histLine = realloc(sh->histLine, sh->histSize);
+		if (sh->histLine == NULL){
+			perror("realloc - history line");
+			exit(1);
+		}
+	}
+	while (end > 0 && (sh->histLine[end - 1] == ' ' || 
+			sh->histLine[end - 1] == '\t')){
+		end--;
+	}
+	if (end >= 2 && (memcmp(sh->histLine + end - 2, "&&", 2) == 0 || 
+			memcmp(sh->histLine + end - 2, "||", 2) == 0)){
+		sh->histLine[sh->histLen++] = ' ';
+	}
+	else if (sh->histLen > 0){
+		memcpy(sh->histLine + sh->histLen, "; ", 2);
+		sh->histLen += 2;
+	}
+	memcpy(sh->histLine + sh->histLen, line, len);
+	sh->histLen += len;
+	sh->histLine[sh->histLen] = '\0';
+}
+
+
+
+
+/*******************************************************************************
+ * growText
+ * makes sure the buffer at *buf, *size bytes long, can hold need bytes, 
+ * doubling it if it can't. what names the buffer if we run out of memory.
+ *
+ * ****************************************************************************/
+void growText(char** buf, size_t* size, size_t need, const char* what){
+	if (need <= *size){
+		return;
+	}
+	*size = need * 2;
+	*buf = realloc(*buf, *size);
+	if (*buf == NULL){
+		perror(what);
+		exit(1);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * editOut / editFlush
+ * the editor builds each screen update in one buffer, and editFlush writes it
+ * to the terminal with one write.
+ *
+ * ****************************************************************************/
+void editOut(struct lineEditor* ed, const char* text, size_t len){
+	growText(&ed->out, &ed->outSize, ed->outLen + len, 
+			"realloc - line editor output");
+	memcpy(ed->out + ed->outLen, text, len);
+	ed->outLen += len;
+}
+
+void editFlush(struct lineEditor* ed){
+	size_t done = 0;
+	ssize_t written;
+
+	while (done < ed->outLen){
+		written = write(STDOUT_FILENO, ed->out + done, ed->outLen - done);
+		if (written == -1 && errno == EINTR){
+			continue;
+		}
+		if (written <= 0){
+			break;
+		}
+		done += written;
+	}
+	ed->outLen = 0;
+}
+
+
+
+
+/*******************************************************************************
+ * textWidth / prevChar / nextChar
+ * the line is UTF-8, so a char can be several bytes. textWidth counts the 
+ * chars in len bytes (taking each to be one column wide), and prevChar and 
+ * nextChar give the start of the char before or after the one at pos.
+ *
+ * ****************************************************************************/
+size_t textWidth(const char* text, size_t len){
+	size_t width = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++){
+		width += ((unsigned char)text[i] & 0xc0) != 0x80;
+	}
+	return width;
+}
+
+size_t prevChar(struct lineEditor* ed, size_t pos){
+	while (pos > 0 && ((unsigned char)ed->line[--pos] & 0xc0) == 0x80);
+	return pos;
+}
+
+size_t nextChar(struct lineEditor* ed, size_t pos){
+	while (pos < ed->len && ((unsigned char)ed->line[++pos] & 0xc0) == 0x80);
+	return pos;
+}
+
+
+
+
+/*******************************************************************************
+ * refreshLine
+ * redraws the prompt and the line, with the cursor in its place. A line too
+ * long for the terminal scrolls sideways to keep the cursor in view.
+ *
+ * ****************************************************************************/
+void refreshLine(struct lineEditor* ed){
+	const char* prompt = ed->searching ? ed->searchPrompt : promptText;
+	size_t promptLen = strlen(prompt);
+	size_t room;                  // columns for the line
+	size_t width;                 // columns before the cursor
+	size_t end;                   // end of the part shown
+	char move[32];                // puts the cursor back
+
+	room = ed->columns > promptLen + 1 ? ed->columns - promptLen - 1 : 1;
+	if (ed->cursor < ed->offset){
+		ed->offset = ed->cursor;
+	}
+	width = textWidth(ed->line + ed->offset, ed->cursor - ed->offset);
+	while (width >= room){
+		ed->offset = nextChar(ed, ed->offset);
+		width--;
+	}
+	end = ed->offset;
+	for (width = 0; end < ed->len && width < room; width++){
+		end = nextChar(ed, end);
+	}
+
+	editOut(ed, "\r", 1);
+	editOut(ed, prompt, promptLen);
+	editOut(ed, ed->line + ed->offset, end - ed->offset);
+	editOut(ed, "\x1b[K\r", 4);
+	width = promptLen + textWidth(ed->line + ed->offset, 
+			ed->cursor - ed->offset);
+	if (width > 0){
+		editOut(ed, move, snprintf(move, sizeof(move), "\x1b[%zuC", width));
+	}
+	ed->dirty = false;
+}
+
+
+
+
+/*******************************************************************************
+ * insertText / deleteText / setLine / killText
+ * change the line being edited. insertText puts text in at the cursor, 
+ * deleteText takes out the bytes from..to, setLine replaces the whole line 
+ * and killText deletes from..to keeping it for ^Y.
+ *
+ * ****************************************************************************/
+void insertText(struct lineEditor* ed, const char* text, size_t len){
+	growText(&ed->line, &ed->size, ed->len + len + 1, 
+			"realloc - line editor");
+	memmove(ed->line + ed->cursor + len, ed->line + ed->cursor, 
+			ed->len - ed->cursor);
+	memcpy(ed->line + ed->cursor, text, len);
+	ed->len += len;
+	ed->cursor += len;
+	ed->line[ed->len] = '\0';
+	ed->dirty = true;
+}
+
+void deleteText(struct lineEditor* ed, size_t from, size_t to){
+	memmove(ed->line + from, ed->line + to, ed->len - to);
+	ed->len -= to - from;
+	ed->line[ed->len] = '\0';
+	if (ed->cursor >= to){
+		ed->cursor -= to - from;
+	}
+	else if (ed->cursor > from){
+		ed->cursor = from;
+	}
+	ed->dirty = true;
+}
+
+void setLine(struct lineEditor* ed, const char* text, size_t len){
+	ed->len = ed->cursor = 0;
+	insertText(ed, text, len);
+}
+
+void killText(struct lineEditor* ed, size_t from, size_t to){
+	if (from == to){
+		return;
+	}
+	growText(&ed->yank, &ed->yankSize, to - from, "realloc - kill buffer");
+	memcpy(ed->yank, ed->line + from, to - from);
+	ed->yankLen = to - from;
+	deleteText(ed, from, to);
+}
+
+
+
+
+/*******************************************************************************
+ * wordLeft / wordRight
+ * where M-b and M-f go: to the start of the word before pos or the end of 
+ * the word after it, where a word is letters and digits (and any non-ASCII 
+ * char).
+ *
+ * ****************************************************************************/
+bool isWordChar(char c){
+	return isalnum((unsigned char)c) || (unsigned char)c >= 0x80;
+}
+
+size_t wordLeft(struct lineEditor* ed, size_t pos){
+	while (pos > 0 && !isWordChar(ed->line[pos - 1])){
+		pos--;
+	}
+	while (pos > 0 && isWordChar(ed->line[pos - 1])){
+		pos--;
+	}
+	return pos;
+}
+
+size_t wordRight(struct lineEditor* ed, size_t pos){
+	while (pos < ed->len && !isWordChar(ed->line[pos])){
+		pos++;
+	}
+	while (pos < ed->len && isWordChar(ed->line[pos])){
+		pos++;
+	}
+	return pos;
+}
+
+
+
+
+/*******************************************************************************
+ * peekKey
+ * returns byte i of the keys typed but not handled yet, waiting for more 
+ * input (see waitInput) if there aren't that many. Before waiting the screen
+ * is brought up to date, so a paste is drawn once and not once a char. 
+ * Returns -1 if a signal or TMOUT interrupted the wait, or at the end of the
+ * input. 
+ *
+ * ****************************************************************************/
+int peekKey(struct inputReader* input, size_t i){
+	struct lineEditor* ed = &editor;
+	ssize_t bytesRead;
+
+	while (ed->keyStart + i >= ed->keyEnd){
+		if (ed->keyStart > 0){
+			memmove(ed->keys, ed->keys + ed->keyStart, 
+					ed->keyEnd - ed->keyStart);
+			ed->keyEnd -= ed->keyStart;
+			ed->keyStart = 0;
+		}
+		if (ed->dirty){
+			refreshLine(ed);
+		}
+		fflush(stdout);
+		editFlush(ed);
+		if (waitInput(input) == -1){
+			return -1;
+		}
+		bytesRead = read(input->fd, ed->keys + ed->keyEnd, 
+				sizeof(ed->keys) - ed->keyEnd);
+		if (bytesRead > 0){
+			ed->keyEnd += bytesRead;
+		}
+		else if (bytesRead == 0 || (errno != EINTR && errno != EAGAIN)){
+			input->eof = true;
+			errno = 0;
+			return -1;
+		}
+	}
+	return (unsigned char)ed->keys[ed->keyStart + i];
+}
+
+
+
+
+/*******************************************************************************
+ * readKey
+ * reads one key. Most are a byte, but the arrows and the like send an escape
+ * sequence (ESC [ or ESC O, numbers, then a letter) and alt sends ESC before
+ * the key, so those come back as the KEY_ codes. Keys that mean nothing to 
+ * us come back as KEY_NONE. A key is only used up once it has all arrived,
+ * so an interrupted read (-1, see peekKey) loses nothing.
+ *
+ * ****************************************************************************/
+int readKey(struct inputReader* input){
+	struct lineEditor* ed = &editor;
+	const char* seq;              // a sequence's numbers
+	bool modified;                // shift, alt or ctrl was held
+	size_t len;                   // bytes in the sequence
+	int c;
+
+	c = peekKey(input, 0);
+	if (c != '\x1b'){
+		ed->keyStart += c != -1;
+		return c;
+	}
+	c = peekKey(input, 1);
+	if (c == -1){
+		return -1;
+	}
+	if (c != '[' && c != 'O'){
+		ed->keyStart += 2;
+		return KEY_META | c;
+	}
+	for (len = 2; len < 16; len++){
+		c = peekKey(input, len);
+		if (c == -1){
+			return -1;
+		}
+		if (c >= 0x40 && c <= 0x7e){
+			break;
+		}
+	}
+	seq = ed->keys + ed->keyStart + 2;
+	modified = memchr(seq, ';', len - 2) != NULL;
+	ed->keyStart += len + 1;
+	switch (c){
+		case 'A':
+			return KEY_UP;
+		case 'B':
+			return KEY_DOWN;
+		case 'C':
+			return modified ? KEY_META | 'f' : KEY_RIGHT;
+		case 'D':
+			return modified ? KEY_META | 'b' : KEY_LEFT;
+		case 'H':
+			return KEY_HOME;
+		case 'F':
+			return KEY_END;
+		case '~':
+			switch (atoi(seq)){
+				case 1:
+				case 7:
+					return KEY_HOME;
+				case 4:
+				case 8:
+					return KEY_END;
+				case 3:
+					return KEY_DELETE;
+			}
+	}
+	return KEY_NONE;
+}
+
+
+
+
+/*******************************************************************************
+ * historyMove
+ * shows the command before (step -1) or after (step 1) the one on the line, 
+ * for the up and down arrows. Moving off the end of the history brings back 
+ * the line that was being typed. Commands the same as the one showing are 
+ * skipped.
+ *
+ * ****************************************************************************/
+void historyMove(struct lineEditor* ed, int step){
+	struct histEntry entry;
+	long pos = ed->histPos;       // record moved to
+
+	if (pos == -1){
+		if (step > 0 || !historySync()){
+			return;
+		}
+		pos = history.count;
+		growText(&ed->saved, &ed->savedSize, ed->len + 1, 
+				"realloc - line editor");
+		memcpy(ed->saved, ed->line, ed->len);
+		ed->savedLen = ed->len;
+	}
+	do {
+		pos += step;
+		if (pos < 0){
+			editOut(ed, "\a", 1);
+			return;
+		}
+		if (pos >= (long)history.count){
+			ed->histPos = -1;
+			setLine(ed, ed->saved, ed->savedLen);
+			return;
+		}
+		historyEntry(pos, &entry);
+	} while (entry.cmdLen == ed->len && 
+			memcmp(entry.cmd, ed->line, ed->len) == 0);
+	ed->histPos = pos;
+	setLine(ed, entry.cmd, entry.cmdLen);
+}
+
+
+
+
+/*******************************************************************************
+ * searchHistory
+ * looks back from record from for a command containing the search text of a 
+ * ^R, and puts it on the line with the cursor on the match. The prompt says 
+ * whether it was found.
+ *
+ * ****************************************************************************/
+void searchHistory(struct lineEditor* ed, long from){
+	struct histEntry entry;
+	const char* match = NULL;     // where the text is in a command
+	long i;
+
+	if (from >= (long)history.count){
+		from = (long)history.count - 1;
+	}
+	for (i = from; i >= 0; i--){
+		historyEntry(i, &entry);
+		match = memmem(entry.cmd, entry.cmdLen, ed->search, ed->searchLen);
+		if (match){
+			ed->searchPos = i;
+			setLine(ed, entry.cmd, entry.cmdLen);
+			ed->cursor = match - entry.cmd;
+			break;
+		}
+	}
+	snprintf(ed->searchPrompt, sizeof(ed->searchPrompt), 
+			"(%sreverse-i-search)`%.*s': ", match || ed->searchLen == 0 ? 
+			"" : "failed ", (int)ed->searchLen, ed->search);
+	ed->dirty = true;
+}
+
+
+
+
+/*******************************************************************************
+ * searchKey
+ * handles a key typed during a ^R search. Typing adds to the text searched 
+ * for, ^R finds the next older match, backspace takes a char off and ^G or 
+ * ^C give up and bring back the line as it was. Any other key ends the 
+ * search leaving the match on the line, and returns false so the key does 
+ * what it usually does.
+ *
+ * ****************************************************************************/
+bool searchKey(struct lineEditor* ed, int key){
+	if (key == 18){
+		searchHistory(ed, ed->searchPos - (ed->searchLen > 0));
+	}
+	else if (key == 127 || key == 8){
+		if (ed->searchLen > 0){
+			ed->searchLen--;
+		}
+		searchHistory(ed, (long)history.count - 1);
+	}
+	else if (key >= ' ' && key < 256 && key != 127){
+		if (ed->searchLen < sizeof(ed->search)){
+			ed->search[ed->searchLen++] = key;
+		}
+		searchHistory(ed, ed->searchPos);
+	}
+	else if (key == 7 || key == 3){
+		ed->searching = false;
+		ed->histPos = -1;
+		setLine(ed, ed->saved, ed->savedLen);
+	}
+	else {
+		ed->searching = false;
+		ed->histPos = ed->searchPos < (long)history.count ? 
+			ed->searchPos : -1;
+		ed->dirty = true;
+		return false;
+	}
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * compareNames / compareMatches / findName
+ * a directory index keeps its names sorted, and compareMatches sorts a list
+ * of pointers to its names. findName returns the index of 
+ * the first name not less than name, which is where it is or would go, and 
+ * also where the names starting with it begin.
+ *
+ * ****************************************************************************/
+int compareNames(const void* a, const void* b){
+	return strcmp(((const struct dirName*)a)->name, 
+			((const struct dirName*)b)->name);
+}
+
+int compareMatches(const void* a, const void* b){
+	return strcmp((*(struct dirName* const*)a)->name, 
+			(*(struct dirName* const*)b)->name);
+}
+
+size_t findName(struct dirIndex* dir, const char* name){
+	size_t low = 0;
+	size_t high = dir->count;
+	size_t mid;
+
+	while (low < high){
+		mid = low + (high - low) / 2;
+		if (strcmp(dir->names[mid].name, name) < 0){
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+
+
+
+/*******************************************************************************
+ * nameType
+ * works out what a directory entry is: NAME_DIR, NAME_EXEC for a program, or
+ * 0. The type readdir gave (or DT_UNKNOWN) saves a stat for a directory.
+ *
+ * ****************************************************************************/
+int nameType(int dirFd, const char* name, int dType){
+	struct stat info;
+
+	if (dType == DT_DIR){
+		return NAME_DIR;
+	}
+	if (dType != DT_REG && dType != DT_LNK && dType != DT_UNKNOWN){
+		return 0;
+	}
+	if (fstatat(dirFd, name, &info, 0) != 0){
+		return 0;
+	}
+	if (S_ISDIR(info.st_mode)){
+		return NAME_DIR;
+	}
+	return S_ISREG(info.st_mode) && (info.st_mode & 0111) ? NAME_EXEC : 0;
+}
+
+
+
+
+/*******************************************************************************
+ * scanDir
+ * reads a directory into its index, sorted. This is the only place a 
+ * directory is read: after that inotify tells us what changed, see 
+ * dirEvents. A directory that can't be watched is read again if its mtime 
+ * changes, see indexDir.
+ *
+ * ****************************************************************************/
+void scanDir(struct dirIndex* dir){
+	DIR* stream;
+	struct dirent* entry;
+	struct stat info;
+	size_t i;
+
+	for (i = 0; i < dir->count; i++){
+		free(dir->names[i].name);
+	}
+	dir->count = 0;
+	dir->stale = false;
+	if (dir->wd == -1 && completion.inotifyFd != -1){
+		dir->wd = inotify_add_watch(completion.inotifyFd, dir->path, 
+				DIRWATCH);
+	}
+	stream = opendir(dir->path);
+	if (stream == NULL){
+		memset(&dir->mtime, 0, sizeof(dir->mtime));
+		return;
+	}
+	if (fstat(dirfd(stream), &info) == 0){
+		dir->mtime = info.st_mtim;
+	}
+	while ((entry = readdir(stream))){
+		if (strcmp(entry->d_name, ".") == 0 || 
+				strcmp(entry->d_name, "..") == 0){
+			continue;
+		}
+		if (dir->count == dir->capacity){
+			dir->capacity = dir->capacity ? dir->capacity * 2 : 64;
+			dir->names = realloc(dir->names, 
+					dir->capacity * sizeof(struct dirName));
+			if (dir->names == NULL){
+				perror("realloc - directory index");
+				exit(1);
+			}
+		}
+		dir->names[dir->count].name = strdup(entry->d_name);
+		dir->names[dir->count].type = nameType(dirfd(stream), 
+				entry->d_name, entry->d_type);
+		dir->count++;
+	}
+	closedir(stream);
+	if (dir->count > 1){
+		qsort(dir->names, dir->count, sizeof(struct dirName), compareNames);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * updateName
+ * brings one name of a directory index up to date after inotify said it was
+ * created, deleted, renamed or chmod'ed: it is looked at again and added, 
+ * changed or taken out.
+ *
+ * ****************************************************************************/
+void updateName(struct dirIndex* dir, const char* name){
+	char path[8192];              // dir/name
+	size_t i = findName(dir, name);
+	bool known = i < dir->count && strcmp(dir->names[i].name, name) == 0;
+	int type;
+
+	snprintf(path, sizeof(path), "%s/%s", dir->path, name);
+	if (access(path, F_OK) != 0){
+		if (known){
+			free(dir->names[i].name);
+			memmove(dir->names + i, dir->names + i + 1, 
+					(dir->count - i - 1) * sizeof(struct dirName));
+			dir->count--;
+		}
+		return;
+	}
+	type = nameType(AT_FDCWD, path, DT_UNKNOWN);
+	if (known){
+		dir->names[i].type = type;
+		return;
+	}
+	if (dir->count == dir->capacity){
+		dir->capacity = dir->capacity ? dir->capacity * 2 : 64;
+		dir->names = realloc(dir->names, 
+				dir->capacity * sizeof(struct dirName));
+		if (dir->names == NULL){
+			perror("realloc - directory index");
+			exit(1);
+		}
+	}
+	memmove(dir->names + i + 1, dir->names + i, 
+			(dir->count - i) * sizeof(struct dirName));
+	dir->names[i].name = strdup(name);
+	dir->names[i].type = type;
+	dir->count++;
+}
+
+
+
+
+/*******************************************************************************
+ * dirEvents
+ * applies whatever inotify has reported since last time to the directory 
+ * indexes. Only the names that changed are looked at. If the events 
+ * overflowed, or a directory itself went away or was renamed, the indexes 
+ * concerned are read again next time they're used.
+ *
+ * ****************************************************************************/
+void dirEvents(void){
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event* event;
+	struct dirIndex* dir;
+	ssize_t bytesRead;
+	char* c;
+	int i;
+
+	if (completion.inotifyFd == -1){
+		return;
+	}
+	while ((bytesRead = read(completion.inotifyFd, buf, sizeof(buf))) > 0){
+		for (c = buf; c < buf + bytesRead; 
+				c += sizeof(struct inotify_event) + event->len){
+			event = (struct inotify_event*)c;
+			dir = NULL;
+			for (i = 0; i < completion.dirCount; i++){
+				if (event->mask & IN_Q_OVERFLOW){
+					completion.dirs[i]->stale = true;
+				}
+				else if (completion.dirs[i]->wd == event->wd){
+					dir = completion.dirs[i];
+				}
+			}
+			if (dir == NULL || dir->stale){
+				continue;
+			}
+			if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)){
+				if (!(event->mask & IN_IGNORED)){
+					inotify_rm_watch(completion.inotifyFd, dir->wd);
+				}
+				dir->wd = -1;
+				dir->stale = true;
+			}
+			else if (event->len > 0){
+				updateName(dir, event->name);
+			}
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * indexDir
+ * returns the index of the directory at path (an absolute path), making it 
+ * the first time. Directories of PATH (onPath) stay indexed, others are 
+ * dropped oldest first when there are more than COMPLETEDIRS of them. Two 
+ * paths to the same directory (like /bin and /usr/bin) share an index. 
+ * Returns NULL if path isn't a directory we can read.
+ *
+ * ****************************************************************************/
+struct dirIndex* indexDir(const char* path, bool onPath){
+	struct dirIndex* dir = NULL;  // the index
+	struct dirIndex* oldest = NULL;   // the one to drop
+	struct stat info;
+	int others = 0;               // indexes not on PATH
+	int wd = -1;                  // path's watch
+	int i;
+
+	if (!completion.started){
+		completion.started = true;
+		completion.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	}
+	completion.clock++;
+	for (i = 0; dir == NULL && i < completion.dirCount; i++){
+		if (strcmp(completion.dirs[i]->path, path) == 0){
+			dir = completion.dirs[i];
+		}
+	}
+	if (dir == NULL && completion.inotifyFd != -1){
+		wd = inotify_add_watch(completion.inotifyFd, path, DIRWATCH);
+		for (i = 0; wd != -1 && dir == NULL && i < completion.dirCount; i++){
+			if (completion.dirs[i]->wd == wd){
+				dir = completion.dirs[i];
+			}
+		}
+	}
+	if (dir == NULL){
+		if (stat(path, &info) != 0 || !S_ISDIR(info.st_mode)){
+			return NULL;
+		}
+		for (i = 0; i < completion.dirCount; i++){
+			if (!completion.dirs[i]->onPath){
+				others++;
+				if (oldest == NULL || completion.dirs[i]->used < oldest->used){
+					oldest = completion.dirs[i];
+				}
+			}
+		}
+		if (others >= COMPLETEDIRS){
+			if (oldest->wd != -1){
+				inotify_rm_watch(completion.inotifyFd, oldest->wd);
+			}
+			for (i = 0; i < (int)oldest->count; i++){
+				free(oldest->names[i].name);
+			}
+			free(oldest->names);
+			free(oldest->path);
+			for (i = 0; completion.dirs[i] != oldest; i++);
+			completion.dirs[i] = completion.dirs[--completion.dirCount];
+			free(oldest);
+		}
+		if (completion.dirCount == completion.dirCapacity){
+			completion.dirCapacity = completion.dirCapacity ? 
+				completion.dirCapacity * 2 : 16;
+			completion.dirs = realloc(completion.dirs, 
+					completion.dirCapacity * sizeof(struct dirIndex*));
+			if (completion.dirs == NULL){
+				perror("realloc - directory indexes");
+				exit(1);
+			}
+		}
+		dir = calloc(1, sizeof(struct dirIndex));
+		if (dir == NULL){
+			perror("calloc - directory index");
+			exit(1);
+		}
+		dir->path = strdup(path);
+		dir->wd = wd;
+		dir->stale = true;
+		completion.dirs[completion.dirCount++] = dir;
+	}
+	dir->onPath |= onPath;
+	dir->used = completion.clock;
+	// not watched, so see if it has changed
+	if (dir->wd == -1 && !dir->stale && (stat(dir->path, &info) != 0 ||
+			info.st_mtim.tv_sec != dir->mtime.tv_sec || 
+			info.st_mtim.tv_nsec != dir->mtime.tv_nsec)){
+		dir->stale = true;
+	}
+	if (dir->stale){
+		scanDir(dir);
+	}
+	return dir;
+}
+
+
+
+
+/*******************************************************************************
+ * listMatches
+ * prints the names a tab could complete to in columns under the line, 
+ * directories with a '/', and draws the line again below them. Too many to
+ * be any use are only counted.
+ *
+ * ****************************************************************************/
+void listMatches(struct lineEditor* ed, struct dirName** matches, 
+		size_t count){
+	size_t width = 0;             // widest name, with room between
+	size_t columns, rows;
+	size_t row, column, i, len;
+
+	editOut(ed, "\n", 1);
+	if (count > COMPLETELIST){
+		char note[64];
+		editOut(ed, note, snprintf(note, sizeof(note), 
+				"%zu possibilities, type more of the name\n", count));
+		refreshLine(ed);
+		return;
+	}
+	for (i = 0; i < count; i++){
+		len = textWidth(matches[i]->name, strlen(matches[i]->name));
+		if (len + 3 > width){
+			width = len + 3;
+		}
+	}
+	columns = ed->columns / width > 0 ? ed->columns / width : 1;
+	rows = (count + columns - 1) / columns;
+	for (row = 0; row < rows; row++){
+		for (column = 0; column < columns; column++){
+			i = column * rows + row;
+			if (i >= count){
+				break;
+			}
+			len = strlen(matches[i]->name);
+			editOut(ed, matches[i]->name, len);
+			len = textWidth(matches[i]->name, len);
+			if (matches[i]->type == NAME_DIR){
+				editOut(ed, "/", 1);
+				len++;
+			}
+			if (column + 1 < columns && i + rows < count){
+				for (; len < width; len++){
+					editOut(ed, " ", 1);
+				}
+			}
+		}
+		editOut(ed, "\n", 1);
+	}
+	refreshLine(ed);
+}
+
+
+
+
+/*******************************************************************************
+ * completeWord
+ * the tab key. The word before the cursor is completed as a command if it is
+ * the first of a command and has no '/', otherwise as a file name. Commands 
+ * are the builtins and the programs in PATH. Names come from the directory 
+ * indexes (see indexDir), so a tab costs a binary search per directory and 
+ * no directories are read. One match is put in whole, followed by a space 
+ * (or a '/' for a directory), and several by what they have in common. When
+ * that adds nothing a second tab lists them.
+ *
+ * ****************************************************************************/
+void completeWord(struct lineEditor* ed){
+	struct arena* arena = &ed->arena;
+	char cwd[4096];               // for relative names and PATH entries
+	char path[8192];              // a directory to look in
+	struct dirIndex** dirs;       // the directories looked in
+	int dirCount = 0;
+	struct dirName** matches;     // the names that fit
+	struct dirName* name;
+	size_t matchCount = 0;
+	size_t total;                 // room for matches
+	size_t wordStart = ed->cursor;    // where the word starts
+	bool inWord = false;
+	bool command;                 // completing a command name?
+	bool fileNext = false;        // a re-direct's file comes next
+	int words = 0;                // words of the command so far
+	char quote = 0;               // quote still open at the cursor
+	char* text;                   // the word as the command will see it
+	size_t textLen = 0;
+	char* base;                   // the part of it being completed
+	size_t baseLen;
+	char* slash;
+	const char* pathVar;
+	const char* entry;            // one directory of PATH
+	const char* entryEnd;
+	const struct builtin* builtin;
+	size_t common;                // bytes the matches all start with
+	size_t inserted = 0;          // bytes the tab added
+	size_t i, j;
+	char c;
+
+	arenaReset(arena);
+	// find the start of the word, and whether it's a command's first
+	for (i = 0; i < ed->cursor; i++){
+		c = ed->line[i];
+		if (quote){
+			if (c == quote){
+				quote = 0;
+			}
+			else if (c == '\\' && quote == '"' && i + 1 < ed->cursor){
+				i++;
+			}
+			continue;
+		}
+		if (c == ' ' || c == '\t' || strchr(";|&<>()", c)){
+			if (inWord){
+				inWord = false;
+				words += !fileNext;
+				fileNext = false;
+			}
+			if (c == ';' || c == '|' || c == '&' || c == '(' || 
+					c == ')'){
+				words = 0;
+			}
+			else if (c == '<' || c == '>'){
+				fileNext = true;
+			}
+			continue;
+		}
+		if (!inWord){
+			inWord = true;
+			wordStart = i;
+		}
+		if (c == '\'' || c == '"'){
+			quote = c;
+		}
+		else if (c == '\\' && i + 1 < ed->cursor){
+			i++;
+		}
+	}
+	if (!inWord){
+		wordStart = ed->cursor;
+	}
+	command = words == 0 && !fileNext;
+
+	// take the quotes and '\'s out
+	text = arenaAlloc(arena, ed->cursor - wordStart + 1);
+	quote = 0;
+	for (i = wordStart; i < ed->cursor; i++){
+		c = ed->line[i];
+		if (quote == 0 && (c == '\'' || c == '"')){
+			quote = c;
+		}
+		else if (c == quote){
+			quote = 0;
+		}
+		else if (c == '\\' && quote != '\'' && i + 1 < ed->cursor){
+			text[textLen++] = ed->line[++i];
+		}
+		else {
+			text[textLen++] = c;
+		}
+	}
+	text[textLen] = '\0';
+	slash = strrchr(text, '/');
+	base = slash ? slash + 1 : text;
+	baseLen = strlen(base);
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL){
+		cwd[0] = '\0';
+	}
+	dirEvents();
+	if (command && slash == NULL){
+		pathVar = getVar("PATH");
+		if (pathVar == NULL){
+			pathVar = "/bin:/usr/bin";
+		}
+		// a new PATH, the old one's directories can be dropped now
+		if (completion.pathVar == NULL || 
+				strcmp(completion.pathVar, pathVar) != 0){
+			for (i = 0; i < (size_t)completion.dirCount; i++){
+				completion.dirs[i]->onPath = false;
+			}
+			free(completion.pathVar);
+			completion.pathVar = strdup(pathVar);
+		}
+		dirs = arenaAlloc(arena, (strlen(pathVar) + 1) * 
+				sizeof(struct dirIndex*));
+		for (entry = pathVar; ; entry = entryEnd + 1){
+			entryEnd = strchrnul(entry, ':');
+			if (entryEnd == entry){
+				snprintf(path, sizeof(path), "%s", cwd);
+			}
+			else if (*entry == '/'){
+				snprintf(path, sizeof(path), "%.*s", 
+						(int)(entryEnd - entry), entry);
+			}
+			else {
+				snprintf(path, sizeof(path), "%s/%.*s", cwd, 
+						(int)(entryEnd - entry), entry);
+			}
+			dirs[dirCount] = indexDir(path, true);
+			// the same directory twice only counts once
+			for (j = 0; dirs[dirCount] && j < (size_t)dirCount; j++){
+				if (dirs[j] == dirs[dirCount]){
+					dirs[dirCount] = NULL;
+				}
+			}
+			dirCount += dirs[dirCount] != NULL;
+			if (*entryEnd == '\0'){
+				break;
+			}
+		}
+	}
+	else {
+		dirs = arenaAlloc(arena, sizeof(struct dirIndex*));
+		if (slash == NULL){
+			snprintf(path, sizeof(path), "%s", cwd);
+		}
+		else if (text[0] == '/'){
+			snprintf(path, sizeof(path), "%.*s", 
+					(int)(slash - text + (slash == text)), text);
+		}
+		else {
+			snprintf(path, sizeof(path), "%s/%.*s", cwd, 
+					(int)(slash - text), text);
+		}
+		dirs[0] = indexDir(path, false);
+		dirCount = dirs[0] != NULL;
+	}
+
+	// gather the names that start with base
+	total = 0;
+	for (builtin = builtins; command && slash == NULL && builtin->name; 
+			builtin++){
+		total++;
+	}
+	for (i = 0; i < (size_t)dirCount; i++){
+		total += dirs[i]->count;
+	}
+	matches = arenaAlloc(arena, (total + 1) * sizeof(struct dirName*));
+	for (i = 0; i < (size_t)dirCount; i++){
+		for (j = findName(dirs[i], base); j < dirs[i]->count; j++){
+			name = &dirs[i]->names[j];
+			if (strncmp(name->name, base, baseLen) != 0){
+				break;
+			}
+			// dot files only if asked for, and only programs as commands
+			if ((name->name[0] == '.' && base[0] != '.') || 
+					(command && slash == NULL && 
+					 name->type != NAME_EXEC)){
+				continue;
+			}
+			matches[matchCount++] = name;
+		}
+	}
+	if (command && slash == NULL){
+		for (builtin = builtins; builtin->name; builtin++){
+			if (strncmp(builtin->name, base, baseLen) == 0){
+				name = arenaAlloc(arena, sizeof(struct dirName));
+				name->name = (char*)builtin->name;
+				name->type = NAME_EXEC;
+				matches[matchCount++] = name;
+			}
+		}
+		// the same program in several directories only counts once
+		qsort(matches, matchCount, sizeof(struct dirName*), compareMatches);
+		for (i = j = 0; i < matchCount; i++){
+			if (j == 0 || strcmp(matches[j - 1]->name, 
+					matches[i]->name) != 0){
+				matches[j++] = matches[i];
+			}
+		}
+		matchCount = j;
+	}
+	if (matchCount == 0){
+		editOut(ed, "\a", 1);
+		return;
+	}
+
+	// put in what every match has
+	common = strlen(matches[0]->name);
+	for (i = 1; i < matchCount; i++){
+		for (j = baseLen; j < common && 
+				matches[i]->name[j] == matches[0]->name[j]; j++);
+		common = j;
+	}
+	for (i = baseLen; i < common; i++){
+		c = matches[0]->name[i];
+		if (quote == 0 && (lexSpecial[(unsigned char)c] || c == '$' || 
+				c == '!')){
+			insertText(ed, "\\", 1);
+		}
+		insertText(ed, &c, 1);
+		inserted++;
+	}
+	if (matchCount == 1){
+		if (matches[0]->type == NAME_DIR){
+			insertText(ed, "/", 1);
+		}
+		else {
+			if (quote){
+				insertText(ed, &quote, 1);
+			}
+			insertText(ed, " ", 1);
+		}
+		inserted++;
+	}
+	if (inserted == 0){
+		if (ed->lastTab){
+			listMatches(ed, matches, matchCount);
+		}
+		else {
+			editOut(ed, "\a", 1);
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * editLine
+ * readLine at a terminal: reads a line with the terminal in raw mode, so it 
+ * can be edited as it's typed. The keys are emacs':
+ *   ^A ^E     start and end of the line    ^B ^F     back and forward a char
+ *   M-b M-f   back and forward a word      ^D        delete a char (or exit)
+ *   ^H        delete the char before       ^K ^U     kill to the end or start
+ *   ^W        kill the word before         M-d       kill the word after
+ *   ^Y        put back what was killed     ^L        clear the screen
+ *   ^P ^N     older and newer commands     ^R        search the history
+ *   tab       complete a name              ^C        give up on the line
+ * and the arrows, home, end and delete keys work. A line being typed when a
+ * signal interrupts the wait (returning -1 with EINTR like readLine) is 
+ * kept, and drawn again after the new prompt next time. The line is in the
+ * editor's buffer and only good until the next call.
+ *
+ * ****************************************************************************/
+ssize_t editLine(struct inputReader* input, char** line){
+	struct lineEditor* ed = &editor;
+	struct termios raw = shellModes;
+	struct winsize size;          // of the terminal
+	ssize_t result = -2;          // what we return, -2 until we know
+	bool wasTab;                  // the key before was a tab?
+	bool finished = false;        // entered, ^C'd or ^D'd
+	size_t start;                 // start of the word ^W kills
+	char byte;                    // a key typed
+	int key;
+
+	raw.c_iflag &= ~(ICRNL | INLCR | IXON | ISTRIP);
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(input->fd, TCSADRAIN, &raw);
+	ed->columns = ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && 
+		size.ws_col > 0 ? size.ws_col : 80;
+	if (ed->line == NULL){
+		growText(&ed->line, &ed->size, 256, "realloc - line editor");
+		ed->line[0] = '\0';
+		ed->histPos = -1;
+	}
+	// there's a prompt up, anything printed goes below it
+	promptShown = promptShown || promptText[0] != '\0';
+	ed->dirty = true;
+
+	while (result == -2){
+		key = readKey(input);
+		if (key == -1){
+			result = -1;
+			break;
+		}
+		wasTab = ed->lastTab;
+		ed->lastTab = false;
+		if (ed->searching && searchKey(ed, key)){
+			continue;
+		}
+		switch (key){
+			case '\r':
+			case '\n':
+				ed->cursor = ed->len;
+				refreshLine(ed);
+				editOut(ed, "\n", 1);
+				result = ed->len;
+				finished = true;
+				break;
+			case 1:
+			case KEY_HOME:
+				ed->cursor = 0;
+				break;
+			case 5:
+			case KEY_END:
+				ed->cursor = ed->len;
+				break;
+			case 2:
+			case KEY_LEFT:
+				ed->cursor = prevChar(ed, ed->cursor);
+				break;
+			case 6:
+			case KEY_RIGHT:
+				ed->cursor = nextChar(ed, ed->cursor);
+				break;
+			case KEY_META | 'b':
+				ed->cursor = wordLeft(ed, ed->cursor);
+				break;
+			case KEY_META | 'f':
+				ed->cursor = wordRight(ed, ed->cursor);
+				break;
+			case 4:
+				if (ed->len == 0){
+					input->eof = true;
+					errno = 0;
+					result = -1;
+					finished = true;
+					break;
+				}
+				// fall through, ^D deletes like the delete key
+			case KEY_DELETE:
+				deleteText(ed, ed->cursor, nextChar(ed, ed->cursor));
+				break;
+			case 8:
+			case 127:
+				deleteText(ed, prevChar(ed, ed->cursor), ed->cursor);
+				break;
+			case 11:
+				killText(ed, ed->cursor, ed->len);
+				break;
+			case 21:
+				killText(ed, 0, ed->cursor);
+				break;
+			case 23:
+				for (start = ed->cursor; start > 0 && 
+						isspace((unsigned char)ed->line[start - 1]); 
+						start--);
+				for (; start > 0 && 
+						!isspace((unsigned char)ed->line[start - 1]); 
+						start--);
+				killText(ed, start, ed->cursor);
+				break;
+			case KEY_META | 127:
+			case KEY_META | 8:
+				killText(ed, wordLeft(ed, ed->cursor), ed->cursor);
+				break;
+			case KEY_META | 'd':
+				killText(ed, ed->cursor, wordRight(ed, ed->cursor));
+				break;
+			case 25:
+				insertText(ed, ed->yank, ed->yankLen);
+				break;
+			case 12:
+				editOut(ed, "\x1b[H\x1b[2J", 7);
+				break;
+			case 16:
+			case KEY_UP:
+				historyMove(ed, -1);
+				break;
+			case 14:
+			case KEY_DOWN:
+				historyMove(ed, 1);
+				break;
+			case 18:
+				if (ed->histPos == -1){
+					growText(&ed->saved, &ed->savedSize, ed->len + 1, 
+							"realloc - line editor");
+					memcpy(ed->saved, ed->line, ed->len);
+					ed->savedLen = ed->len;
+				}
+				if (historySync()){
+					ed->searching = true;
+					ed->searchLen = 0;
+					ed->searchPos = history.count;
+					searchHistory(ed, ed->searchPos);
+				}
+				break;
+			case '\t':
+				ed->lastTab = wasTab;
+				completeWord(ed);
+				ed->lastTab = true;
+				break;
+			case 3:
+				ed->cursor = ed->len;
+				refreshLine(ed);
+				editOut(ed, "^C\n", 3);
+				errno = EINTR;
+				result = -1;
+				finished = true;
+				break;
+			default:
+				if ((key >= ' ' && key < 127) || (key >= 0x80 && key < 256)){
+					byte = key;
+					insertText(ed, &byte, 1);
+				}
+		}
+		ed->dirty = true;
+	}
+
+	// done with this line, the next starts from scratch. A line that was 
+	// interrupted is kept
+	if (finished){
+		*line = ed->line;
+		ed->line[ed->len] = '\0';
+		ed->len = ed->cursor = ed->offset = 0;
+		ed->histPos = -1;
+		ed->searching = false;
+		promptShown = false;
+		promptText = "";
+	}
+	editFlush(ed);
+	tcsetattr(input->fd, TCSADRAIN, &shellModes);
+	return result;
+}
+
+
+
+
+/*******************************************************************************
+ * reapPid
+ * records that a process we were tracking has finished, and the resources it
+ * used. Once every process of its job has been reaped the job's completion 
+ * information is printed, the job is accounted for by recordCommand and it
+ * is removed from the table. Pids we aren't tracking are ignored.
+ *
+ * ****************************************************************************/
+void reapPid(struct jobTable* jobs, pid_t pid, int childExitMethod,
+		struct rusage* usage){
+	struct job* job;    // job the reaped process belongs to
+
+	// only report the ones we launched in the background
+	job = findJob(jobs, pid);
+	if (job == NULL){
+		return;
+	}
+	// the last process of a pipeline decides how the job exited
+	if (pid == job->pid){
+		job->status = childExitMethod;
+	}
+	addUsage(&job->usage, usage);
+	removePid(jobs, pid);
+	// wait until every process of the job is done
+	if (job->running > 0){
+		return;
+	}
+	recordCommand(job->cmdLine, job->pid, true, job->status, &job->start,
+			&job->usage);
+	jobs->doneId = job->id;
+	jobs->doneStatus = job->status;
+	clearPrompt();
+	// check if process exited
+	if(WIFEXITED(job->status)){
+		printf("background pid %d is done: exit value %d\n", (int)job->pid, WEXITSTATUS(job->status));
+		flushOutput();
+	}
+	// or if it was terminated by a signal
+	if (WIFSIGNALED(job->status)){
+		int sigStatus = WTERMSIG(job->status);
+		printf("background pid %d is done: terminated by signal %d\n", (int)job->pid, sigStatus);
+		flushOutput();
+	}
+	// free up a slot for the parallel builtin, unless the user ^C'd it
+	if (job->parallel){
+		jobs->parallelRunning--;
+		jobs->parallelFailed |= job->status != 0;
+		if (WIFSIGNALED(job->status) && 
+				WTERMSIG(job->status) == SIGINT){
+			jobs->parallelStop = true;
+		}
+	}
+	// remove the finished job from the job table
+	removeJob(jobs, job);
+}
+
+
+
+
+/*******************************************************************************
+ * reapEvent
+ * handles what wait4 reported about one of our children: a stopped or 
+ * continued process changes the state of its job (a stop is announced once 
+ * per job), and one that finished is handed to reapPid.
+ *
+ * ****************************************************************************/
+void reapEvent(struct jobTable* jobs, pid_t pid, int childExitMethod,
+		struct rusage* usage){
+	struct job* job;    // job the process belongs to
+
+	if (!WIFSTOPPED(childExitMethod) && !WIFCONTINUED(childExitMethod)){
+		reapPid(jobs, pid, childExitMethod, usage);
+		return;
+	}
+	job = findJob(jobs, pid);
+	if (job == NULL){
+		return;
+	}
+	if (WIFCONTINUED(childExitMethod)){
+		job->state = JOB_RUNNING;
+	}
+	else if (job->state != JOB_STOPPED){
+		job->state = JOB_STOPPED;
+		clearPrompt();
+		// laid out like a line of jobs
+		printf("[%d]+  %-22s %s\n", job->id, "Stopped", job->cmdLine);
+		flushOutput();
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * reapChildren
+ * picks up any SIGCHLD waiting on the signalfd and if any children finished
+ * since last time reaps them all with wait4(-1), handing each to reapEvent.
+ * Background jobs that were stopped or continued are noticed here too. With
+ * no jobs running there is nothing to reap and no system calls are made at 
+ * all, which keeps it cheap enough to call after every command of a loop.
+ * Returns true if a SIGINT was read along the way, for the caller to act on.
+ *
+ * ****************************************************************************/
+bool reapChildren(struct jobTable* jobs){
+	//printf("in reapChildren\n");
+	int childExitMethod; // how the reaped process exited
+	pid_t pid;          // holds return from wait4 call
+	struct rusage usage; // resources the reaped process used
+	uint64_t start;      // for the reap timer
+	bool interrupt;      // a SIGINT was read
+
+	if (jobs->count == 0){
+		return false;
+	}
+	start = phaseStart(PHASE_REAP);
+	interrupt = readSignals();
+	if (!childWoken){
+		phaseEnd(PHASE_REAP, start);
+		return interrupt;
+	}
+	// cleared first, so a SIGCHLD from here on sets it again
+	childWoken = false;
+	// reap every finished child, one wait4 call per child
+	while ((pid = wait4(-1, &childExitMethod, 
+			WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0){
+		PROBE(child__reap, pid, childExitMethod);
+		reapEvent(jobs, pid, childExitMethod, &usage);
+	}
+	phaseEnd(PHASE_REAP, start);
+	return interrupt;
+}
+
+
+
+
+/*******************************************************************************
+ * continueJob
+ * sends SIGCONT to every process of a stopped job and marks it running.
+ *
+ * ****************************************************************************/
+void continueJob(struct job* job){
+	int i;
+	if (job->pgid){
+		kill(-job->pgid, SIGCONT);
+	}
+	else {
+		for (i = 0; i < job->procCount; i++){
+			kill(job->pids[i], SIGCONT);
+		}
+	}
+	job->state = JOB_RUNNING;
+}
+
+
+
+
+/*******************************************************************************
+ * waitJob
+ * waits for every process of a foreground job to finish, or for the job to
+ * be stopped. A job with its own process group is waited for as a group, so
+ * no other child is reaped by mistake. Returns how the job exited, or the 
+ * stop status if it was stopped. Without job control a stop isn't ours to
+ * deal with (a subshell is stopped and continued along with its command),
+ * so we keep waiting.
+ *
+ * ****************************************************************************/
+int waitJob(struct jobTable* jobs, struct job* job){
+	int status;              // what wait4 reported
+	pid_t pid;               // about which process
+	struct rusage usage;     // resources it used
+	int i = 0;               // next process to wait for, without a group
+	int options = jobControl ? WUNTRACED : 0;    // report stops?
+
+	while (job->running > 0){
+		if (job->pgid){
+			pid = wait4(-job->pgid, &status, options, &usage);
+		}
+		else {
+			while (findJob(jobs, job->pids[i]) != job){
+				i++;
+			}
+			pid = wait4(job->pids[i], &status, options, &usage);
+		}
+		// SIGCHLD is read from the signalfd, but try again if interrupted
+		if (pid == -1 && errno == EINTR){
+			continue;
+		}
+		if (pid == -1){
+			break;
+		}
+		if (WIFSTOPPED(status)){
+			// it read the terminal before we handed it over
+			if ((WSTOPSIG(status) == SIGTTIN || 
+					WSTOPSIG(status) == SIGTTOU) &&
+					jobControl && job->pgid && 
+					tcgetpgrp(0) == job->pgid){
+				kill(pid, SIGCONT);
+				continue;
+			}
+			job->state = JOB_STOPPED;
+			return status;
+		}
+		// the last stage is the one 'status' reports
+		if (pid == job->pid){
+			job->status = status;
+		}
+		addUsage(&job->usage, &usage);
+		removePid(jobs, pid);
+	}
+	job->state = JOB_DONE;
+	return job->status;
+}
+
+
+
+
+bool relayPipes(struct relay* relays, int relayCount, struct job* job);
+
+/*******************************************************************************
+ * runForeground
+ * runs a job in the foreground until it finishes or is stopped. Under job 
+ * control the job is given the terminal (and the terminal modes it had, if 
+ * it is being resumed) and the shell takes it back afterwards. The data of 
+ * its '|>' links is moved first, until they're done or it is stopped. A 
+ * stopped job stays in the job table, a finished one is accounted for and 
+ * removed. Returns how the job exited, or its stop status.
+ *
+ * ****************************************************************************/
+int runForeground(struct jobTable* jobs, struct job* job, bool resume){
+	bool tty = jobControl && job->pgid;    // hand the terminal over?
+	int status;                            // how it exited
+
+	if (tty){
+		tcsetpgrp(0, job->pgid);
+		if (resume && job->savedModes){
+			tcsetattr(0, TCSADRAIN, &job->modes);
+		}
+	}
+	if (resume){
+		continueJob(job);
+	}
+	if (job->relayCount > 0 && 
+			relayPipes(job->relays, job->relayCount, job)){
+		free(job->relays);
+		job->relays = NULL;
+		job->relayCount = 0;
+	}
+	status = waitJob(jobs, job);
+	if (tty){
+		tcsetpgrp(0, shellPgid);
+		if (job->state == JOB_STOPPED){
+			tcgetattr(0, &job->modes);
+			job->savedModes = true;
+		}
+		tcsetattr(0, TCSADRAIN, &shellModes);
+	}
+
+	if (job->state == JOB_STOPPED){
+		// laid out like a line of jobs
+		printf("\n[%d]+  %-22s %s\n", job->id, "Stopped", 
+				job->cmdLine);
+		flushOutput();
+		return status;
+	}
+	recordCommand(job->cmdLine, job->pid, false, status, &job->start, 
+			&job->usage);
+	// check if process terminated by signal
+	if (WIFSIGNALED(status) != 0){
+		int sigStatus = WTERMSIG(status);
+		printf("terminated by signal %d\n", sigStatus);
+		flushOutput();
+	}
+	removeJob(jobs, job);
+	return status;
+}
+
+
+
+
+/*******************************************************************************
+ * forknExec
+ * forks off a new process for one stage of a pipeline and then executes the 
+ * proper command. Returns the pid of the new process to the parent, or -1
+ * (having said why) if there isn't one, say because we're out of processes.
+ * The process is launched with spawnAndExec when possible, the fork path is
+ * kept as the fallback for anything spawn can't do, like the limit builtin's
+ * limits or running a builtin (or if SMALLSH_SPAWN=0).
+ * The process is put in process group pgid (0 starts a new group, -1 leaves
+ * it in the shell's), and a foreground one under job control is given the 
+ * terminal.
+ *
+ * ****************************************************************************/
+pid_t forkAndExec(struct stage* stage, bool runBG, pid_t pgid,
+		struct sigaction* normal_action){
+	//printf("in forkAndExec\n");
+	pid_t spawnPid = -5;     // holds spawned process id
+	int ret = -1;            // result of spawnAndExec
+	int argCount = 0;        // words of a builtin
+	uint64_t start = phaseStart(PHASE_LAUNCH);
+
+	// what we printed has to come out before anything the child prints,
+	// and a forked child mustn't inherit it still in the buffer
+	fflush(stdout);
+	// the shell's environment, gathered again only if it changed
+	if (stage->envp == NULL){
+		stage->envp = exportedEnv();
+	}
+
+	// try the cheap posix_spawn path first. If it can't launch the command
+	// fall back to fork so the child can report exactly what went wrong
+	if (useSpawn && stage->limits == NULL && stage->builtin == NULL){
+		ret = spawnAndExec(stage, runBG, pgid, &spawnPid);
+	}
+	if (ret != 0){
+		// a cached path whose file has gone is looked up again next 
+		// time, and the child searches PATH itself this time. A '<'
+		// file that isn't there is an ENOENT too, the path is kept
+		if (ret == ENOENT && stage->path && 
+				access(stage->path, X_OK) != 0){
+			forgetPath(stage->argv[0]);
+			stage->path = NULL;
+		}
+		// fork into a child and parent process
+		spawnPid = fork();
+	}
+
+	// do different things for parent and child
+	switch(spawnPid){
+		// if there was an error forking
+		case -1:
+			perror("Hull Breach! error forking...");
+			phaseEnd(PHASE_LAUNCH, start);
+			break;
+	
+		// child process
+		case 0:
+			//printf("in child process\n");
+			// join the job's process group, and take the terminal
+			// if it's a foreground job. SIGTTOU is still ignored
+			if (pgid != -1){
+				setpgid(0, pgid);
+				if (!runBG && jobControl){
+					tcsetpgrp(0, getpgrp());
+				}
+			}
+			// hook up to the rest of the pipeline
+			if (stage->pipeIn != -1){
+				dup2(stage->pipeIn, 0);
+			}
+			if (stage->pipeOut != -1){
+				dup2(stage->pipeOut, 1);
+			}
+			// check if we are re-directing input/output
+			checkReDirect(stage);
+
+			// change foreground proccs to accept SIGINT signals
+			// if user doesnt want to run in bg or cant run in bg,
+			// and put back the job control signals
+			if (!runBG || jobControl){			
+				sigaction(SIGINT, normal_action, NULL);
+			}
+			sigaction(SIGTSTP, normal_action, NULL);
+			sigaction(SIGTTIN, normal_action, NULL);
+			sigaction(SIGTTOU, normal_action, NULL);
+			sigprocmask(SIG_SETMASK, &childMask, NULL);
+			environ = stage->envp;
+			// the limit builtin's limits, and the job's cgroup
+			if (stage->limits && 
+					!applyLimits(stage->limits, stage->cgroup)){
+				exit(1);
+			}
+
+			// a builtin in a pipeline runs here, on a copy of 
+			// the shell
+			if (stage->builtin){
+				while (stage->argv[argCount]){
+					argCount++;
+				}
+				ret = stage->builtin->run(stage->sh, stage->argv,
+						argCount);
+				fflush(stdout);
+				_exit(ret);
+			}
+
+			// have child execute command, searching PATH only if 
+			// the resolved file didn't work
+			if (stage->path){
+				execv(stage->path, stage->argv);
+			}
+			execvp(stage->argv[0], stage->argv);
+			
+			// if we get here there was a problem with execvp
+			perror(stage->argv[0]);
+			// terminate the child
+			exit(1);
+			break;
+
+		// parent process
+		default:
+			//printf("in parent Process\n");
+			// also set the group from here so it exists before we
+			// return, whichever of us runs first
+			if (pgid != -1){
+				setpgid(spawnPid, pgid);
+			}
+			phaseEnd(PHASE_LAUNCH, start);
+			PROBE(command__launch, spawnPid, stage->argv[0], ret == 0);
+			break;
+	}
+	return spawnPid;
+}
+
+
+
+
+/*******************************************************************************
+ * relayPipes
+ * moves the data of every '|>' link of a foreground job from the stage 
+ * before it to the stage after it with splice, so nothing is copied through
+ * user space, and counts the bytes as they go by. Returns true once every 
+ * link has hit end of file or lost its reader, then prints the throughput of
+ * each link to stderr. The signalfd is polled too, so a job stopped with ^Z
+ * doesn't leave us waiting on links that will never move: we return false 
+ * and waitJob collects the stop. Its links are kept, for when it is resumed.
+ *
+ * ****************************************************************************/
+bool relayPipes(struct relay* relays, int relayCount, struct job* job){
+	struct pollfd* fds;               // each link's wait, then signals
+	struct sigaction ignore = {0};    // to ignore SIGPIPE while relaying
+	struct sigaction old;             // SIGPIPE action to restore
+	struct timespec start, end;       // for the throughput
+	double seconds;                   // how long we relayed for
+	siginfo_t info;                   // a stopped stage
+	bool stopped = false;             // was the job stopped?
+	int open = 0;                     // links still moving data
+	ssize_t moved;                    // bytes moved by one splice
+	int i;
+
+	fds = calloc(relayCount + 1, sizeof(struct pollfd));
+	if (fds == NULL){
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < relayCount; i++){
+		open += relays[i].from != -1;
+	}
+	// a stop is only ours to notice under job control
+	fds[relayCount].fd = jobControl && job->pgid ? signalFd : -1;
+	fds[relayCount].events = POLLIN;
+
+	// if a stage exits early we want EPIPE, not to be killed by SIGPIPE
+	ignore.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ignore, &old);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (open > 0){
+		// wait for input, or for room to write if the last splice 
+		// couldn't write. Finished links are skipped by poll
+		for (i = 0; i < relayCount; i++){
+			if (relays[i].from == -1){
+				fds[i].fd = -1;
+			}
+			else if (relays[i].full){
+				fds[i].fd = relays[i].to;
+				fds[i].events = POLLOUT;
+			}
+			else {
+				fds[i].fd = relays[i].from;
+				fds[i].events = POLLIN;
+			}
+		}
+		if (poll(fds, relayCount + 1, -1) == -1){
+			if (errno == EINTR){
+				continue;
+			}
+			perror("poll - relay");
+			break;
+		}
+
+		// a stage finished or stopped. A stop is looked at without
+		// being collected, so waitJob still sees it
+		if (fds[relayCount].revents){
+			readSignals();
+			info.si_pid = 0;
+			if (waitid(P_PGID, job->pgid, &info, WSTOPPED | WNOHANG | 
+					WNOWAIT) == 0 && info.si_pid != 0){
+				// it read the terminal before it was handed over,
+				// the way waitJob lets it go on
+				if ((info.si_status == SIGTTIN || 
+						info.si_status == SIGTTOU) &&
+						tcgetpgrp(0) == job->pgid){
+					waitid(P_PID, info.si_pid, &info, 
+							WSTOPPED | WNOHANG);
+					kill(info.si_pid, SIGCONT);
+				}
+				else {
+					stopped = true;
+					break;
+				}
+			}
+		}
+
+		for (i = 0; i < relayCount; i++){
+			if (relays[i].from == -1 || fds[i].revents == 0){
+				continue;
+			}
+			moved = splice(relays[i].from, NULL, relays[i].to, NULL,
+					RELAYCHUNK, 
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (moved > 0){
+				relays[i].bytes += moved;
+				relays[i].full = false;
+			}
+			// the side we just polled for is ready, so EAGAIN means
+			// the other side isn't. Wait on that side next time
+			else if (moved == -1 && errno == EAGAIN){
+				relays[i].full = !relays[i].full;
+			}
+			// end of file, or the next stage went away
+			else {
+				close(relays[i].from);
+				close(relays[i].to);
+				relays[i].from = -1;
+				open--;
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sigaction(SIGPIPE, &old, NULL);
+	free(fds);
+	seconds = (end.tv_sec - start.tv_sec) + 
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	for (i = 0; i < relayCount; i++){
+		relays[i].seconds += seconds;
+	}
+	if (stopped){
+		return false;
+	}
+	for (i = 0; i < relayCount; i++){
+		seconds = relays[i].seconds;
+		fprintf(stderr, "|> link %d: %lld bytes in %.3f s (%.1f MB/s)\n",
+				i + 1, relays[i].bytes, seconds, 
+				seconds > 0 ? relays[i].bytes / seconds / 1e6 : 0);
+	}
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * isPipe
+ * checks if a command is one of the pipe symbols, '|' or '|>'.
+ *
+ * ****************************************************************************/
+bool isPipe(char* userCmd){
+	return isOperator(userCmd, "|") || isOperator(userCmd, "|>");
+}
+
+
+
+
+/*******************************************************************************
+ * abandonStages
+ * cleans up after a pipeline that couldn't be launched in full: the first 
+ * launched stages are killed and reaped, and the pipe ends the shell still
+ * holds are closed. failed is the stage that didn't start, prevRead the read
+ * end meant for the stage after it, and cgroup the job's cgroup, if any.
+ *
+ * ****************************************************************************/
+void abandonStages(struct stage* failed, pid_t* pids, int launched, 
+		int prevRead, struct relay* relays, int relayCount, char* cgroup){
+	int i;
+
+	if (failed->pipeIn != -1){
+		close(failed->pipeIn);
+	}
+	if (failed->pipeOut != -1){
+		close(failed->pipeOut);
+	}
+	if (prevRead != -1){
+		close(prevRead);
+	}
+	for (i = 0; i < relayCount; i++){
+		close(relays[i].from);
+		close(relays[i].to);
+	}
+	for (i = 0; i < launched; i++){
+		kill(pids[i], SIGKILL);
+	}
+	for (i = 0; i < launched; i++){
+		waitpid(pids[i], NULL, 0);
+	}
+	if (cgroup){
+		unlinkat(cgroups.dirFd, cgroup, AT_REMOVEDIR);
+		free(cgroup);
+	}
+}
+
+
+
+
+const struct builtin* findBuiltin(const char* name);
+
+/*******************************************************************************
+ * runPipeline
+ * splits the user commands into stages at each '|' or '|>' and launches one 
+ * process per stage, connected by pipes. On a '|>' link the shell moves the 
+ * data itself (see relayPipes). The job is added to the job table. A 
+ * background job's stages share a new process group and user access to shell
+ * will instantly return. Under job control a foreground job gets a process 
+ * group of its own too, and the terminal, and we wait until every stage is 
+ * done or the job is stopped. The last stage's exit is what 'status' reports.
+ * runFlags is RUN_BG if the user asked for a background job. RUN_PARALLEL 
+ * jobs (see runParallel) are added to the job table without being announced,
+ * keep the shell's stdout and process group, and read from /dev/null.
+ * Both kinds get the limit builtin's background limits, and limits (from 
+ * limit's options in front of the command, or NULL) on top of them. A stage
+ * naming a builtin that doesn't stand in for a utility runs it in its forked
+ * process, on a copy of sh, so  history | grep x  works.
+ *
+ * ****************************************************************************/
+void runPipeline(struct shell* sh, char** userCmds, int cmdCount, 
+		int* childExitMethod, int runFlags, struct limits* limits, 
+		struct jobTable* jobs, char* cmdLine,
+		struct arena* arena, struct sigaction* normal_action){
+	struct stage* stages;     // the commands between the pipes
+	bool* metered;            // is the link after stage i a '|>'?
+	pid_t* pids;              // pid of each stage
+	struct relay* relays;     // links the shell is moving data for
+	int stageCount = 0;       // how many stages
+	int relayCount = 0;       // how many relays
+	int start = 0;            // first command of the current stage
+	int prevRead = -1;        // read end of the pipe into the next stage
+	int fds[2];               // new pipe
+	int relayFds[2];          // second pipe of a '|>' link
+	bool parallel = runFlags & RUN_PARALLEL;   // started by parallel?
+	bool runBG = (runFlags & RUN_BG) && canRunBG && !parallel;  // in bg?
+	pid_t pgid;               // process group of the job, -1 for the shell's
+	struct job* job;          // the job once it's in the job table
+	struct timespec launched; // when the first stage was launched
+	int argCount;             // commands of a stage
+	int assigns;              // VAR=x words at the start of a stage
+	struct limits jobLimits = {0};   // the limits every stage gets
+	char* cgroup = NULL;      // the job's cgroup, if it gets one
+	int i;
+
+	pgid = runBG || (jobControl && !parallel) ? 0 : -1;
+
+	stages = arenaAlloc(arena, (cmdCount + 1) * sizeof(struct stage));
+	metered = arenaAlloc(arena, (cmdCount + 1) * sizeof(bool));
+	pids = arenaAlloc(arena, (cmdCount + 1) * sizeof(pid_t));
+	relays = arenaAlloc(arena, (cmdCount + 1) * sizeof(struct relay));
+
+	// split the commands into stages
+	for (i = 0; i <= cmdCount; i++){
+		// a stage ends at a pipe symbol or the end of the commands
+		if (i < cmdCount && !isPipe(userCmds[i])){
+			continue;
+		}
+		if (i < cmdCount){
+			// the shell can't sit between the stages of a bg job
+			metered[stageCount] = !runBG && !parallel &&
+				isOperator(userCmds[i], "|>");
+			// NULL it out so the stage's argv ends here
+			userCmds[i] = NULL;
+		}
+		stages[stageCount].argv = &userCmds[start];
+		// pull the re-directs out of the stage before launching
+		argCount = i - start;
+		stages[stageCount].redirectCount = findReDirect(
+				&userCmds[start], &argCount, arena,
+				&stages[stageCount].redirects);
+		if (stages[stageCount].redirectCount == -1){
+			jobs->parallelFailed |= parallel;
+			*childExitMethod = W_EXITCODE(2, 0);
+			return;
+		}
+		// VAR=x words before the command are for its environment
+		assigns = countAssignments(stages[stageCount].argv, argCount);
+		stages[stageCount].envp = assigns ? commandEnv(
+				stages[stageCount].argv, assigns, arena) : NULL;
+		stages[stageCount].argv += assigns;
+		// every stage needs a command
+		if (stages[stageCount].argv[0] == NULL){
+			printf("syntax error near '|'\n");
+			flushOutput();
+			jobs->parallelFailed |= parallel;
+			*childExitMethod = W_EXITCODE(2, 0);
+			return;
+		}
+		stageCount++;
+		start = i + 1;
+	}
+
+	// background jobs get the background limits, the command's own win
+	if (runBG || parallel){
+		jobLimits = bgLimits;
+	}
+	if (limits){
+		mergeLimits(&jobLimits, limits);
+	}
+	cgroup = jobCgroup(&jobLimits);
+
+	// launch each stage, creating the pipe to the next one as we go
+	clock_gettime(CLOCK_MONOTONIC, &launched);
+	for (i = 0; i < stageCount; i++){
+		stages[i].pipeIn = prevRead;
+		stages[i].pipeOut = -1;
+		// a builtin runs in the child as it is, a utility it stands
+		// in for is run instead
+		stages[i].builtin = findBuiltin(stages[i].argv[0]);
+		if (stages[i].builtin && 
+				(stages[i].builtin->flags & BUILTIN_FAST)){
+			stages[i].builtin = NULL;
+		}
+		stages[i].sh = sh;
+		// looked up now, after any earlier stage's launch has updated
+		// the path cache
+		stages[i].path = stages[i].builtin ? NULL : 
+			findCommand(stages[i].argv[0], arena);
+		prevRead = -1;
+		// ends of a bg job that aren't piped use /dev/null unless 
+		// re-directed, parallel jobs only get it for their input
+		stages[i].nullIn = (runBG || parallel) && i == 0;
+		stages[i].nullOut = runBG && i == stageCount - 1;
+		stages[i].limits = jobLimits.set ? &jobLimits : NULL;
+		stages[i].cgroup = cgroup;
+		if (i < stageCount - 1){
+			// close on exec so only the dup2'd copies reach a stage
+			if (pipe2(fds, O_CLOEXEC) == -1){
+				perror("pipe2");
+				break;
+			}
+			stages[i].pipeOut = fds[1];
+			prevRead = fds[0];
+			// for a '|>' the shell reads this pipe and writes 
+			// the next stage's input pipe
+			if (metered[i]){
+				if (pipe2(relayFds, O_CLOEXEC) == -1){
+					perror("pipe2");
+					break;
+				}
+				relays[relayCount] = (struct relay){0};
+				relays[relayCount].from = fds[0];
+				relays[relayCount].to = relayFds[1];
+				fcntl(fds[0], F_SETFL, O_NONBLOCK);
+				fcntl(relayFds[1], F_SETFL, O_NONBLOCK);
+				// bigger pipes mean fewer splices, ok if refused
+				fcntl(fds[0], F_SETPIPE_SZ, RELAYCHUNK);
+				fcntl(relayFds[1], F_SETPIPE_SZ, RELAYCHUNK);
+				relayCount++;
+				prevRead = relayFds[0];
+			}
+		}
+		pids[i] = forkAndExec(&stages[i], runBG, pgid, normal_action);
+		if (pids[i] == -1){
+			break;
+		}
+		// the first stage leads the job's process group. A foreground
+		// job gets the terminal from here too, in case the child 
+		// hasn't taken it yet
+		if (pgid == 0){
+			pgid = pids[i];
+			if (!runBG){
+				tcsetpgrp(0, pgid);
+			}
+		}
+		// the stage has its own copies of the pipe ends now
+		if (stages[i].pipeIn != -1){
+			close(stages[i].pipeIn);
+		}
+		if (stages[i].pipeOut != -1){
+			close(stages[i].pipeOut);
+		}
+	}
+	// out of pipes or processes, the shell goes on without the job
+	if (i < stageCount){
+		abandonStages(stages + i, pids, i, prevRead, relays, relayCount,
+				cgroup);
+		if (!runBG && pgid > 0){
+			tcsetpgrp(0, shellPgid);
+		}
+		jobs->parallelFailed |= parallel;
+		*childExitMethod = W_EXITCODE(1, 0);
+		return;
+	}
+
+	job = addJob(jobs, pids, stageCount, pgid > 0 ? pgid : 0, cmdLine);
+	job->start = launched;
+	job->cgroup = cgroup;
+	// runForeground moves the data for any '|>' links, they last as long
+	// as the job does
+	if (relayCount > 0){
+		job->relays = malloc(relayCount * sizeof(struct relay));
+		if (job->relays == NULL){
+			perror("malloc");
+			exit(1);
+		}
+		memcpy(job->relays, relays, relayCount * sizeof(struct relay));
+		job->relayCount = relayCount;
+	}
+	// if the user wants and can run the job in the bg
+	if (runBG){
+		printf("background pid is %d\n", pids[stageCount - 1]);
+		flushOutput();
+		jobs->lastPid = job->pid;
+	}
+	// parallel's jobs are tracked the same way, it does the waiting
+	else if (parallel){
+		job->parallel = true;
+		jobs->parallelRunning++;
+		jobs->lastPid = job->pid;
+	}
+	// else we are waiting for the foreground job
+	else {
+		*childExitMethod = runForeground(jobs, job, false);
+	}
+}
+
+
+
+
+struct node* parseCommands(struct shell* sh, char* line, size_t len);
+void runSubshell(struct shell* sh, struct node* node, int runFlags);
+
+/*******************************************************************************
+ * runParallel
+ * the parallel builtin:  parallel [-j N] [file]
+ * reads commands one per line from file (or the shell's own input if no file
+ * is given) and runs them with exactly N of them running at once, until the
+ * commands run out. Each line is parsed like any other: a pipeline is run as
+ * it is, and anything more (a list, a loop, a group) in a copy of the shell,
+ * each of them one job. Without -j, N comes from MAXJOBS or else is the number 
+ * of cpus. Whenever all N are running we block in wait4, and a slot is 
+ * refilled as soon as the reaping path reports a job done, in the same
+ * format as any other background job. If a job is interrupted with ^C no 
+ * new jobs are started. Returns 0 if every job succeeded, 1 if one didn't,
+ * a line had a syntax error or the file can't be read, and 2 for bad options.
+ *
+ * ****************************************************************************/
+int runParallel(struct shell* sh, char** userCmds, int cmdCount){
+	struct jobTable* jobs = &sh->jobs;      // where its jobs go
+	struct arena* arena = &sh->arena;       // memory for parsing
+	struct inputReader* input = sh->input;  // the shell's input
+	int maxJobs = 0;              // how many jobs to run at once
+	char* jobsArg;                // -j's value
+	char* end;                    // where its digits stop
+	char* maxEnv;                 // the MAXJOBS variable
+	char* fileName = NULL;        // file of commands, if given
+	struct inputReader fileInput; // reads fileName
+	struct inputReader* from = input;   // where commands are read from
+	char* line;                   // one command, in the input buffer
+	ssize_t len;                  // length of line
+	char* cmdLine;                // line as read, for the job table
+	struct node* list;            // the line parsed
+	struct node wrapper = {0};    // runs a list in a subshell
+	char** lineCmds;              // a pipeline's words, to expand
+	bool wantRunBG;               // a trailing '&' changes nothing
+	struct arenaMark mark;        // to free each line's parsing
+	int status;                   // how a reaped child exited
+	pid_t pid;                    // reaped child
+	struct rusage usage;          // resources it used
+	int fd;                       // fileName opened
+	int i;
+
+	// parallel [-j N] [file]
+	for (i = 1; i < cmdCount; i++){
+		if (strncmp(userCmds[i], "-j", 2) == 0){
+			jobsArg = userCmds[i][2] ? userCmds[i] + 2 :
+				i + 1 < cmdCount ? userCmds[++i] : NULL;
+			if (jobsArg == NULL){
+				printf("parallel: -j needs a value\n");
+				flushOutput();
+				return 2;
+			}
+			errno = 0;
+			maxJobs = strtol(jobsArg, &end, 10);
+			if (end == jobsArg || *end != '\0' || errno != 0 || 
+					maxJobs < 1){
+				printf("parallel: -j %s: bad value\n", jobsArg);
+				flushOutput();
+				return 2;
+			}
+		}
+		else if (fileName == NULL){
+			fileName = userCmds[i];
+		}
+		else {
+			printf("parallel: usage: parallel [-j N] [file]\n");
+			flushOutput();
+			return 2;
+		}
+	}
+	// no -j, use MAXJOBS or one job per cpu
+	if (maxJobs <= 0 && (maxEnv = getVar("MAXJOBS"))){
+		maxJobs = atoi(maxEnv);
+	}
+	if (maxJobs <= 0){
+		maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (maxJobs <= 0){
+		maxJobs = 1;
+	}
+
+	if (fileName){
+		fd = open(fileName, O_RDONLY | O_CLOEXEC);
+		if (fd == -1){
+			printf("cannot open %s for input\n", fileName);
+			flushOutput();
+			return 1;
+		}
+		initInput(&fileInput, fd, NULL);
+		from = &fileInput;
+	}
+
+	jobs->parallelStop = false;
+	jobs->parallelFailed = false;
+	while (1){
+		// start jobs until every slot is full or we run out
+		while (jobs->parallelRunning < maxJobs && !jobs->parallelStop){
+			len = readLine(from, &line);
+			if (len == -1 && from->eof){
+				break;
+			}
+			// interrupted, report anything that finished
+			if (len == -1){
+				reapChildren(jobs);
+				continue;
+			}
+			// skip blank lines and comments
+			if (line[strspn(line, " \t")] == '\0' || line[0] == '#'){
+				continue;
+			}
+			// parse it like any other command, then free it. An
+			// unfinished if or loop goes on in the same file
+			mark = arenaSave(arena);
+			cmdLine = arenaCopy(arena, line, len);
+			sh->input = from;
+			list = parseCommands(sh, line, len);
+			sh->input = input;
+			if (list == NULL){
+				jobs->parallelFailed = true;
+			}
+			else if (list->type == NODE_COMMAND && !list->next){
+				lineCmds = arenaAlloc(arena, 
+						(list->wordCount + 1) * 
+						sizeof(char*));
+				memcpy(lineCmds, list->words, 
+						list->wordCount * sizeof(char*));
+				lineCmds[list->wordCount] = NULL;
+				expandWords(lineCmds, list->wordCount, 
+						sh->status, 
+						jobs->lastPid, arena);
+				checkIfBG(lineCmds, list->wordCount, 
+						&wantRunBG);
+				runPipeline(sh, lineCmds, list->wordCount, 
+						&status,
+						RUN_PARALLEL, NULL, jobs, cmdLine,
+						arena, sh->normal_action);
+			}
+			else if (list->type == NODE_SUBSHELL && !list->next){
+				runSubshell(sh, list, RUN_PARALLEL);
+			}
+			else {
+				wrapper.type = NODE_SUBSHELL;
+				wrapper.body = list;
+				wrapper.cmdLine = cmdLine;
+				runSubshell(sh, &wrapper, RUN_PARALLEL);
+			}
+			arenaRestore(arena, mark);
+		}
+		// done once the input is used up and nothing is running
+		if (jobs->parallelRunning == 0){
+			break;
+		}
+		// wait for a slot to free up
+		pid = wait4(-1, &status, 0, &usage);
+		if (pid == -1){
+			if (errno == EINTR){
+				continue;
+			}
+			break;
+		}
+		reapPid(jobs, pid, status, &usage);
+	}
+
+	// cleanup
+	if (fileName){
+		close(fd);
+		free(fileInput.buf);
+	}
+	// a user at a terminal can keep typing after the ^D that ended the list
+	else if (interactive){
+		input->eof = false;
+	}
+	return jobs->parallelFailed;
+}
+
+
+
+
+/*******************************************************************************
+ * exitShell
+ * the exit builtin:  exit [n]
+ * ends the shell loop once the current command is done. The shell exits 
+ * with n, or 0.
+ *
+ * ****************************************************************************/
+int exitShell(struct shell* sh, char** userCmds, int cmdCount){
+	sh->exiting = true;
+	sh->exitValue = cmdCount > 1 ? atoi(userCmds[1]) & 0xff : 0;
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * leaveLoop
+ * the break and continue builtins:  break [n]  or  continue [n]
+ * leaves the n innermost loops being run (1 if n isn't given). continue then
+ * goes on with the next pass of the last loop left, break doesn't. The loops
+ * themselves notice when their body returns, see loopJump.
+ *
+ * ****************************************************************************/
+int leaveLoop(struct shell* sh, char** userCmds, int cmdCount){
+	int levels = cmdCount > 1 ? atoi(userCmds[1]) : 1;  // loops to leave
+
+	if (sh->loopDepth == 0){
+		printf("%s: only meaningful in a loop\n", userCmds[0]);
+		return 1;
+	}
+	if (levels < 1){
+		printf("%s: %s: loop count out of range\n", userCmds[0], 
+				userCmds[1]);
+		return 1;
+	}
+	sh->breakLevels = levels < sh->loopDepth ? levels : sh->loopDepth;
+	sh->continuing = strcmp(userCmds[0], "continue") == 0;
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * pickJob
+ * returns the job fg and bg use when none is named: the newest stopped job,
+ * or else the newest job. skip is left out, which picks the one before it 
+ * (%-). Returns NULL if there is no such job.
+ *
+ * ****************************************************************************/
+struct job* pickJob(struct jobTable* jobs, struct job* skip){
+	struct job* job;
+	for (job = jobs->tail; job; job = job->prev){
+		if (job != skip && job->state == JOB_STOPPED){
+			return job;
+		}
+	}
+	for (job = jobs->tail; job; job = job->prev){
+		if (job != skip){
+			return job;
+		}
+	}
+	return NULL;
+}
+
+
+
+
+/*******************************************************************************
+ * findJobSpec
+ * looks up the job named by spec:  %n  job n,  %+ or %%  the current job 
+ * (see pickJob),  %-  the one before it,  %word  the job whose command 
+ * starts with word. A bare number is a job number too, or a pid if byPid is 
+ * set (for wait). Returns NULL if there is no such job.
+ *
+ * ****************************************************************************/
+struct job* findJobSpec(struct jobTable* jobs, const char* spec, bool byPid){
+	struct job* job;
+	const char* s = spec[0] == '%' ? spec + 1 : spec;
+
+	if (spec[0] != '%' && byPid){
+		return findJob(jobs, atoi(spec));
+	}
+	if (spec[0] == '%' && (*s == '\0' || *s == '%' || *s == '+')){
+		return pickJob(jobs, NULL);
+	}
+	if (spec[0] == '%' && *s == '-'){
+		return pickJob(jobs, pickJob(jobs, NULL));
+	}
+	for (job = jobs->head; job; job = job->next){
+		if (isdigit((unsigned char)*s) ? job->id == atoi(s) :
+				strncmp(job->cmdLine, s, strlen(s)) == 0){
+			return job;
+		}
+	}
+	return NULL;
+}
+
+
+
+
+/*******************************************************************************
+ * listJobs
+ * the jobs builtin:  jobs [-l]
+ * lists the jobs in the job table with their number, state and command. The
+ * current job (see pickJob) is marked with a '+' and the one before it with
+ * a '-'. -l adds each job's pid, and for a job with a cgroup of its own 
+ * (see jobCgroup) the cpu time and memory it has used so far.
+ *
+ * ****************************************************************************/
+int listJobs(struct shell* sh, char** userCmds, int cmdCount){
+	struct job* current = pickJob(&sh->jobs, NULL);
+	struct job* previous = pickJob(&sh->jobs, current);
+	bool showPid = cmdCount > 1 && strcmp(userCmds[1], "-l") == 0;
+	struct job* job;
+
+	for (job = sh->jobs.head; job; job = job->next){
+		printf("[%d]%c ", job->id, job == current ? '+' : 
+				job == previous ? '-' : ' ');
+		if (showPid){
+			printf("%d ", (int)job->pid);
+		}
+		printf(" %-22s %s", job->state == JOB_STOPPED ? "Stopped" :
+				job->state == JOB_DONE ? "Done" : "Running", 
+				job->cmdLine);
+		if (showPid && job->cgroup){
+			printCgroupUsage(job->cgroup);
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * foregroundJob
+ * the fg builtin:  fg [job]
+ * continues a job (the current one if none is named) in the foreground and
+ * waits for it, like it had been started there. Its exit becomes the status.
+ *
+ * ****************************************************************************/
+int foregroundJob(struct shell* sh, char** userCmds, int cmdCount){
+	struct job* job;
+
+	job = cmdCount > 1 ? findJobSpec(&sh->jobs, userCmds[1], false) :
+		pickJob(&sh->jobs, NULL);
+	if (job == NULL){
+		printf("fg: %s: no such job\n", 
+				cmdCount > 1 ? userCmds[1] : "current");
+		return 1;
+	}
+	if (job->parallel){
+		printf("fg: job %d belongs to parallel\n", job->id);
+		return 1;
+	}
+	printf("%s\n", job->cmdLine);
+	fflush(stdout);
+	sh->status = runForeground(&sh->jobs, job, true);
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * backgroundJob
+ * the bg builtin:  bg [job]
+ * continues a stopped job (the current one if none is named) in the 
+ * background.
+ *
+ * ****************************************************************************/
+int backgroundJob(struct shell* sh, char** userCmds, int cmdCount){
+	struct job* job;
+
+	job = cmdCount > 1 ? findJobSpec(&sh->jobs, userCmds[1], false) :
+		pickJob(&sh->jobs, NULL);
+	if (job == NULL){
+		printf("bg: %s: no such job\n", 
+				cmdCount > 1 ? userCmds[1] : "current");
+		return 1;
+	}
+	if (job->state != JOB_STOPPED){
+		printf("bg: job %d already in background\n", job->id);
+		return 0;
+	}
+	// the shell has to be there to move the data
+	if (job->relayCount > 0){
+		printf("bg: job %d has |> links, use fg\n", job->id);
+		return 1;
+	}
+	continueJob(job);
+	printf("[%d] %s &\n", job->id, job->cmdLine);
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * waitInterrupt
+ * SIGINT handler while the wait builtin is waiting, so ^C can stop it. SIGINT
+ * is normally blocked and read from the signalfd, wait unblocks it.
+ *
+ * ****************************************************************************/
+volatile sig_atomic_t waitInterrupted = 0;
+
+void waitInterrupt(int sig){
+	waitInterrupted = 1;
+}
+
+
+
+
+/*******************************************************************************
+ * waitJobs
+ * the wait builtin:  wait [job | pid ...]
+ * waits for the named jobs to finish, or with none named for every running
+ * job. Finished jobs are reported like any other background job. Returns 
+ * the exit value of the last job named (127 if it doesn't exist). A stopped
+ * job isn't waited for, and ^C stops the wait.
+ *
+ * ****************************************************************************/
+int waitJobs(struct shell* sh, char** userCmds, int cmdCount){
+	struct jobTable* jobs = &sh->jobs;
+	struct sigaction onInt = {0};   // lets ^C interrupt wait4
+	struct sigaction oldInt;        // SIGINT action to put back
+	sigset_t intMask;               // just SIGINT
+	struct job* job = NULL;         // job being waited for
+	int id = 0;                     // its number, 0 for any running job
+	int status;                     // what wait4 reported
+	struct rusage usage;
+	pid_t pid;
+	int ret = 0;
+	int i = 1;
+
+	// forget any earlier ^C, then let the next one interrupt wait4
+	readSignals();
+	onInt.sa_handler = waitInterrupt;
+	sigaction(SIGINT, &onInt, &oldInt);
+	sigemptyset(&intMask);
+	sigaddset(&intMask, SIGINT);
+	sigprocmask(SIG_UNBLOCK, &intMask, NULL);
+	waitInterrupted = 0;
+	fflush(stdout);
+
+	do{
+		if (cmdCount > 1){
+			job = findJobSpec(jobs, userCmds[i], true);
+			if (job == NULL){
+				printf("wait: %s: no such job\n", userCmds[i]);
+				ret = 127;
+				continue;
+			}
+			id = job->id;
+		}
+		while (!waitInterrupted){
+			// look again, it may have finished. Without a job
+			// anything still running will do
+			for (job = jobs->head; job; job = job->next){
+				if (id ? job->id == id : 
+						job->state == JOB_RUNNING){
+					break;
+				}
+			}
+			if (job == NULL || job->state != JOB_RUNNING){
+				break;
+			}
+			pid = wait4(-1, &status, WUNTRACED | WCONTINUED, &usage);
+			if (pid == -1 && errno == EINTR){
+				continue;
+			}
+			if (pid == -1){
+				break;
+			}
+			reapEvent(jobs, pid, status, &usage);
+		}
+		// it went, so it was the last job finished
+		if (cmdCount > 1 && job == NULL && jobs->doneId == id){
+			ret = statusValue(jobs->doneStatus);
+		}
+	} while (++i < cmdCount && !waitInterrupted);
+
+	sigprocmask(SIG_BLOCK, &intMask, NULL);
+	sigaction(SIGINT, &oldInt, NULL);
+	return waitInterrupted ? 128 + SIGINT : ret;
+}
+
+
+
+
+/*******************************************************************************
+ * foregroundOnly
+ * the fgonly builtin:  fgonly [on | off]
+ * turns foreground-only mode on or off (or over, with no argument). In 
+ * foreground-only mode a trailing '&' is ignored and every command runs in
+ * the foreground.
+ *
+ * ****************************************************************************/
+int foregroundOnly(struct shell* sh, char** userCmds, int cmdCount){
+	bool wasOn = !canRunBG;
+
+	if (cmdCount > 1 && strcmp(userCmds[1], "on") && 
+			strcmp(userCmds[1], "off")){
+		printf("fgonly: usage: fgonly [on | off]\n");
+		return 2;
+	}
+	canRunBG = cmdCount > 1 ? strcmp(userCmds[1], "off") == 0 : !canRunBG;
+	if (!canRunBG && !wasOn){
+		printf("Entering foreground-only mode (& is now ignored)\n");
+	}
+	else if (canRunBG && wasOn){
+		printf("Exiting foreground-only mode\n");
+	}
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * printSize
+ * prints a size in bytes, in the biggest of K, M, G or T it's a whole 
+ * number of.
+ *
+ * ****************************************************************************/
+void printSize(long long size){
+	int unit = -1;           // the suffix, -1 for none
+	while (unit < 3 && size != 0 && size % 1024 == 0){
+		size /= 1024;
+		unit++;
+	}
+	if (unit == -1){
+		printf("%lld", size);
+	}
+	else {
+		printf("%lld%c", size, "KMGT"[unit]);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * printCpus
+ * prints a set of cpus the way parseCpus reads them, like 0-3,6.
+ *
+ * ****************************************************************************/
+void printCpus(cpu_set_t* cpus){
+	const char* sep = "";    // goes before every range but the first
+	int cpu, last;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		if (!CPU_ISSET(cpu, cpus)){
+			continue;
+		}
+		for (last = cpu; last + 1 < CPU_SETSIZE && 
+				CPU_ISSET(last + 1, cpus); last++);
+		if (last == cpu){
+			printf("%s%d", sep, cpu);
+		}
+		else {
+			printf("%s%d-%d", sep, cpu, last);
+		}
+		sep = ",";
+		cpu = last;
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * printLimits
+ * prints limits as the limit command that would set them, if any are set.
+ *
+ * ****************************************************************************/
+void printLimits(struct limits* limits){
+	int set = limits->set;
+
+	if (set == 0){
+		return;
+	}
+	printf("limit");
+	if (set & LIMIT_CPU){
+		printf(" -t %llu", (unsigned long long)limits->cpuTime);
+	}
+	if (set & LIMIT_AS){
+		printf(" -v ");
+		printSize(limits->addressSpace);
+	}
+	if (set & LIMIT_FILES){
+		printf(" -n %llu", (unsigned long long)limits->openFiles);
+	}
+	if (set & LIMIT_NICE){
+		printf(" -p %d", limits->nice);
+	}
+	if (set & LIMIT_IO){
+		printf(" -i %s:%d", ioClasses[limits->ioClass], limits->ioLevel);
+	}
+	if (set & LIMIT_CPUS){
+		printf(" -c ");
+		printCpus(&limits->cpus);
+	}
+	if (set & LIMIT_MEMORY){
+		printf(" -m ");
+		printSize(limits->memory);
+	}
+	if (set & LIMIT_WEIGHT){
+		printf(" -w %d", limits->weight);
+	}
+	// -m and -w give a job a cgroup anyway
+	if ((set & LIMIT_CGROUPS) == LIMIT_CGROUP){
+		printf(" -g");
+	}
+	printf("\n");
+}
+
+
+
+
+/*******************************************************************************
+ * setLimits
+ * the limit builtin:  limit [-r] [option value ...] [-g] [command ...]
+ * sets the limits every background job (and parallel's jobs) is run with, 
+ * or, followed by a command, runs just that command with them, on top of 
+ * the background ones if it's in the background (see runCommand):
+ *   -t secs    cpu time              -p n       nice value raised by n
+ *   -v size    address space         -i class   io class idle, be[:0-7] or 
+ *   -n count   open files                       rt[:0-7] (ionice)
+ *   -c cpus    cpus it can run on, like 0-3,6 (taskset)
+ *   -m size    memory, and -w weight cpu weight (1-10000, 100 is even),
+ *              in a cgroup of its own, see jobCgroup. -g gives it one 
+ *              without them, to see its usage in jobs -l
+ * Sizes can end in K, M, G or T. -r clears the background limits first. 
+ * With no options they are listed, along with where the jobs' cgroups go.
+ *
+ * ****************************************************************************/
+int setLimits(struct shell* sh, char** userCmds, int cmdCount){
+	struct limits limits = {0};   // what the options set
+	bool clear = false;           // -r
+	int used = parseLimits(userCmds, cmdCount, &limits, &clear);
+
+	if (used == -1){
+		return 1;
+	}
+	// a job that needs a cgroup and can't have one is told so now
+	if ((limits.set & LIMIT_CGROUPS) && !setupCgroups(limits.set)){
+		return 1;
+	}
+	if (clear){
+		memset(&bgLimits, 0, sizeof(bgLimits));
+	}
+	mergeLimits(&bgLimits, &limits);
+	if (used == 1){
+		printLimits(&bgLimits);
+		if (cgroups.dirFd != -1){
+			printf("# jobs' cgroups are in %s\n", cgroups.path);
+		}
+	}
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * trueCommand / falseCommand
+ * the true and false builtins, which do nothing successfully or not.
+ *
+ * ****************************************************************************/
+int trueCommand(struct shell* sh, char** userCmds, int cmdCount){
+	return 0;
+}
+
+int falseCommand(struct shell* sh, char** userCmds, int cmdCount){
+	return 1;
+}
+
+
+
+
+/*******************************************************************************
+ * escapeChar
+ * decodes the backslash escape starting just after the '\' at *str, for echo
+ * -e, printf formats and printf's %b. *str is moved past the escape. Returns
+ * the character, or -1 for \c, which means stop printing altogether.
+ *
+ * ****************************************************************************/
+int escapeChar(const char** str){
+	const char* p = *str;     // walks the escape
+	int value = 0;            // of an octal escape
+	int digits;
+
+	*str = p + 1;
+	switch (*p){
+		case 'a': return '\a';
+		case 'b': return '\b';
+		case 'c': return -1;
+		case 'e': return 27;
+		case 'f': return '\f';
+		case 'n': return '\n';
+		case 'r': return '\r';
+		case 't': return '\t';
+		case 'v': return '\v';
+		case '\\': return '\\';
+		case '\0':
+			// a lone '\' at the very end is kept
+			*str = p;
+			return '\\';
+	}
+	// \NNN or \0NNN, up to three octal digits
+	if (*p >= '0' && *p <= '7'){
+		if (*p == '0'){
+			p++;
+		}
+		for (digits = 0; digits < 3 && *p >= '0' && *p <= '7'; digits++){
+			value = value * 8 + (*p++ - '0');
+		}
+		*str = p;
+		return value & 0xff;
+	}
+	// anything else isn't an escape, keep the backslash
+	*str = p;
+	return '\\';
+}
+
+
+
+
+/*******************************************************************************
+ * printEscaped
+ * prints str, decoding backslash escapes with escapeChar. Returns false if a
+ * \c said to stop printing.
+ *
+ * ****************************************************************************/
+bool printEscaped(const char* str){
+	int c;      // one decoded character
+	while (*str){
+		if (*str != '\\'){
+			putchar(*str++);
+			continue;
+		}
+		str++;
+		if ((c = escapeChar(&str)) == -1){
+			return false;
+		}
+		putchar(c);
+	}
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * echoWords
+ * the echo builtin:  echo [-neE] [word ...]
+ * prints the words separated by spaces and followed by a newline, the same
+ * as /bin/echo. -n leaves off the newline, -e decodes backslash escapes and 
+ * -E (the default) doesn't.
+ *
+ * ****************************************************************************/
+int echoWords(struct shell* sh, char** userCmds, int cmdCount){
+	bool newline = true;       // print the newline at the end?
+	bool escapes = false;      // decode backslash escapes?
+	int i = 1;
+	char* opt;
+
+	// options are only words made up entirely of n, e and E
+	for (; i < cmdCount && userCmds[i][0] == '-' && userCmds[i][1]; i++){
+		if (strspn(userCmds[i] + 1, "neE") != strlen(userCmds[i] + 1)){
+			break;
+		}
+		for (opt = userCmds[i] + 1; *opt; opt++){
+			if (*opt == 'n'){
+				newline = false;
+			}
+			else {
+				escapes = *opt == 'e';
+			}
+		}
+	}
+
+	for (; i < cmdCount; i++){
+		if (escapes){
+			if (!printEscaped(userCmds[i])){
+				return 0;
+			}
+		}
+		else {
+			fputs(userCmds[i], stdout);
+		}
+		if (i + 1 < cmdCount){
+			putchar(' ');
+		}
+	}
+	if (newline){
+		putchar('\n');
+	}
+	return 0;
+}
+
+
+
+
+/*******************************************************************************
+ * testInteger
+ * converts an argument of test to a number, setting the error flag (test's
+ * status 2) if it isn't one.
+ *
+ * ****************************************************************************/
+long long testInteger(struct testArgs* args, const char* str){
+	char* end;             // where the number stopped
+	long long value;
+
+	errno = 0;
+	value = strtoll(str, &end, 10);
+	while (isspace((unsigned char)*end)){
+		end++;
+	}
+	if (end == str || *end != '\0' || errno){
+		printf("test: %s: integer expression expected\n", str);
+		args->error = true;
+	}
+	return value;
+}
+
+
+
+
+/*******************************************************************************
+ * testBinary
+ * evaluates one binary primary of test,  left op right. Returns -1 if op 
+ * isn't a binary operator.
+ *
+ * ****************************************************************************/
+int testBinary(struct testArgs* args, const char* left, const char* op, 
+		const char* right){
+	struct stat a, b;           // the files of -nt, -ot and -ef
+	bool haveA, haveB;
+
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0){
+		return strcmp(left, right) == 0;
+	}
+	if (strcmp(op, "!=") == 0){
+		return strcmp(left, right) != 0;
+	}
+	if (strcmp(op, "<") == 0){
+		return strcmp(left, right) < 0;
+	}
+	if (strcmp(op, ">") == 0){
+		return strcmp(left, right) > 0;
+	}
+	if (op[0] != '-' || strlen(op) != 3){
+		return -1;
+	}
+	if (strcmp(op, "-eq") == 0){
+		return testInteger(args, left) == testInteger(args, right);
+	}
+	if (strcmp(op, "-ne") == 0){
+		return testInteger(args, left) != testInteger(args, right);
+	}
+	if (strcmp(op, "-lt") == 0){
+		return testInteger(args, left) < testInteger(args, right);
+	}
+	if (strcmp(op, "-le") == 0){
+		return testInteger(args, left) <= testInteger(args, right);
+	}
+	if (strcmp(op, "-gt") == 0){
+		return testInteger(args, left) > testInteger(args, right);
+	}
+	if (strcmp(op, "-ge") == 0){
+		return testInteger(args, left) >= testInteger(args, right);
+	}
+	if (strcmp(op, "-nt") && strcmp(op, "-ot") && strcmp(op, "-ef")){
+		return -1;
+	}
+	haveA = stat(left, &a) == 0;
+	haveB = stat(right, &b) == 0;
+	if (strcmp(op, "-ef") == 0){
+		return haveA && haveB && a.st_dev == b.st_dev && 
+			a.st_ino == b.st_ino;
+	}
+	// a file that doesn't exist is older than one that does
+	if (strcmp(op, "-ot") == 0){
+		return haveB && (!haveA || 
+			a.st_mtim.tv_sec < b.st_mtim.tv_sec ||
+			(a.st_mtim.tv_sec == b.st_mtim.tv_sec && 
+			 a.st_mtim.tv_nsec < b.st_mtim.tv_nsec));
+	}
+	return haveA && (!haveB || 
+		a.st_mtim.tv_sec > b.st_mtim.tv_sec ||
+		(a.st_mtim.tv_sec == b.st_mtim.tv_sec && 
+		 a.st_mtim.tv_nsec > b.st_mtim.tv_nsec));
+}
+
+
+
+
+/*******************************************************************************
+ * testUnary
+ * evaluates one unary primary of test,  op arg. Returns -1 if op isn't a 
+ * unary operator.
+ *
+ * ****************************************************************************/
+int testUnary(struct testArgs* args, const char* op, const char* arg){
+	struct stat info;           // the file being tested
+	bool exists;
+
+	if (op[0] != '-' || op[1] == '\0' || op[2] != '\0'){
+		return -1;
+	}
+	switch (op[1]){
+		case 'n': return arg[0] != '\0';
+		case 'z': return arg[0] == '\0';
+		case 't': return isatty(testInteger(args, arg));
+		case 'r': return access(arg, R_OK) == 0;
+		case 'w': return access(arg, W_OK) == 0;
+		case 'x': return access(arg, X_OK) == 0;
+		case 'h':
+		case 'L': return lstat(arg, &info) == 0 && S_ISLNK(info.st_mode);
+	}
+	if (strchr("bcdefgpsSuk", op[1]) == NULL){
+		return -1;
+	}
+	exists = stat(arg, &info) == 0;
+	switch (op[1]){
+		case 'b': return exists && S_ISBLK(info.st_mode);
+		case 'c': return exists && S_ISCHR(info.st_mode);
+		case 'd': return exists && S_ISDIR(info.st_mode);
+		case 'f': return exists && S_ISREG(info.st_mode);
+		case 'g': return exists && (info.st_mode & S_ISGID);
+		case 'k': return exists && (info.st_mode & S_ISVTX);
+		case 'p': return exists && S_ISFIFO(info.st_mode);
+		case 's': return exists && info.st_size > 0;
+		case 'S': return exists && S_ISSOCK(info.st_mode);
+		case 'u': return exists && (info.st_mode & S_ISUID);
+	}
+	return exists;
+}
+
+
+
+
+/*******************************************************************************
+ * testOr
+ * evaluates a test expression by recursive descent, from the loosest 
+ * operator down:
+ *     or      := and [-o and]...
+ *     and     := not [-a not]...
+ *     not     := ! not | primary
+ *     primary := ( or ) | arg binop arg | unop arg | arg
+ * Binary operators are tried before unary ones and a lone word is a string,
+ * so  [ -n = -n ]  and  [ -n ]  mean what they do in other shells.
+ *
+ * ****************************************************************************/
+bool testOr(struct testArgs* args);
+
+bool testPrimary(struct testArgs* args){
+	char** a = args->argv + args->pos;     // the words left
+	int left = args->end - args->pos;      // how many
+	int ret;
+	bool value;
+
+	if (left <= 0){
+		printf("test: argument expected\n");
+		args->error = true;
+		return false;
+	}
+	// arg binop arg
+	if (left >= 3 && (ret = testBinary(args, a[0], a[1], a[2])) != -1){
+		args->pos += 3;
+		return ret;
+	}
+	// ( or )
+	if (strcmp(a[0], "(") == 0 && left >= 2){
+		args->pos++;
+		value = testOr(args);
+		if (args->pos >= args->end || 
+				strcmp(args->argv[args->pos], ")") != 0){
+			printf("test: ')' expected\n");
+			args->error = true;
+			return false;
+		}
+		args->pos++;
+		return value;
+	}
+	// unop arg
+	if (left >= 2 && (ret = testUnary(args, a[0], a[1])) != -1){
+		args->pos += 2;
+		return ret;
+	}
+	// a word on its own is true unless it's empty
+	if (left >= 2 && strcmp(a[1], "-a") && strcmp(a[1], "-o") &&
+			strcmp(a[1], ")")){
+		printf("test: %s: unexpected operator\n", a[1]);
+		args->error = true;
+	}
+	args->pos++;
+	return a[0][0] != '\0';
+}
+
+bool testNot(struct testArgs* args){
+	if (args->end - args->pos > 1 && 
+			strcmp(args->argv[args->pos], "!") == 0){
+		args->pos++;
+		return !testNot(args);
+	}
+	return testPrimary(args);
+}
+
+bool testAnd(struct testArgs* args){
+	bool value = testNot(args);
+	while (!args->error && args->pos < args->end && 
+			strcmp(args->argv[args->pos], "-a") == 0){
+		args->pos++;
+		// evaluate both sides so the words are used up either way
+		value = testNot(args) && value;
+	}
+	return value;
+}
+
+bool testOr(struct testArgs* args){
+	bool value = testAnd(args);
+	while (!args->error && args->pos < args->end && 
+			strcmp(args->argv[args->pos], "-o") == 0){
+		args->pos++;
+		value = testAnd(args) || value;
+	}
+	return value;
+}
+
+
+
+
+/*******************************************************************************
+ * testExpression
+ * the test and [ builtins:  test expr  or  [ expr ]
+ * Returns 0 if the expression is true, 1 if it's false and 2 if it couldn't 
+ * be evaluated, like /usr/bin/test.
+ *
+ * ****************************************************************************/
+int testExpression(struct shell* sh, char** userCmds, int cmdCount){
+	struct testArgs args = {userCmds, 1, cmdCount, false};
+	bool value;
+
+	// [ needs its ]
+	if (strcmp(userCmds[0], "[") == 0){
+		if (strcmp(userCmds[cmdCount - 1], "]") != 0){
+			printf("[: missing ']'\n");
+			return 2;
+		}
+		args.end--;
+	}
+	// no expression at all is false
+	if (args.end == 1){
+		return 1;
+	}
+	value = testOr(&args);
+	if (!args.error && args.pos < args.end){
+		printf("test: %s: unexpected argument\n", 
+				args.argv[args.pos]);
+		args.error = true;
+	}
+	return args.error ? 2 : !value;
+}
+
+
+
+
+/*******************************************************************************
+ * printFormatted
+ * the printf builtin:  printf format [arg ...]
+ * prints the args according to format like printf(1). Backslash escapes in
+ * format are decoded, and d i o u x X c s b e E f g G and %% conversions 
+ * are supported with flags, width and precision (including *). The format is
+ * reused until the args run out, and missing args count as "" or 0.
+ *
+ * ****************************************************************************/
+int printFormatted(struct shell* sh, char** userCmds, int cmdCount){
+	const char* fmt;            // walks the format
+	const char* convStart;      // the '%' of the current conversion
+	char spec[64];              // conversion handed to printf
+	size_t specLen;
+	int next = 2;               // next arg to use
+	int stars[2];               // values of '*' width and precision
+	int starCount;
+	int ret = 0;
+	int c;
+	char conv;                  // conversion character
+	const char* arg;            // the arg being converted
+	char one[2] = "";           // the character of a %c
+	char* end;                  // where a number stopped
+	long long number;
+
+	if (cmdCount < 2){
+		printf("printf: usage: printf format [arguments]\n");
+		return 2;
+	}
+
+	do{
+		for (fmt = userCmds[1]; *fmt; ){
+			// ordinary characters and escapes
+			if (*fmt == '\\'){
+				fmt++;
+				if ((c = escapeChar(&fmt)) == -1){
+					return ret;
+				}
+				putchar(c);
+				continue;
+			}
+			if (*fmt != '%'){
+				putchar(*fmt++);
+				continue;
+			}
+			if (fmt[1] == '%'){
+				putchar('%');
+				fmt += 2;
+				continue;
+			}
+
+			// %[flags][width][.precision]conversion
+			convStart = fmt++;
+			starCount = 0;
+			fmt += strspn(fmt, "-+ #0");
+			if (*fmt == '*'){
+				stars[starCount++] = next < cmdCount ? 
+					atoi(userCmds[next++]) : 0;
+				fmt++;
+			}
+			else {
+				fmt += strspn(fmt, "0123456789");
+			}
+			if (*fmt == '.'){
+				fmt++;
+				if (*fmt == '*'){
+					stars[starCount++] = next < cmdCount ? 
+						atoi(userCmds[next++]) : 0;
+					fmt++;
+				}
+				else {
+					fmt += strspn(fmt, "0123456789");
+				}
+			}
+			conv = *fmt;
+			if (conv == '\0' || !strchr("diouxXcsbeEfgG", conv) ||
+					(size_t)(fmt - convStart) + 3 > 
+					sizeof(spec)){
+				printf("printf: %.*s: invalid conversion\n",
+						(int)(fmt - convStart + 1), 
+						convStart);
+				return 1;
+			}
+			fmt++;
+
+			// copy the flags, width and precision, then add the
+			// length modifier the conversion needs
+			specLen = fmt - 1 - convStart;
+			memcpy(spec, convStart, specLen);
+			arg = next < cmdCount ? userCmds[next++] : NULL;
+
+			switch (conv){
+			case 'd': case 'i': case 'o': case 'u': case 'x': 
+			case 'X':
+				memcpy(spec + specLen, "ll", 2);
+				spec[specLen + 2] = conv;
+				spec[specLen + 3] = '\0';
+				number = 0;
+				// 'c is the value of the character c
+				if (arg && (arg[0] == '\'' || arg[0] == '"')){
+					number = (unsigned char)arg[1];
+				}
+				else if (arg){
+					errno = 0;
+					number = strchr("di", conv) ? 
+						strtoll(arg, &end, 0) :
+						(long long)strtoull(arg, &end,
+							0);
+					if (end == arg || *end || errno){
+						printf("printf: %s: invalid "
+							"number\n", arg);
+						ret = 1;
+					}
+				}
+				if (starCount == 2){
+					printf(spec, stars[0], stars[1], 
+							number);
+				}
+				else if (starCount == 1){
+					printf(spec, stars[0], number);
+				}
+				else {
+					printf(spec, number);
+				}
+				break;
+			case 'e': case 'E': case 'f': case 'g': case 'G':
+				spec[specLen] = conv;
+				spec[specLen + 1] = '\0';
+				if (starCount == 2){
+					printf(spec, stars[0], stars[1], 
+							arg ? strtod(arg, 0) : 0.0);
+				}
+				else if (starCount == 1){
+					printf(spec, stars[0], 
+							arg ? strtod(arg, 0) : 0.0);
+				}
+				else {
+					printf(spec, arg ? strtod(arg, 0) : 0.0);
+				}
+				break;
+			case 'b':
+				// %b decodes escapes in the arg itself
+				if (arg && !printEscaped(arg)){
+					return ret;
+				}
+				break;
+			case 'c':
+				// only the first character of the arg
+				one[0] = arg ? arg[0] : '\0';
+				arg = one;
+				// fall through
+			default:
+				spec[specLen] = 's';
+				spec[specLen + 1] = '\0';
+				if (starCount == 2){
+					printf(spec, stars[0], stars[1], 
+							arg ? arg : "");
+				}
+				else if (starCount == 1){
+					printf(spec, stars[0], arg ? arg : "");
+				}
+				else {
+					printf(spec, arg ? arg : "");
+				}
+				break;
+			}
+		}
+	// go round the format again while it's still using args up
+	} while (next < cmdCount && next > 2);
+
+	return ret;
+}
+
+
+
+
+/*******************************************************************************
+ * builtins
+ * the commands the shell runs itself. Adding a builtin is adding a line here.
+ * BUILTIN_STATUS ones set the status reported by 'status' and $?, and 
+ * BUILTIN_FAST ones stand in for a utility of the same name: they save a 
+ * fork and exec when run in the foreground on their own, but inside a
+ * pipeline or in the background the real utility is run instead.
+ *
+ * ****************************************************************************/
+const struct builtin builtins[] = {
+	{"exit",     exitShell,       0},
+	{"cd",       changeDirectory, BUILTIN_STATUS},
+	{"status",   checkStatus,     0},
+	{"stats",    showStats,       0},
+	{"perf",     showPerf,        0},
+	{"hash",     hashCommands,    BUILTIN_STATUS},
+	{"parallel", runParallel,     BUILTIN_STATUS},
+	{"break",    leaveLoop,       BUILTIN_STATUS},
+	{"continue", leaveLoop,       BUILTIN_STATUS},
+	{"jobs",     listJobs,        0},
+	{"fg",       foregroundJob,   0},
+	{"bg",       backgroundJob,   BUILTIN_STATUS},
+	{"wait",     waitJobs,        BUILTIN_STATUS},
+	{"fgonly",   foregroundOnly,  BUILTIN_STATUS},
+	{"limit",    setLimits,       BUILTIN_STATUS | BUILTIN_PREFIX},
+	{"history",  showHistory,     BUILTIN_STATUS},
+	{"export",   exportVars,      BUILTIN_STATUS},
+	{"unset",    unsetVars,       BUILTIN_STATUS},
+	{"echo",     echoWords,       BUILTIN_STATUS | BUILTIN_FAST},
+	{"true",     trueCommand,     BUILTIN_STATUS | BUILTIN_FAST},
+	{"false",    falseCommand,    BUILTIN_STATUS | BUILTIN_FAST},
+	{"test",     testExpression,  BUILTIN_STATUS | BUILTIN_FAST},
+	{"[",        testExpression,  BUILTIN_STATUS | BUILTIN_FAST},
+	{"printf",   printFormatted,  BUILTIN_STATUS | BUILTIN_FAST},
+	{NULL,       NULL,            0}
+};
+
+
+
+
+/*******************************************************************************
+ * findBuiltin
+ * returns the builtin called name, or NULL if name isn't one.
+ *
+ * ****************************************************************************/
+const struct builtin* findBuiltin(const char* name){
+	const struct builtin* builtin;
+	for (builtin = builtins; builtin->name; builtin++){
+		// the first character rules out most of them cheaply
+		if (builtin->name[0] == name[0] && 
+				strcmp(builtin->name, name) == 0){
+			return builtin;
+		}
+	}
+	return NULL;
+}
+
+
+
+
+/*******************************************************************************
+ * restoreFd
+ * puts back an fd a builtin re-directed, from the copy runBuiltin saved. An
+ * fd that wasn't open before is closed again.
+ *
+ * ****************************************************************************/
+void restoreFd(int fd, int saved){
+	if (saved == -1){
+		close(fd);
+		return;
+	}
+	dup2(saved, fd);
+	close(saved);
+}
+
+
+
+
+/*******************************************************************************
+ * pushRedirects
+ * points stdin, stdout and stderr at the files of count re-directs in the
+ * shell itself, for a builtin or a compound command, saving the fds they 
+ * replace in saved (which starts out all -2, for not saved). Returns false,
+ * having said why, if one can't be done.
+ *
+ * ****************************************************************************/
+bool pushRedirects(struct redirect* redirects, int count, int saved[3]){
+	bool ready = true;          // every re-direct worked
+	int fd;
+	int i;
+
+	// anything already printed belongs before the re-direct
+	if (count > 0){
+		fflush(stdout);
+	}
+	for (i = 0; ready && i < count; i++){
+		fd = redirects[i].fd;
+		// kept above the low fds, and out of any children
+		if (saved[fd] == -2){
+			saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+		}
+		ready = applyRedirect(&redirects[i]);
+	}
+	return ready;
+}
+
+
+
+
+/*******************************************************************************
+ * popRedirects
+ * puts back the fds pushRedirects saved once what they were re-directed for
+ * is done, writing out anything printed to them first.
+ *
+ * ****************************************************************************/
+void popRedirects(int count, int saved[3]){
+	int fd;
+
+	// only a re-directed stdout has to be written out now
+	if (count > 0){
+		fflush(stdout);
+	}
+	else {
+		flushOutput();
+	}
+	for (fd = 0; fd < 3; fd++){
+		if (saved[fd] != -2){
+			restoreFd(fd, saved[fd]);
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * runBuiltin
+ * runs a builtin in the shell's own process. Its re-directs are honored by 
+ * pointing stdin, stdout and stderr at the files for the duration and then 
+ * putting them back, so no fork is needed. The status of a BUILTIN_STATUS 
+ * builtin is recorded as if it had exited with it.
+ *
+ * ****************************************************************************/
+void runBuiltin(struct shell* sh, const struct builtin* builtin, 
+		char** userCmds, int cmdCount){
+	struct redirect* redirects; // the builtin's re-directs
+	int redirectCount;          // how many
+	int saved[3] = {-2, -2, -2};  // fds 0-2 while re-directed (-2 if not)
+	bool ready;                 // every re-direct worked
+	int ret = 1;                // the builtin's exit value
+
+	// pull out the re-directs, the args end where exec's would
+	redirectCount = findReDirect(userCmds, &cmdCount, &sh->arena, 
+			&redirects);
+	ready = redirectCount != -1 && 
+			pushRedirects(redirects, redirectCount, saved);
+	// a bad re-direct is a syntax error, like sh's
+	if (redirectCount == -1){
+		ret = 2;
+	}
+	if (ready){
+		ret = builtin->run(sh, userCmds, cmdCount);
+	}
+	popRedirects(redirectCount, saved);
+
+	if ((builtin->flags & BUILTIN_STATUS) || !ready){
+		sh->status = W_EXITCODE(ret, 0);
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * runCommand
+ * runs one tokenized and expanded command line: a builtin if the first word
+ * names one, otherwise a pipeline of programs. A fast builtin is only used in
+ * the foreground outside a pipeline, otherwise the utility is run. Any 
+ * other builtin in a pipeline is run by its stage's process. limit 
+ * followed by a command runs the command's pipeline with its options.
+ *
+ * ****************************************************************************/
+void runCommand(struct shell* sh, char** userCmds, int cmdCount, 
+		char* cmdLine){
+	int assigns = countAssignments(userCmds, cmdCount);  // VAR=x words
+	const struct builtin* builtin;
+	bool wantRunBG;            // want to run a process in background?
+	struct savedVar* saved;    // variables a builtin's VAR=x words changed
+	struct limits limits = {0};   // limit's options in front of a command
+	struct limits* prefix = NULL; // set if there are some
+	bool clear = false;        // limit -r, only for the builtin
+	int used;                  // words of limit and its options
+	bool command;              // there's a command after them
+	int i;
+
+	// nothing but VAR=x words sets shell variables
+	if (assigns == cmdCount){
+		assignVars(userCmds, assigns);
+		sh->status = 0;
+		return;
+	}
+	builtin = findBuiltin(userCmds[assigns]);
+
+	// user wants to run process in background?
+	checkIfBG(userCmds, cmdCount, &wantRunBG);
+
+	// a command after limit's options is run, with its VAR=x words moved
+	// up to it. Without one (an operator is the builtin's) it's the builtin
+	if (builtin && (builtin->flags & BUILTIN_PREFIX)){
+		used = parseLimits(userCmds + assigns, cmdCount - assigns, 
+				&limits, &clear);
+		command = used != -1 && assigns + used < cmdCount && 
+			userCmds[assigns + used] && 
+			!isOperator(userCmds[assigns + used], NULL);
+		if (used == -1 || (clear && command)){
+			if (used != -1){
+				printf("limit: -r doesn't take a command\n");
+				flushOutput();
+			}
+			sh->status = W_EXITCODE(1, 0);
+			return;
+		}
+		if (command){
+			memmove(userCmds + used, userCmds, 
+					assigns * sizeof(char*));
+			userCmds += used;
+			cmdCount -= used;
+			prefix = &limits;
+			builtin = NULL;
+		}
+	}
+
+	if (builtin && (builtin->flags & BUILTIN_FAST) && wantRunBG && 
+			canRunBG){
+		builtin = NULL;
+	}
+	// in a pipeline it's a stage like any other, see runPipeline
+	for (i = 0; builtin && i < cmdCount && userCmds[i]; i++){
+		if (isPipe(userCmds[i])){
+			builtin = NULL;
+		}
+	}
+
+	// a builtin runs in the shell, its VAR=x words are exported for as
+	// long as it runs
+	if (builtin){
+		saved = pushVars(userCmds, assigns, &sh->arena);
+		runBuiltin(sh, builtin, userCmds + assigns, cmdCount - assigns);
+		popVars(saved, assigns);
+	}
+	// else we need to fork and execute a process
+	else {
+		// fork and execvp each stage of the pipeline
+		runPipeline(sh, userCmds, cmdCount, &sh->status,
+				wantRunBG ? RUN_BG : 0, prefix, &sh->jobs, cmdLine,
+				&sh->arena, sh->normal_action);
+		// ^C'ing or ^Z'ing a foreground job stops the rest of the 
+		// command line, so a loop can be interrupted
+		if (!(wantRunBG && canRunBG) && (WIFSTOPPED(sh->status) ||
+				(WIFSIGNALED(sh->status) && 
+				 WTERMSIG(sh->status) == SIGINT))){
+			sh->interrupted = true;
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * nextLine
+ * reads another line for a compound command that isn't finished yet, with a
+ * "> " prompt at a terminal, and tokenizes it into the arena. Blank lines and
+ * comments are skipped. Returns false if the input ran out first.
+ *
+ * ****************************************************************************/
+bool nextLine(struct parser* p){
+	ssize_t len;             // length of the line read
+	char* line;              // the line, in the input buffer
+
+	while (1){
+		if (interactive){
+			promptText = "> ";
+			printf("%s", promptText);
+			fflush(stdout);
+		}
+		len = readLine(p->sh->input, &line);
+		if (len == -1 && p->sh->input->eof){
+			return false;
+		}
+		// interrupted, report anything that finished while we waited
+		if (len == -1){
+			reapChildren(&p->sh->jobs);
+			continue;
+		}
+		if (len == 0 || line[0] == '#'){
+			continue;
+		}
+		p->pos = 0;
+		if (interactive){
+			keepHistory(p->sh, line, len);
+		}
+		if (!tokenizeInput(line, len, &p->sh->arena, &p->words, 
+				&p->count, &p->spans)){
+			p->error = true;
+			return false;
+		}
+		if (p->count > 0){
+			return true;
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * peekWord / isWord / isTerminator / endsCommand
+ * helpers for the parser. peekWord returns the next word of the current line
+ * without using it up, or NULL at the end of the line. isWord checks if a 
+ * word is the given keyword, and isTerminator if it is one that ends a list 
+ * of commands. endsCommand checks for an operator that ends a simple 
+ * command: ';' '&' '&&' '||' or ')'.
+ *
+ * ****************************************************************************/
+char* peekWord(struct parser* p){
+	return p->pos < p->count ? p->words[p->pos] : NULL;
+}
+
+bool isWord(char* word, const char* keyword){
+	return word && strcmp(word, keyword) == 0;
+}
+
+bool isTerminator(char* word){
+	return isWord(word, "then") || isWord(word, "else") || 
+		isWord(word, "elif") || isWord(word, "fi") || 
+		isWord(word, "do") || isWord(word, "done") || 
+		isWord(word, "}") || isOperator(word, ")");
+}
+
+bool endsCommand(char* word){
+	return isOperator(word, ";") || isOperator(word, "&") || 
+		isOperator(word, "&&") || isOperator(word, "||") || 
+		isOperator(word, ")");
+}
+
+
+
+
+/*******************************************************************************
+ * syntaxError
+ * reports a syntax error at word (NULL if the input ended too soon). Only 
+ * the first error of a command line is reported.
+ *
+ * ****************************************************************************/
+void syntaxError(struct parser* p, char* word){
+	if (!p->error){
+		if (word){
+			printf("syntax error near '%s'\n", word);
+		}
+		else {
+			printf("syntax error: unexpected end of input\n");
+		}
+		flushOutput();
+	}
+	p->error = true;
+}
+
+
+
+
+/*******************************************************************************
+ * expectWord
+ * uses up the keyword that has to come next, or reports a syntax error and
+ * returns false if something else is there.
+ *
+ * ****************************************************************************/
+bool expectWord(struct parser* p, const char* keyword){
+	if (p->error){
+		return false;
+	}
+	if (!isWord(peekWord(p), keyword)){
+		syntaxError(p, peekWord(p));
+		return false;
+	}
+	p->pos++;
+	return true;
+}
+
+
+
+
+/*******************************************************************************
+ * newNode
+ * allocates an empty node of the given type from the arena.
+ *
+ * ****************************************************************************/
+struct node* newNode(struct parser* p, int type){
+	struct node* node = arenaAlloc(&p->sh->arena, sizeof(struct node));
+	memset(node, 0, sizeof(struct node));
+	node->type = type;
+	return node;
+}
+
+
+
+
+struct node* parseList(struct parser* p);
+
+/*******************************************************************************
+ * copySpan
+ * returns the text from start up to end, with more added after it if it 
+ * isn't NULL. It's how a command shows up in the job table and stats.
+ *
+ * ****************************************************************************/
+char* copySpan(struct parser* p, char* start, char* end, const char* more){
+	size_t len = end - start;      // length of the text
+	size_t moreLen = more ? strlen(more) : 0;
+	char* line;                    // the copy
+
+	line = arenaAlloc(&p->sh->arena, len + moreLen + 1);
+	memcpy(line, start, len);
+	if (more){
+		memcpy(line + len, more, moreLen);
+	}
+	line[len + moreLen] = '\0';
+	return line;
+}
+
+
+
+
+/*******************************************************************************
+ * spanLine
+ * returns the text of the words parsed since the parser was at pos of the 
+ * line spans (count words long), as typed, for a command line. If the 
+ * command went on to more lines only the first one's words are used, 
+ * followed by "...".
+ *
+ * ****************************************************************************/
+char* spanLine(struct parser* p, char** spans, int pos, int count){
+	if (p->spans == spans){
+		return copySpan(p, spans[2 * pos], spans[2 * p->pos - 1], NULL);
+	}
+	return copySpan(p, spans[2 * pos], spans[2 * count - 1], "...");
+}
+
+
+
+
+/*******************************************************************************
+ * parseSimple
+ * parses a command that isn't a compound one: its words up to the operator
+ * that ends it (see endsCommand) or the end of the line. The words aren't 
+ * copied, the node points at them in the line's tokens. A re-direct without
+ * its word or a pipe without a command after it is a syntax error.
+ *
+ * ****************************************************************************/
+struct node* parseSimple(struct parser* p){
+	struct node* node = newNode(p, NODE_COMMAND);
+	int first = p->pos;      // where its words start
+	char* next;              // the word after a re-direct or pipe
+	int i;
+
+	node->words = &p->words[p->pos];
+	while (p->pos < p->count && !endsCommand(p->words[p->pos])){
+		p->pos++;
+		node->wordCount++;
+	}
+	for (i = first; !p->error && i < p->pos; i++){
+		next = i + 1 < p->pos ? p->words[i + 1] : NULL;
+		if ((isRedirect(p->words[i]) && (next == NULL || 
+				isOperator(next, NULL))) || 
+				(isPipe(p->words[i]) && (next == NULL || 
+				isPipe(next)))){
+			syntaxError(p, i + 1 < p->count ? p->words[i + 1] : 
+					NULL);
+		}
+	}
+	node->cmdLine = spanLine(p, p->spans, first, p->count);
+	return node;
+}
+
+
+
+
+/*******************************************************************************
+ * parseIf
+ * parses  if list then list [elif list then list]... [else list] fi
+ * An elif is parsed as an if nested in the else part, ending at the same fi.
+ *
+ * ****************************************************************************/
+struct node* parseIf(struct parser* p){
+	struct node* node = newNode(p, NODE_IF);
+
+	p->depth++;
+	p->pos++;
+	node->cond = parseList(p);
+	if (node->cond == NULL){
+		syntaxError(p, peekWord(p));
+	}
+	if (expectWord(p, "then")){
+		node->body = parseList(p);
+		if (node->body == NULL){
+			syntaxError(p, peekWord(p));
+		}
+	}
+	if (!p->error && isWord(peekWord(p), "elif")){
+		node->elseBody = parseIf(p);
+	}
+	else {
+		if (!p->error && isWord(peekWord(p), "else")){
+			p->pos++;
+			node->elseBody = parseList(p);
+		}
+		expectWord(p, "fi");
+	}
+	p->depth--;
+	return node;
+}
+
+
+
+
+/*******************************************************************************
+ * parseWhile
+ * parses  while list do list done  and  until list do list done
+ *
+ * ****************************************************************************/
+struct node* parseWhile(struct parser* p){
+	struct node* node;
+
+	node = newNode(p, isWord(peekWord(p), "while") ? NODE_WHILE : NODE_UNTIL);
+	p->depth++;
+	p->pos++;
+	node->cond = parseList(p);
+	if (node->cond == NULL){
+		syntaxError(p, peekWord(p));
+	}
+	if (expectWord(p, "do")){
+		node->body = parseList(p);
+		if (node->body == NULL){
+			syntaxError(p, peekWord(p));
+		}
+		expectWord(p, "done");
+	}
+	p->depth--;
+	return node;
+}
+
+
+
+
+/*******************************************************************************
+ * parseFor
+ * parses  for name in [word ...] do list done  where the words must be on 
+ * the same line as the for, and do can follow a ';' or start a new line.
+ *
+ * ****************************************************************************/
+struct node* parseFor(struct parser* p){
+	struct node* node = newNode(p, NODE_FOR);
+	char* name;
+
+	p->depth++;
+	p->pos++;
+	// the variable has to be a valid name
+	name = peekWord(p);
+	if (name == NULL || !(isalpha((unsigned char)name[0]) || 
+			name[0] == '_') || name[strspn(name, "abcdefghijklmnopqrstu"
+			"vwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_")]){
+		syntaxError(p, name);
+		p->depth--;
+		return node;
+	}
+	node->name = name;
+	p->pos++;
+	if (expectWord(p, "in")){
+		node->words = &p->words[p->pos];
+		while (p->pos < p->count && !isOperator(p->words[p->pos], ";")){
+			p->pos++;
+			node->wordCount++;
+		}
+	}
+	// then any number of ';'s and new lines before the do
+	while (!p->error){
+		if (peekWord(p) == NULL){
+			if (!nextLine(p)){
+				syntaxError(p, NULL);
+			}
+		}
+		else if (isOperator(peekWord(p), ";")){
+			p->pos++;
+		}
+		else {
+			break;
+		}
+	}
+	if (expectWord(p, "do")){
+		node->body = parseList(p);
+		if (node->body == NULL){
+			syntaxError(p, peekWord(p));
+		}
+		expectWord(p, "done");
+	}
+	p->depth--;
+	return node;
+}
+
+
+
+
+/*******************************************************************************
+ * parseGroup
+ * parses  { list }  which runs in the shell, and  ( list )  which runs in a
+ * subshell. Like a keyword, the } has to start a command, so it needs a ';' 
+ * or a new line before it.
+ *
+ * ****************************************************************************/
+struct node* parseGroup(struct parser* p){
+	bool subshell = isOperator(peekWord(p), "(");
+	struct node* node = newNode(p, subshell ? NODE_SUBSHELL : NODE_GROUP);
+	char** firstSpans = p->spans;  // the line it started on
+	int first = p->pos;            // and where on it
+	int firstCount = p->count;
+
+	p->depth++;
+	p->pos++;
+	node->body = parseList(p);
+	if (node->body == NULL){
+		syntaxError(p, peekWord(p));
+	}
+	if (subshell && !p->error){
+		if (isOperator(peekWord(p), ")")){
+			p->pos++;
+			node->cmdLine = spanLine(p, firstSpans, first, 
+					firstCount);
+		}
+		else {
+			syntaxError(p, peekWord(p));
+		}
+	}
+	else if (!subshell){
+		expectWord(p, "}");
+	}
+	p->depth--;
+	return node;
+}
+
+
+
+
+/*******************************************************************************
+ * parseCommand
+ * parses one command of an && || list, simple or compound. A compound one 
+ * can be followed by re-directs, then has to be followed by the end of a 
+ * command.
+ *
+ * ****************************************************************************/
+struct node* parseCommand(struct parser* p){
+	char* word = peekWord(p);
+	struct node* node;
+
+	// a command can't start with what ends one
+	if (word == NULL || endsCommand(word) || isTerminator(word)){
+		syntaxError(p, word);
+		return NULL;
+	}
+	if (isWord(word, "if")){
+		node = parseIf(p);
+	}
+	else if (isWord(word, "while") || isWord(word, "until")){
+		node = parseWhile(p);
+	}
+	else if (isWord(word, "for")){
+		node = parseFor(p);
+	}
+	else if (isWord(word, "{") || isOperator(word, "(")){
+		node = parseGroup(p);
+	}
+	else {
+		return parseSimple(p);
+	}
+	// re-directs after it apply to all of it, each needs its word
+	node->redirWords = &p->words[p->pos];
+	while (!p->error && isRedirect(peekWord(p))){
+		word = p->pos + 1 < p->count ? p->words[p->pos + 1] : NULL;
+		if (word == NULL || isOperator(word, NULL)){
+			syntaxError(p, word);
+		}
+		p->pos += 2;
+		node->redirWordCount += 2;
+	}
+	word = peekWord(p);
+	if (!p->error && word && !endsCommand(word) && !isTerminator(word)){
+		syntaxError(p, word);
+	}
+	return node;
+}
+
+
+
+
+/*******************************************************************************
+ * parseAndOr
+ * parses commands joined by && and ||, which may be followed by a new line,
+ * and a '&' after them. The list is a left leaning tree of NODE_AND and 
+ * NODE_OR nodes, so  a && b || c  runs c if either a or b failed. A '&' 
+ * after a simple command stays with its words, as runCommand expects. 
+ * Anything else run with '&' (a ( list ), or an && || list) becomes a 
+ * subshell in the background.
+ *
+ * ****************************************************************************/
+struct node* parseAndOr(struct parser* p){
+	char** firstSpans = p->spans;  // the line the list started on
+	int first = p->pos;            // and where on it
+	int firstCount = p->count;
+	struct node* node;
+	struct node* right;            // the command after an && or ||
+	struct node* list;
+	char* word;
+
+	node = parseCommand(p);
+	while (!p->error && ((word = peekWord(p)) != NULL) &&
+			(isOperator(word, "&&") || isOperator(word, "||"))){
+		p->pos++;
+		while (!p->error && peekWord(p) == NULL){
+			if (!nextLine(p)){
+				syntaxError(p, NULL);
+			}
+		}
+		right = parseCommand(p);
+		list = newNode(p, isOperator(word, "&&") ? NODE_AND : NODE_OR);
+		list->cond = node;
+		list->body = right;
+		node = list;
+	}
+	if (p->error || !isOperator(peekWord(p), "&")){
+		return node;
+	}
+	if (node->type == NODE_COMMAND){
+		node->wordCount++;
+		p->pos++;
+		node->cmdLine = spanLine(p, firstSpans, first, firstCount);
+		return node;
+	}
+	if (node->type != NODE_SUBSHELL){
+		list = newNode(p, NODE_SUBSHELL);
+		list->body = node;
+		node = list;
+	}
+	node->background = true;
+	p->pos++;
+	node->cmdLine = spanLine(p, firstSpans, first, firstCount);
+	return node;
+}
+
+
+
+
+/*******************************************************************************
+ * parseList
+ * parses && || lists separated by ';' or '&' (or by new lines inside a 
+ * compound command) until a keyword that ends the list, or the end of the 
+ * line at the top level. Returns the first of them, or NULL if it is empty.
+ *
+ * ****************************************************************************/
+struct node* parseList(struct parser* p){
+	struct node* head = NULL;      // the list
+	struct node** tail = &head;    // where the next command goes
+	char* word;
+
+	while (!p->error){
+		word = peekWord(p);
+		// the end of the line ends the list unless a compound is open
+		if (word == NULL){
+			if (p->depth == 0){
+				break;
+			}
+			if (!nextLine(p)){
+				syntaxError(p, NULL);
+			}
+			continue;
+		}
+		if (isOperator(word, ";")){
+			p->pos++;
+			continue;
+		}
+		if (isTerminator(word)){
+			break;
+		}
+		*tail = parseAndOr(p);
+		if (*tail){
+			tail = &(*tail)->next;
+		}
+	}
+	return head;
 }
 
 
 
 
 /*******************************************************************************
- * expandPID
- * loops through array of user commands and if any contain '$$', then the 
- * process ID for this program's process is appended in its place. 
- *
- *
- * to do:
- * I changed how this function works to remove all instances of '$$' from any
- * command instead of just the first. With that change, how I allocate and free 
- * the variable post isnt very efficient...   it's late...
+ * parseCommands
+ * parses a line of input into a list of commands. If the line opens an if, 
+ * while or for, more lines are read until it is closed. The words are 
+ * copied into the shell's arena as the line is tokenized, since reading 
+ * those lines can move the input buffer under it. Everything is allocated 
+ * from the arena and the words are tokenized once, however often loops go 
+ * on to run them. 
+ * Returns NULL for a line with no commands or a syntax error, and sets 
+ * parseError if it was an error.
  *
  * ****************************************************************************/
-void expandPID(char** userCmds, int cmdCount){
-	int i;                   // tracks loop
-	char* index;             // address of '$$' if found, otherwise is NULL
-	char* index2;            // tracks address of just after '$$'
-	bool postCheck = false;  // tracks if command hsa anything beyond '$$'
-	char* post;              // holds post command if found
-
-	// holds converted pid number as string
-	char* pidBuff = calloc(10, sizeof(char));
+struct node* parseCommands(struct shell* sh, char* line, size_t len){
+	struct parser p = {0};
+	struct node* list;
 
-	// loop through all the commands in array
-	for (i = 0; i < cmdCount; i++){
-		do {
-			// if the current command contains "$$"
-			if (index = strstr(userCmds[i], "$$")){
-				index2 = index + 2;
-				// check if there are chars after the '$$'
-				if (strcmp(index2, "\0") != 0){
-					// we have a string past the '$$'
-					postCheck = true;
-					// allocate space to store post string
-					post = calloc(40, sizeof(char));
-					// copy string after '$$' to post
-					strcpy(post, index2);
-				}
-				// chop off the "$$"
-				*index = '\0';
-				// get and convert the PID to string
-				snprintf(pidBuff, 9, "%d", getpid());
-				// append the PID
-				strcat(userCmds[i], pidBuff);
-				// if post string, 
-				// append it back on and clean up post
-				if (postCheck){
-					strcat(userCmds[i], post);
-					free(post);
-				}
-			}
-
-			// reset flag
-			postCheck = false;
-		// while we can still find a '$$'
-		} while (index);			                         
+	p.sh = sh;
+	sh->parseError = false;
+	if (!tokenizeInput(line, len, &sh->arena, &p.words, &p.count, 
+			&p.spans)){
+		sh->parseError = true;
+		return NULL;
 	}
-	// cleanup
-	free(pidBuff);
+	list = parseList(&p);
+	// a keyword like fi or done with nothing open
+	if (!p.error && peekWord(&p)){
+		syntaxError(&p, peekWord(&p));
+	}
+	sh->parseError = p.error;
+	return p.error ? NULL : list;
 }
 
 
 
 
 /*******************************************************************************
- * changeDirectory
- * checks if a directory path argument was entered and if so changes the 
- * current workiing directory to that location. If a path argument wasn't 
- * provided, the current working directory is set to the users HOME directory.
+ * runSimple
+ * expands and runs one command of a parsed list. The words are copied first
+ * because expanding and running a command rewrites its array, and a loop 
+ * needs the original again next time. Everything the command allocates from
+ * the arena is freed once it is done, so a loop doesn't grow the arena.
  *
  * ****************************************************************************/
-void changeDirectory(char** userCmds){
-	int ret;   // stores returned value from chdir 
+void runSimple(struct shell* sh, struct node* node){
+	struct arenaMark mark = arenaSave(&sh->arena);   // to free it all after
+	char** userCmds;          // the command's own copy of its words
 
-	// check if just 'cd' command or if has path
-	if (userCmds[1] == NULL){
-		// change to home directory
-		//Ref:   https://tinyurl.com/yd3yk2ez
-		ret = chdir(getenv("HOME"));
-		// check if chdir error
-		if (ret == -1){
-			printf("error changing to HOME dir\n");
-			fflush(stdout);
-			exit(1);
-		}
-	}
-	// else a path was specified
-	else{
-		ret = chdir(userCmds[1]);
-		// check if chdir error
-		if (ret == -1){
-			printf("error changing to %s\n", userCmds[1]);
-			fflush(stdout);
-			exit(1);
-		}
+	userCmds = arenaAlloc(&sh->arena, (node->wordCount + 1) * sizeof(char*));
+	memcpy(userCmds, node->words, node->wordCount * sizeof(char*));
+	userCmds[node->wordCount] = NULL;
+
+	// check for and expand any commands with '$'
+	expandWords(userCmds, node->wordCount, sh->status, sh->jobs.lastPid, 
+			&sh->arena);
+	// run the builtin or program it names
+	runCommand(sh, userCmds, node->wordCount, node->cmdLine);
+	arenaRestore(&sh->arena, mark);
+
+	// report finished background jobs as we go, a loop can run a while,
+	// and a ^C seen while doing it stops the rest of the line
+	if (reapChildren(&sh->jobs)){
+		sh->interrupted = true;
 	}
 }
 
@@ -192,339 +9048,324 @@ void changeDirectory(char** userCmds){
 
 
 /*******************************************************************************
- * checkIfBG
- * checks the last element of userCmds array to see if the user wanted to run
- * the process in the background. Updates the wantRunGB bool appropriately.
+ * stopList
+ * checks if the rest of a list should be skipped: the shell is exiting, a 
+ * command was interrupted, or break or continue is leaving a loop.
  *
  * ****************************************************************************/
-checkIfBG(char** userCmds, int cmdCount, bool* wantRunBG){
-	// if the last command is '&'
-	if (strcmp(userCmds[cmdCount - 1], "&") == 0){
-		//printf("user wants bg process\n");
-		*wantRunBG = true;
-		// free and null out the bg command so not passed to execvp
-		free(userCmds[cmdCount - 1]);
-		userCmds[cmdCount - 1] = NULL;
-	}
-	else {
-		*wantRunBG = false;
-	}
+bool stopList(struct shell* sh){
+	return sh->exiting || sh->interrupted || sh->breakLevels > 0;
 }
 
 
 
 
 /*******************************************************************************
- * checkStatus
- * checks if the last process exited or recieved a signal and prints the 
- * cooresponding exit or signal information. Only one of either WIFEXITED or
- * WIFSIGNALED should return a non-zero value.
+ * loopJump
+ * called by a loop after running its condition or body. Returns true if the
+ * loop has to end: the list was stopped, or a break or continue is leaving 
+ * this loop. A continue leaving only this loop goes on with its next pass.
+ * A loop of builtins or quick commands spends nearly all its time in the
+ * shell, where the ^C is blocked, so the signalfd is checked here for one.
  *
  * ****************************************************************************/
-void checkStatus(int* childExitMethod){
-	//printf("in checkStatus\n");
-	// check if process exited
-	if (WIFEXITED(*childExitMethod) != 0){
-		// get and print the exit status
-		int exitStatus = WEXITSTATUS(*childExitMethod);
-		printf("exit value %d\n", exitStatus);
-		fflush(stdout);
+bool loopJump(struct shell* sh){
+	if (readSignals()){
+		sh->interrupted = true;
 	}
-	// check if the process recieved a signal
-	else if (WIFSIGNALED(*childExitMethod) != 0){
-		// get and print the signal number
-		int sigStatus = WTERMSIG(*childExitMethod);
-		printf("terminated by signal %d\n", sigStatus);
-		fflush(stdout);
+	if (sh->breakLevels == 0){
+		return stopList(sh);
 	}
+	sh->breakLevels--;
+	if (sh->breakLevels == 0 && sh->continuing){
+		sh->continuing = false;
+		return stopList(sh);
+	}
+	return true;
 }
 
 
 
 
+void runList(struct shell* sh, struct node* node);
+
 /*******************************************************************************
- * checkReDirect
- * checks if user wants to re-direct stdin and/or stdout. If so, file pointers 
- * are opened and set using dup2.
+ * runLoop
+ * runs a while or until loop: the body runs for as long as the condition 
+ * succeeds (while) or fails (until). Its status is that of the last body run,
+ * or 0 if the body never ran.
  *
  * ****************************************************************************/
-void checkReDirect(char** userCmds, int cmdCount, bool wantRunBG, 
-		int* inFile, int* outFile){
-	//printf("checking for input/output re-direction\n");
-	int i;                   // for looping
-	int ret;                 // stores return val for error check
-	bool foundIn = false;    // did we find a input redirect?
-	bool foundOut = false;   // did we find a output redirect?
+void runLoop(struct shell* sh, struct node* node){
+	bool ran = false;          // did the body run at all?
 
-	// loop through all of the user commands
-	for (i = 0; i < cmdCount; i++){
-		// check value wasn't NULL'd out
-		if (userCmds[i]){
-			// if we find a input re-direct
-			if (strcmp(userCmds[i], "<") == 0){
-				//printf("found input re-direct\n");
-				foundIn = true;
-				// open the file for reading
-				*inFile = open(userCmds[i + 1], O_RDONLY);
-				// error check
-				if (*inFile == -1){
-					//perror(userCmds[i + 1]);
-					printf("cannot open %s for input\n", 
-							userCmds[i + 1]);
-					fflush(stdout);
-					exit(1);
-				}
-				// if we opened the file redirect stdin to it 
-				ret = dup2(*inFile, 0);
-				// check for dup error
-				if (ret == -1){
-					perror("dup2 - input redirect");
-					exit(1);
-				}
-				//remove '<' from cmds so not passed to execvp
-				free(userCmds[i]);
-				userCmds[i] = NULL;
-			}	
-		}
-		// else if we're redirecting stdout
-		// check value wasn't NULL'd out
-		if (userCmds[i]){	
-			// if we find a output re-direct
-			if (strcmp(userCmds[i], ">") == 0){
-				//printf("found output re-direct\n");
-				foundOut = true;
-				// open the file for writing
-				*outFile = open(userCmds[i + 1],
-					       	O_WRONLY | O_CREAT | O_TRUNC,
-					       	0644);
-				// error check
-				if (*outFile == -1){
-					//perror(userCmds[i+ 1]);
-					printf("cannot open %s for output\n",
-							userCmds[i + 1]);
-					fflush(stdout);
-					exit(1);
-				}
-				// if we opened the file redirect stdout to it
-				ret = dup2(*outFile, 1);
-				// check for dup error
-				if (ret == -1){
-					perror("dup2 - output redirect");
-					exit(1);
-				}
-				//remove '>' from cmds so not passed to execvp
-				free(userCmds[i]);
-				userCmds[i] = NULL;
-			}
+	sh->loopDepth++;
+	while (1){
+		runList(sh, node->cond);
+		if (loopJump(sh)){
+			break;
 		}
-	}
-	// if we're running process in bg we need to redirect input and output
-	// from their default values if input or output files are not provided
-	if (wantRunBG && canRunBG){
-		// if a redirect wasnt set then redirect to dev/null
-		if (!foundIn){
-			// we will read from dev/null
-			*inFile = open("/dev/null", O_RDONLY);
-			// error check
-			if (*inFile == -1){
-				perror("couldnt open dev/null for reading");
-				exit(1);
-			}
-			// if dev/null was opened redirect to it
-			ret = dup2(*inFile, 0);
-			// check for dup error
-			if (ret == -1){
-				perror("dup2 - input from dev/null");
-				exit(1);
-			}
+		if ((sh->status == 0) != (node->type == NODE_WHILE)){
+			break;
 		}
-		// if we didn't find any output redirects
-		if (!foundOut){
-			// we will write to dev/null
-			*outFile = open("/dev/null", 
-					O_WRONLY | O_CREAT | O_TRUNC, 0644);
-			// error check
-			if (*outFile == -1){
-				perror("couldnt open dev/null for writing");
-				exit(1);
-			}
-			// if dev/null was opened redirect to it
-			ret = dup2(*outFile, 1);
-			// check for dup error
-			if (ret == -1){
-				perror("dup2 - output to dev/null");
-				exit(1);
-			}
+		runList(sh, node->body);
+		ran = true;
+		if (loopJump(sh)){
+			break;
 		}
 	}
+	sh->loopDepth--;
+	if (!ran){
+		sh->status = 0;
+	}
 }
 
 
 
 
 /*******************************************************************************
- * addPid
- * As background processes are created they are added to the pidArray and the 
- * count is incremented.
+ * runFor
+ * runs a for loop. The words are expanded once, then the body runs with the
+ * variable set to each in turn. It's a shell variable, only in commands' 
+ * environment if it was exported, and setVar writes each value over the 
+ * last so the passes don't allocate.
  *
  * ****************************************************************************/
-void addPid(pid_t* pidArray, int* pidCount, pid_t pid){
-	pidArray[*pidCount] = pid;
-	(*pidCount)++;
+void runFor(struct shell* sh, struct node* node){
+	struct arenaMark mark = arenaSave(&sh->arena);  // frees the expanded words
+	char** words;              // the expanded words
+	size_t nameLen = strlen(node->name);
+	int i;
+
+	words = arenaAlloc(&sh->arena, (node->wordCount + 1) * sizeof(char*));
+	memcpy(words, node->words, node->wordCount * sizeof(char*));
+	words[node->wordCount] = NULL;
+	expandWords(words, node->wordCount, sh->status, sh->jobs.lastPid, 
+			&sh->arena);
+
+	sh->status = 0;
+	sh->loopDepth++;
+	for (i = 0; i < node->wordCount; i++){
+		setVar(node->name, nameLen, words[i]);
+		runList(sh, node->body);
+		if (loopJump(sh)){
+			break;
+		}
+	}
+	sh->loopDepth--;
+	arenaRestore(&sh->arena, mark);
 }
 
 
 
 
 /*******************************************************************************
- * removePid
- * searches for (and should find) PID of a recently finished background process.
- * When found the pid is removed and the array count is decremented
+ * nodeRedirects
+ * expands the re-directs after a compound command into an array allocated 
+ * from the arena, from a copy of its words since a loop can run it again.
+ * Returns how many there are, or -1 (having said so) if one is bad.
  *
  * ****************************************************************************/
-int removePid(pid_t* pidArray, int* pidCount, pid_t targetPid){
-	int i;
-	int index = -1;
+int nodeRedirects(struct shell* sh, struct node* node, 
+		struct redirect** redirects){
+	int count = node->redirWordCount;
+	char** words;             // a copy of the words to expand
 
-	// loop through pidArray looking for index of our target pid
-	for (i = 0; i < *pidCount; i++){
-		// if we find it record location and break loop
-		if (pidArray[i] == targetPid){
-			index = i;
-			break;
-		}
-	}
-	// if we found the index
-	if (index != -1){
-		// shift pids down overwriting pid we want to remove
-		for (index; index < (*pidCount) - 1; index++){
-		pidArray[index] = pidArray[index + 1];
-		}	
-		// decrement our count of pid's in the array
-		(*pidCount)--;
-	}
+	words = arenaAlloc(&sh->arena, (count + 1) * sizeof(char*));
+	memcpy(words, node->redirWords, count * sizeof(char*));
+	words[count] = NULL;
+	expandWords(words, count, sh->status, sh->jobs.lastPid, &sh->arena);
+	return findReDirect(words, &count, &sh->arena, redirects);
 }
 
 
 
 
 /*******************************************************************************
- * reapChildren
- * loops through pidArray and checks if any of the processes within have 
- * finished. If so the process completion information is printed and the 
- * pid is removed from the pidArray.
+ * runSubshell
+ * runs a ( list ), or a list run with '&', in a forked copy of the shell. 
+ * The child gets a process group and the terminal the way a pipeline's 
+ * first stage would, runs the list without job control (its commands share
+ * its group) and exits with the list's status, or with exit's value. In the
+ * background its input and output are /dev/null, like any other command's.
+ * The parent tracks it in the job table, so it can be waited for, stopped 
+ * and resumed like a pipeline. runFlags are runPipeline's: RUN_BG for a list
+ * run with '&', or RUN_PARALLEL for a line of the parallel builtin, which
+ * is left running like parallel's pipelines. Re-directs after the ( list )
+ * are applied in the child, like a command's.
  *
  * ****************************************************************************/
-void reapChildren(pid_t* pidArray, int* pidCount, int* childExitMethod){
-	//printf("in reapChildren\n");
-	int i;        // for looping
-	int ret;      // tracks if removePid succeedes or fails
-	pid_t pid;    // holds return from waitpid call
-	// for each of the unreaped processes
-	for (i = 0; i < *pidCount; i++){
-		pid = waitpid(pidArray[i], childExitMethod, WNOHANG);
-		// if we reaped a process
-		if ((int)pid != 0){
-			// check if process exited
-			if(WIFEXITED(*childExitMethod)){
-				printf("background pid %d is done: exit value %d\n", (int)pid, WEXITSTATUS(*childExitMethod));
-				fflush(stdout);
+void runSubshell(struct shell* sh, struct node* node, int runFlags){
+	bool parallel = runFlags & RUN_PARALLEL;     // started by parallel?
+	bool runBG = (runFlags & RUN_BG) && canRunBG && !parallel;  // in bg?
+	bool limited = runBG || parallel;             // gets the bg limits?
+	pid_t pgid;                 // like runPipeline's
+	struct stage stage = {0};   // for checkReDirect
+	struct arenaMark mark = arenaSave(&sh->arena);  // frees the re-directs
+	struct timespec launched;   // when it was forked
+	struct job* job;
+	sigset_t interrupt;         // SIGINT, unblocked in the child
+	char* cgroup = NULL;        // its cgroup, from the background limits
+	pid_t pid;
+
+	pgid = runBG || (jobControl && !parallel) ? 0 : -1;
+	stage.redirectCount = nodeRedirects(sh, node, &stage.redirects);
+	if (stage.redirectCount == -1){
+		arenaRestore(&sh->arena, mark);
+		sh->jobs.parallelFailed |= parallel;
+		sh->status = W_EXITCODE(2, 0);
+		return;
+	}
+	// what we printed mustn't be printed again by the child
+	fflush(stdout);
+	if (limited){
+		cgroup = jobCgroup(&bgLimits);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &launched);
+	pid = fork();
+	if (pid == -1){
+		perror("Hull Breach! error forking...");
+		if (cgroup){
+			unlinkat(cgroups.dirFd, cgroup, AT_REMOVEDIR);
+			free(cgroup);
+		}
+		arenaRestore(&sh->arena, mark);
+		sh->jobs.parallelFailed |= parallel;
+		sh->status = W_EXITCODE(1, 0);
+		return;
+	}
+	if (pid == 0){
+		if (pgid != -1){
+			setpgid(0, 0);
+			if (!runBG && jobControl){
+				tcsetpgrp(0, getpgrp());
 			}
-			// or if it was terminated by a signal
-			if (WIFSIGNALED(*childExitMethod)){
-				int sigStatus = WTERMSIG(*childExitMethod);
-				printf("background pid %d is done: terminated by signal %d\n", (int)pid, sigStatus);
-				fflush(stdout);
+		}
+		stage.nullIn = runBG || parallel;
+		stage.nullOut = runBG;
+		checkReDirect(&stage);
+		// in the background it's under the background limits, and so
+		// is everything it runs, so they aren't applied again
+		if (limited && bgLimits.set){
+			if (!applyLimits(&bgLimits, cgroup)){
+				_exit(1);
 			}
-			// remove the reaped child from the pidArray
-			removePid(pidArray, pidCount, pid);
-			// decrement i so we check the same index again as 
-			// removePid shifts remaining pids to lower incices. 
-			// we shouldnt segfauld because removePid also decrements
-			// pidCount
-			i--;
+			memset(&bgLimits, 0, sizeof(bgLimits));
+		}
+		// and its own jobs' cgroups go inside its cgroup, under its cap
+		if (cgroup){
+			close(cgroups.dirFd);
+			free(cgroups.path);
+			cgroups.dirFd = -1;
+			cgroups.path = NULL;
+			cgroups.enabled = 0;
+		}
+		// ^C and ^Z act on the subshell itself, not just the command
+		// it's running, so a loop of builtins can be stopped too
+		if (!runBG || jobControl){
+			sigaction(SIGINT, sh->normal_action, NULL);
+			sigemptyset(&interrupt);
+			sigaddset(&interrupt, SIGINT);
+			sigprocmask(SIG_UNBLOCK, &interrupt, NULL);
+		}
+		if (jobControl){
+			sigaction(SIGTSTP, sh->normal_action, NULL);
+			sigaction(SIGTTIN, sh->normal_action, NULL);
+			sigaction(SIGTTOU, sh->normal_action, NULL);
+		}
+		// the parent's jobs aren't our children
+		jobControl = false;
+		initJobs(&sh->jobs);
+		sh->loopDepth = 0;
+
+		runList(sh, node->body);
+		fflush(stdout);
+		_exit(sh->exiting ? sh->exitValue : statusValue(sh->status));
+	}
+
+	arenaRestore(&sh->arena, mark);
+	if (pgid == 0){
+		pgid = pid;
+		setpgid(pid, pgid);
+		if (!runBG){
+			tcsetpgrp(0, pgid);
 		}
 	}
+	job = addJob(&sh->jobs, &pid, 1, pgid > 0 ? pgid : 0, node->cmdLine);
+	job->start = launched;
+	job->cgroup = cgroup;
+	if (runBG){
+		printf("background pid is %d\n", pid);
+		flushOutput();
+		sh->jobs.lastPid = pid;
+		return;
+	}
+	if (parallel){
+		job->parallel = true;
+		sh->jobs.parallelRunning++;
+		sh->jobs.lastPid = pid;
+		return;
+	}
+	sh->status = runForeground(&sh->jobs, job, false);
+	// like a command, ^C'ing or ^Z'ing it stops the rest of the line
+	if (WIFSTOPPED(sh->status) || (WIFSIGNALED(sh->status) && 
+			WTERMSIG(sh->status) == SIGINT)){
+		sh->interrupted = true;
+	}
 }
 
 
 
 
 /*******************************************************************************
- * forknExec
- * forks off a new process and then executes the proper command. If it is a 
- * background process user access to shell will instantly return. If it is a 
- * foreground process the child process will run until completiion and then 
- * return user access to the shell prompt. 
+ * runNode
+ * runs one command of a parsed list. An if runs its then part if its
+ * condition succeeded and its else part otherwise, with a status of 0 if 
+ * neither ran. The right side of && runs only if the left side succeeded,
+ * of || only if it failed, and the status is the last one run.
  *
  * ****************************************************************************/
-void forkAndExec(char** userCmds, int cmdCount, int* childExitMethod, 
-		bool wantRunBG, pid_t* pidArray, 
-		int* pidCount, struct sigaction* normal_action){
-	//printf("in forkAndExec\n");
-	pid_t spawnPid = -5;     // holds spawned process id
-	int inFile;             // input file descriptor
-	int outFile;             // output file descriptor
-
-	// fork into a child and parent process
-	spawnPid = fork();
-
-	// do different things for parent and child
-	switch(spawnPid){
-		// if there was an error forking
-		case -1:
-			perror("Hull Breach! error forking...");
-			exit(1);
+void runNode(struct shell* sh, struct node* node){
+	switch (node->type){
+		case NODE_COMMAND:
+			runSimple(sh, node);
 			break;
-	
-		// child process
-		case 0:
-			//printf("in child process\n");
-			// check if we are re-directing input/output
-			checkReDirect(userCmds, cmdCount, wantRunBG, 
-					&inFile, &outFile);
-
-			// change foreground proccs to accept SIGINT signals
-			// if user doesnt want to run in bg or cant run in bg
-			if (!wantRunBG || !canRunBG){			
-				sigaction(SIGINT, normal_action, NULL);
+		case NODE_IF:
+			runList(sh, node->cond);
+			if (stopList(sh)){
+				break;
 			}
-
-			// have child execute command
-			execvp(userCmds[0], userCmds);
-			
-			// if we get here there was a problem with execvp
-			perror(userCmds[0]);
-			// set childExitMethod to reflect an error
-			*childExitMethod = 1;
-			// terminate the child
-			exit(1);
-			break;
-
-		// parent process
-		default:
-			//printf("in parent Process\n");
-			// if the user wants and can run the process in the bg
-			if (wantRunBG && canRunBG){
-				printf("background pid is %d\n", spawnPid);
-				fflush(stdout);
-				// add the process to bgProccArray
-				addPid(pidArray, pidCount, spawnPid);
+			if (sh->status == 0){
+				runList(sh, node->body);
+			}
+			else if (node->elseBody){
+				runList(sh, node->elseBody);
 			}
-			// else we are waiting for the foreground process
 			else {
-				// wait until process done
-				waitpid(spawnPid, childExitMethod, 0);
-				// check if process terminated by signal
-				if (WIFSIGNALED(*childExitMethod) != 0){
-					int sigStatus = 
-						WTERMSIG(*childExitMethod);
-					printf("terminated by signal %d\n", 
-							sigStatus);
-					fflush(stdout);
-				}
+				sh->status = 0;
+			}
+			break;
+		case NODE_WHILE:
+		case NODE_UNTIL:
+			runLoop(sh, node);
+			break;
+		case NODE_FOR:
+			runFor(sh, node);
+			break;
+		case NODE_AND:
+		case NODE_OR:
+			runList(sh, node->cond);
+			if (!stopList(sh) && (sh->status == 0) == 
+					(node->type == NODE_AND)){
+				runList(sh, node->body);
 			}
 			break;
+		case NODE_GROUP:
+			runList(sh, node->body);
+			break;
+		case NODE_SUBSHELL:
+			runSubshell(sh, node, node->background ? RUN_BG : 0);
+			break;
 	}
 }
 
@@ -532,42 +9373,47 @@ void forkAndExec(char** userCmds, int cmdCount, int* childExitMethod,
 
 
 /*******************************************************************************
- * toggleBG
- * toggles the currently set boolean value of global canRunBG at the receipt of
- * a SIGTSTP signal. So if canRunBG is set to true, and the the SIGTSTP signal 
- * is caught, the value will be toggled to false. Likewise the bool will be 
- * toggled to true if originally set to false when the signal is caught.
+ * runRedirected
+ * runs a compound command with the re-directs after it, which point the 
+ * shell's own stdin, stdout or stderr at their files while it runs, like a
+ * builtin's. If one can't be done the command isn't run and fails.
  *
  * ****************************************************************************/
-void toggleBG(){
-	// if we can currently run a background process
-	if (canRunBG){
-		char* message = "\nEntering foreground-only mode" 
-			" (& is now ignored)\n";
-		write(STDOUT_FILENO, message, 50);
-		canRunBG = false;
+void runRedirected(struct shell* sh, struct node* node){
+	struct arenaMark mark = arenaSave(&sh->arena);  // frees the re-directs
+	struct redirect* redirects;   // the command's re-directs
+	int redirectCount;            // how many
+	int saved[3] = {-2, -2, -2};  // fds 0-2 while re-directed (-2 if not)
+
+	redirectCount = nodeRedirects(sh, node, &redirects);
+	if (redirectCount != -1 && 
+			pushRedirects(redirects, redirectCount, saved)){
+		runNode(sh, node);
 	}
-	// else we can not run a background process
-	else {  // (!canRunBG)
-		char* message = "\nExiting foreground-only mode\n";
-		write(STDOUT_FILENO, message, 30);
-		canRunBG = true;
+	else {
+		sh->status = W_EXITCODE(redirectCount == -1 ? 2 : 1, 0);
 	}
+	popRedirects(redirectCount, saved);
+	arenaRestore(&sh->arena, mark);
 }
 
 
 
 
 /*******************************************************************************
- * killBG
- * on program exit loops through the array of background processes and 
- * terminates them.
+ * runList
+ * runs a parsed list of commands in order. A subshell applies its own 
+ * re-directs, in the child.
  *
  * ****************************************************************************/
-void killBG(pid_t* pidArray, int pidCount){
-	int i;
-	for (i = 0; i < pidCount; i++){
-		kill(pidArray[i], SIGTERM);
+void runList(struct shell* sh, struct node* node){
+	for (; node && !stopList(sh); node = node->next){
+		if (node->redirWordCount > 0 && node->type != NODE_SUBSHELL){
+			runRedirected(sh, node);
+		}
+		else {
+			runNode(sh, node);
+		}
 	}
 }
 
@@ -575,17 +9421,142 @@ void killBG(pid_t* pidArray, int pidCount){
 
 
 /*******************************************************************************
- * reapBG
- * should be used after killBG. Loops through array of background process ids 
- * and because they should all be killed, procededs to reap them.
+ * killJobs
+ * on program exit signals every background job at once, with sig. Each job
+ * with its own process group is signaled as a group, so the whole pipeline
+ * gets it. Stopped jobs are continued so they can act on a SIGTERM. A 
+ * SIGKILL goes through the job's cgroup.kill when it has a cgroup, which 
+ * also gets anything it started in a process group of its own.
  *
  * ****************************************************************************/
-void reapBG(pid_t* pidArray, int pidCount, int* childExitMethod){	
+void killJobs(struct jobTable* jobs, int sig){
+	struct job* job;
 	int i;
-	for (i = 0; i < pidCount; i++){
-		waitpid(pidArray[i], childExitMethod, 0);
+	for (job = jobs->head; job; job = job->next){
+		if (sig == SIGKILL && job->cgroup && 
+				writeCgroup(job->cgroup, "cgroup.kill", "1")){
+			continue;
+		}
+		// jobs in the shell's own process group are signaled one by one
+		if (job->pgid == 0){
+			for (i = 0; i < job->procCount; i++){
+				kill(job->pids[i], sig);
+			}
+		}
+		else {
+			kill(-job->pgid, sig);
+		}
+		if (job->state == JOB_STOPPED){
+			continueJob(job);
+		}
+	}
+}
+
+
+
+
+/*******************************************************************************
+ * reapJobs
+ * used on exit after killJobs has sent SIGTERM. Reaps the jobs with 
+ * wait4(-1) in whatever order they finish, sleeping on the signalfd in 
+ * between, for up to wait seconds. Jobs still running then get SIGKILL 
+ * (so does everything at once if ^C is pressed) and a second more, after 
+ * which any left are given up on. So exit takes as long as the slowest job,
+ * and never more than wait seconds and one, however many jobs there are. 
+ * Prints a summary to stderr if there were jobs, and empties the job table.
+ *
+ * ****************************************************************************/
+void reapJobs(struct jobTable* jobs, double wait){	
+	int childExitMethod;    // how the process exited
+	struct rusage usage;    // resources it used
+	struct pollfd pfd = {signalFd, POLLIN, 0};   // for the SIGCHLDs
+	struct timespec start, now;  // when we started, and now
+	double elapsed = 0;     // seconds since start
+	double deadline = wait; // when the jobs left get SIGKILL, then give up
+	bool killed = false;    // was SIGKILL sent?
+	int total = 0;          // jobs there were
+	int ended = 0;          // jobs that finished before the SIGKILL
+	int forced = 0;         // and after it
+	struct job* job;
+	pid_t pid;
+
+	for (job = jobs->head; job; job = job->next){
+		total++;
+	}
+	// anything printed so far comes before the summary
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (jobs->head){
+		pid = wait4(-1, &childExitMethod, WNOHANG, &usage);
+		if (pid > 0){
+			job = findJob(jobs, pid);
+			if (job == NULL){
+				continue;
+			}
+			if (pid == job->pid){
+				job->status = childExitMethod;
+			}
+			addUsage(&job->usage, &usage);
+			removePid(jobs, pid);
+			if (job->running > 0){
+				continue;
+			}
+			// still goes in the trace, but isn't reported
+			recordCommand(job->cmdLine, job->pid, true, 
+					job->status, &job->start, &job->usage);
+			removeJob(jobs, job);
+			if (killed){
+				forced++;
+			}
+			else {
+				ended++;
+			}
+			continue;
+		}
+		// none of them are our children any more
+		if (pid == -1 && errno != EINTR){
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) + 
+			(now.tv_nsec - start.tv_nsec) / 1e9;
+		if (elapsed >= deadline){
+			if (killed){
+				break;
+			}
+			killJobs(jobs, SIGKILL);
+			killed = true;
+			deadline = elapsed + 1;
+			continue;
+		}
+		// sleep until a child finishes or it's time
+		if (poll(&pfd, 1, (deadline - elapsed) * 1000 + 1) > 0 &&
+				readSignals()){
+			deadline = elapsed;
+		}
+	}
+
+	// what's left couldn't be reaped, in the kernel or not our children
+	while (jobs->head){
+		removeJob(jobs, jobs->head);
+	}
+	free(jobs->slots);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - start.tv_sec) + 
+		(now.tv_nsec - start.tv_nsec) / 1e9;
+	if (total > 0){
+		fprintf(stderr, "%d job%s ended in %.3fs", total, 
+				total == 1 ? "" : "s", elapsed);
+		if (forced > 0){
+			fprintf(stderr, ", %d needed SIGKILL", forced);
+		}
+		if (total - ended - forced > 0){
+			fprintf(stderr, ", %d wouldn't die", 
+					total - ended - forced);
+		}
+		fprintf(stderr, "\n");
 	}
-	//printf("done reaping\n");
 }
 
 
@@ -594,65 +9565,92 @@ void reapBG(pid_t* pidArray, int pidCount, int* childExitMethod){
 /*******************************************************************************
  * shellLoop
  * This is the main loop for the program. The loop starts with gathering user 
- * input and then parsing it to run the proper command. 
+ * input and then parsing it to run the proper commands. A line that opens an
+ * if, while or for is parsed together with the lines up to its end, and the
+ * whole thing is run from the parsed form. The loop ends on exit or at the 
+ * end of the input, and returns the value the shell exits with.
  *
  * ****************************************************************************/
-void shellLoop(struct sigaction* normal_action){
+int shellLoop(struct inputReader* input, struct sigaction* normal_action){
 	//printf("in shellLoop\n");
 	
-	int cmdCount = 0;          // tracks number of commands entered by user
-	int bytesEntered;          // tracks bytes read from getline
-	
-	int childExitMethod = -5;  // tracks how a process exited
-	
-	bool wantToExit = false;   // user want to exit?
-	bool wantRunBG = false;    // want to run a process in background?
-	size_t size = MAXINPUT;    // how many bytes to read froom stdin
+	int bytesEntered;          // tracks bytes read from readLine
+	size_t lineLen;            // length of the line after historyExpand
+	int expanded;              // did historyExpand replace anything?
+	time_t entered = 0;        // when the line was entered
+	char cwd[4096];            // where, for the history
 
-	pid_t pidArray[50];          // hold unreaped child process id's
-	int pidCount = 0;          // tracks how many child PID's in pidArray	
+	struct shell sh = {0};     // jobs, parse memory and the last status
 	
-	// holds user input string
-	char* userInput = calloc(MAXINPUT + 1, sizeof(char));
+	// holds user input string, it points into the input buffer
+	char* userInput = NULL;
 
-	// holds tokenized user input
-	char** userCmds = calloc(MAXARGS, sizeof(char*));
+	// holds the parsed user input, allocated from the arena
+	struct node* commands;
+
+	char* waitVar;             // EXITWAIT, if set
+	char* waitEnd = NULL;      // where its number ends
+	double exitWait;           // seconds jobs get on exit before SIGKILL
+
+	initJobs(&sh.jobs);
+	sh.input = input;
+	sh.normal_action = normal_action;
 
 
 	// shell loop is here, horray!
 	do{
+		// free everything the last command used, all at once
+		arenaReset(&sh.arena);
+
 		// until we have cleared any stdinput errors and have some input
 		while(1){
-			// print the prompt
-			printPrompt();
+			// print the prompt, unless it's still showing
+			if (!promptShown){
+				printPrompt();
+			}
 
-			// get user input from stdin
-			bytesEntered = getline(&userInput, &size, stdin);	
+			// get user input
+			bytesEntered = readLine(input, &userInput);	
 			
-			// if getline was interrupted by a signal
-			if (bytesEntered == -1){
-				// clear the error
-				clearerr(stdin);
+			// if the input ran out we're done, like 'exit'
+			if (bytesEntered == -1 && input->eof){
+				break;
+			}
+			// TMOUT ran out, also like 'exit'
+			else if (bytesEntered == -1 && errno == ETIMEDOUT){
+				clearPrompt();
+				printf("timed out waiting for input: "
+						"auto-logout\n");
+				break;
+			}
+			// if readLine was woken by a signal report anything 
+			// that finished while we waited. The prompt comes 
+			// back if that printed anything, or after a ^C
+			else if (bytesEntered == -1){
+				reapChildren(&sh.jobs);
 			}
-			// else we had good input so remove the trailing
-			// newline and break so we can evaluate input
+			// else we had good input so break so we can 
+			// evaluate input
 			else{
-				userInput[strlen(userInput) - 1] = '\0';
 				break;
 			}
 		}
-		//printf("the user entered: %s\n", userInput);
-
-		//check if user wants to exit
-		if (strcmp(userInput, "exit") == 0){
-			wantToExit = true;
+		// the user pressed enter, we're off the prompt's line
+		promptShown = false;
+		if (idleTimeout > 0){
+			timerfd_settime(timerFd, 0, &(struct itimerspec){0}, 
+					NULL);
 		}
+		if (bytesEntered == -1){
+			sh.exiting = true;
+		}
+		//printf("the user entered: %s\n", userInput);
 
 		// check if user entered a blank line
 		else if (strcmp(userInput, "") == 0){
 			//printf("user entered an empty line\n");
 			// check for any finished background processes
-			reapChildren(pidArray, &pidCount, &childExitMethod);
+			reapChildren(&sh.jobs);
 			continue;    // to top of do/while loop
 		}
 
@@ -660,65 +9658,82 @@ void shellLoop(struct sigaction* normal_action){
 		else if (userInput[0] == '#'){
 			//printf("user entered a comment\n");
 			// check for any finished background processes
-			reapChildren(pidArray, &pidCount, &childExitMethod);
+			reapChildren(&sh.jobs);
 			continue;    // to top of do/while loop
 		}
 		// else we can proccess input
 		else{
-			tokenizeInput(userInput, userCmds, &cmdCount);	
-			//printInput(userCmds, cmdCount);
-			
-			// check for and expand any commands with '$$'
-			expandPID(userCmds, cmdCount); 
-			//printInput(userCmds, cmdCount);
+			// at a terminal, !! and the like are replaced first,
+			// and the line is remembered along with where and
+			// when it was entered
+			if (interactive){
+				expanded = 0;
+				if (memchr(userInput, '!', bytesEntered)){
+					expanded = historyExpand(userInput, 
+							bytesEntered, &sh.arena,
+							&userInput, &lineLen);
+				}
+				if (expanded == -1){
+					continue;
+				}
+				if (expanded == 1){
+					bytesEntered = lineLen;
+					printf("%s\n", userInput);
+				}
+				sh.histLen = 0;
+				keepHistory(&sh, userInput, bytesEntered);
+				entered = time(NULL);
+				if (getcwd(cwd, sizeof(cwd)) == NULL){
+					cwd[0] = '\0';
+				}
+			}
 
-			// already checked for 'exit' now check for cd or status
-			// check for "cd"
-			if (strcmp(userCmds[0], "cd") == 0){
-				changeDirectory(userCmds);
+			// tokenize and parse the line, and any more lines an
+			// unfinished if, while or for needs
+			commands = parseCommands(&sh, userInput, bytesEntered);
+
+			// run the commands, a ^C only stops this line. There's
+			// nothing to run in a line of only spaces, or one with
+			// a syntax error
+			if (commands){
+				runList(&sh, commands);
+				sh.interrupted = false;
 			}
-			
-			// else check for "status"
-			else if (strcmp(userCmds[0], "status") == 0){
-				checkStatus(&childExitMethod);
+			// a script with a syntax error stops there, like sh
+			else if (sh.parseError){
+				sh.status = W_EXITCODE(2, 0);
+				if (!interactive){
+					sh.exiting = true;
+					sh.exitValue = 2;
+				}
 			}
-	
-			// else we need to fork and execute a process
-			else {
-				// user wants to run process in background?
-				checkIfBG(userCmds, cmdCount, &wantRunBG);
-				// fork and execvp	
-				forkAndExec(userCmds, cmdCount,	&childExitMethod,
-					       	wantRunBG, pidArray, 
-						&pidCount, normal_action);
+			if (interactive && sh.histLine[strspn(sh.histLine, 
+						" \t")] != '\0'){
+				historyAdd(sh.histLine, sh.histLen, entered, 
+						statusValue(sh.status), cwd, 
+						&sh.arena);
 			}
 
 			// check for any finished background processes
-			reapChildren(pidArray, &pidCount, &childExitMethod);
-		}
-
-		//printf("clearing array ");
-		// free/reset array
-		int i;
-		for (i = 0; i < cmdCount; i++){
-			// check that command wasn't NULL'd out
-			if(userCmds[i]){
-				free(userCmds[i]);
-				userCmds[i] = NULL;
-			}
+			reapChildren(&sh.jobs);
 		}
-		// reset command count
-		cmdCount = 0;
 	
 	// loop while we dont want to exit
-	} while (!wantToExit);
+	} while (!sh.exiting);
 
-	// clean up the user input
-	free(userInput);
-	// kill any background processes
-	killBG(pidArray, pidCount);
-	// reap them
-	reapBG(pidArray, pidCount, &childExitMethod);
+	// clean up
+	free(sh.histLine);
+	arenaFree(&sh.arena);
+	// kill any background processes, all at once
+	killJobs(&sh.jobs, SIGTERM);
+	// reap them, giving them EXITWAIT seconds before SIGKILL
+	waitVar = getVar("EXITWAIT");
+	exitWait = waitVar ? strtod(waitVar, &waitEnd) : -1;
+	if (exitWait < 0 || waitEnd == waitVar || *waitEnd != '\0'){
+		exitWait = EXITWAIT;
+	}
+	reapJobs(&sh.jobs, exitWait);
+	return sh.exitValue;
 }
 
 
@@ -730,13 +9745,40 @@ void shellLoop(struct sigaction* normal_action){
  * starts the loop for the shell
  *
  * ****************************************************************************/
-int main(){
+int main(int argc, char** argv){
 	//printf("in main\n");
+	struct inputReader input;   // where commands are read from
+	char* command = NULL;       // the -c command
+	char* script = NULL;        // the -f script
+	int scriptFd = 0;           // fd commands are read from
+	int opt;                    // from getopt
+
+	// smallsh [-c command | -f script | script]
+	while ((opt = getopt(argc, argv, "c:f:")) != -1){
+		switch (opt){
+			case 'c':
+				command = optarg;
+				break;
+			case 'f':
+				script = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-c command | "
+						"-f script | script]\n", argv[0]);
+				exit(2);
+		}
+	}
+	if (script == NULL && optind < argc){
+		script = argv[optind];
+	}
+
+	// the environment becomes exported shell variables
+	initVars();
 
 	// signal stuff...
 	struct sigaction ignore_action = {0}, 
-			 normal_action = {0}, 
-			 SIGTSTP_action = {0};
+			 normal_action = {0};
+	sigset_t readMask;          // signals read from the signalfd
 
 	// set the structs
 	// will be used to ignore SIGINT
@@ -747,20 +9789,101 @@ int main(){
 	// used to make foreground proccs respond to SIGTSTP
 	normal_action.sa_handler = SIG_DFL;
 
-	// used to toggle canRunBG bool
-	SIGTSTP_action.sa_handler = toggleBG;
-	sigfillset(&SIGTSTP_action.sa_mask);
-	SIGTSTP_action.sa_flags = 0;
-		
-	// register the signal actions to ignore SIGINT and togglel on SIGTSTP
+	// register the signal action to ignore SIGINT
 	sigaction(SIGINT, &ignore_action, NULL);
-	sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+
+	// SIGCHLD (a child finished or stopped) and SIGINT are blocked and 
+	// read from a signalfd instead, so waitInput wakes for them along 
+	// with the input. Children get the mask we started with
+	sigemptyset(&readMask);
+	sigaddset(&readMask, SIGCHLD);
+	sigaddset(&readMask, SIGINT);
+	sigprocmask(SIG_BLOCK, &readMask, &childMask);
+	signalFd = signalfd(-1, &readMask, SFD_NONBLOCK | SFD_CLOEXEC);
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (signalFd == -1 || timerFd == -1){
+		perror("signalfd/timerfd");
+		exit(1);
+	}
+	// TMOUT=n logs out after n idle seconds at the prompt
+	char* idleEnv = getenv("TMOUT");
+	if (idleEnv){
+		idleTimeout = atol(idleEnv);
+	}
+
+	// the perf builtin's timers count ticks from here
+	startTicks = readTicks();
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+	// our pid never changes, so $$ only needs converting once
+	pidStringLen = snprintf(pidString, sizeof(pidString), "%d", getpid());
+
+	// SMALLSH_TRACE=file appends a record of every command to file
+	char* traceEnv = getenv("SMALLSH_TRACE");
+	if (traceEnv && *traceEnv){
+		traceFd = open(traceEnv, O_WRONLY | O_CREAT | O_APPEND | 
+				O_CLOEXEC, 0644);
+		if (traceFd == -1){
+			perror(traceEnv);
+		}
+	}
+
+	// SMALLSH_SPAWN=0 forces the old fork path for every command
+	char* spawnEnv = getenv("SMALLSH_SPAWN");
+	if (spawnEnv && strcmp(spawnEnv, "0") == 0){
+		useSpawn = false;
+	}
+
+	// open the script, if there is one
+	if (script && command == NULL){
+		scriptFd = open(script, O_RDONLY | O_CLOEXEC);
+		if (scriptFd == -1){
+			perror(script);
+			exit(1);
+		}
+	}
+	initInput(&input, scriptFd, command);
+
+	// only a user at a terminal gets prompts and an unbuffered stdout, 
+	// otherwise output is written out a buffer at a time
+	interactive = command == NULL && script == NULL && isatty(0);
+	if (!interactive){
+		setvbuf(stdout, NULL, _IOFBF, OUTPUTBUF);
+	}
+
+	// at a terminal we do job control: wait until we're in the 
+	// foreground, then ignore the job control signals so ^Z stops our
+	// jobs rather than us, and take the terminal with a process group of
+	// our own. A session leader already has one
+	if (interactive){
+		while (tcgetpgrp(0) != (shellPgid = getpgrp())){
+			kill(-shellPgid, SIGTTIN);
+		}
+		sigaction(SIGTSTP, &ignore_action, NULL);
+		sigaction(SIGTTIN, &ignore_action, NULL);
+		sigaction(SIGTTOU, &ignore_action, NULL);
+		if (setpgid(0, 0) == 0){
+			shellPgid = getpid();
+		}
+		tcsetpgrp(0, shellPgid);
+		tcgetattr(0, &shellModes);
+		jobControl = true;
+		// commands entered at a terminal are kept in the history
+		historySync();
+		// and can be edited as they're typed, unless the terminal 
+		// can't take it
+		char* term = getenv("TERM");
+		input.edit = isatty(STDOUT_FILENO) && 
+			(term == NULL || strcmp(term, "dumb") != 0);
+	}
 
 	// our programs loop
-	shellLoop(&normal_action);
+	int exitValue = shellLoop(&input, &normal_action);
 	
-	printf("\n");
-	exit(0);
+	if (interactive){
+		printf("\n");
+	}
+	exit(exitValue);
 }
 
 